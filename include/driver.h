@@ -53,11 +53,54 @@ extern char driver_method[];
 
 int  usb_open_rio  (rios_t *rio, int number);
 void usb_close_rio (rios_t *rio);
+/* number of attached players. number may be anything from 0 to usb_count_rio() - 1
+   when calling usb_open_rio. returns < 0 on error */
+int  usb_count_rio (void);
 
 int  read_bulk  (rios_t *rio, unsigned char *buffer, u_int32_t size);
+/* same as read_bulk but returns -ETIMEDOUT if nothing arrives within timeout usec */
+int  read_bulk_timeout (rios_t *rio, unsigned char *buffer, u_int32_t size, u_int32_t timeout);
 int  write_bulk (rios_t *rio, unsigned char *buffer, u_int32_t size);
 int  control_msg(rios_t *rio, u_int8_t request, u_int16_t value,
 		 u_int16_t index, u_int16_t length, unsigned char *buffer);
 
+/* asynchronous bulk transfers. transfers on the same endpoint complete in the order
+   they were submitted. a transfer's buffer must not be touched until it is reaped.
+   usb_reap_bulk returns the number of bytes transfered or < 0 on error. */
+#define RIO_BULK_IN  0
+#define RIO_BULK_OUT 1
+
+struct rio_xfer;
+
+int  usb_submit_bulk (rios_t *rio, int direction, unsigned char *buffer, u_int32_t size,
+		      u_int32_t timeout, struct rio_xfer **xfer);
+int  usb_reap_bulk (rios_t *rio, struct rio_xfer *xfer);
+
 void usb_setdebug(int);
+
+/* driver_emu.c: software emulated player. only available when linking against
+   librioutil_emu */
+struct emu_config {
+  char *player;      /* name of the emulated player (see player_devices) */
+  int devices;       /* number of emulated players on the bus */
+  int latency;       /* per-transfer latency in usec. -1 for the player default */
+  int bandwidth;     /* bytes/sec. -1 for the player default */
+  int ack_delay;     /* usec the player needs to commit a block. -1 for the player default */
+  u_int32_t mem_size;/* size of the internal memory in bytes */
+};
+
+struct emu_stats {
+  u_int32_t commands;
+  u_int32_t bulk_in, bulk_out;
+  u_int64_t bytes_in, bytes_out;
+
+  /* data blocks transfered and their round trip times (usec) */
+  u_int32_t blocks;
+  u_int64_t block_time;
+  u_int64_t block_min, block_max;
+};
+
+void emu_set_config (struct emu_config *config);
+int  emu_get_stats (rios_t *rio, struct emu_stats *stats);
+void emu_reset_stats (rios_t *rio);
 #endif
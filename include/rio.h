@@ -27,6 +27,7 @@ extern "C" {
 #endif
 
 #include <sys/types.h>
+#include <pthread.h>
 
 /* errors */
 #define URIO_SUCCESS 0
@@ -132,6 +133,15 @@ typedef struct _rio_device_info {
   u_int8_t serial_number[16];
 } rio_info_t;
 
+/* the files on a memory unit in file list order. used by librioutil to find
+   files without walking the list */
+typedef struct _rio_file_table {
+  flist_rio_t **entries;
+  uint size, alloc;
+  /* every file header has been read from the player */
+  int complete;
+} rio_file_table_t;
+
 typedef struct _rios {
   /* void here to avoid the user needing to define WITH_USBDEVFS and such */
   void *dev;
@@ -148,8 +158,45 @@ typedef struct _rios {
   void (*progress)(int x, int X, void *ptr);
   void *progress_ptr;
 
-  /* make rioutil thread-safe */
-  int lock;
+  /* make rioutil thread-safe (see set_lock_mode_rio) */
+  pthread_mutex_t lock;
+  int lock_mode;
+  int lock_timeout; /* ms */
+
+  /* number of times the current command has been retried */
+  int cmd_retry;
+
+  /* block acknowledgement handshake (see set_handshake_rio) */
+  int handshake;
+  u_int32_t ack_estimate; /* usec */
+
+  /* nitrus database updates deferred by begin_batch_rio */
+  int batch;    /* nesting depth */
+  int db_dirty;
+
+  /* sorted views of the file list used to build the nitrus database. private */
+  void *db_index;
+
+  /* index of rio->info.memory[].files. private */
+  rio_file_table_t file_table[MAX_MEM_UNITS];
+
+  /* allocator for the entries of rio->info.memory[].files. private */
+  void *flist_pool;
+
+  /* incremented every time a file list changes. private */
+  uint flist_gen;
+  /* open file list views (see open_flist_view_rio). private */
+  void *flist_views;
+
+  /* read file headers on demand (see RIO_OPEN_LAZY) */
+  int lazy;
+
+  /* on-disk file list cache (see RIO_OPEN_CACHED) */
+  int cache;
+  uint cache_gen; /* flist_gen when the cache was last read or written */
+
+  /* how downloaded files are written (see set_download_flags_rio) */
+  int download_flags;
 } rios_t;
 
 
@@ -162,11 +209,70 @@ typedef struct _rios {
  * rio: struct to fill with rio data
  * number:
  * debug: debug verbosity level
- * fill_structures: non-zero to fill the info structures
+ * fill_structures: non-zero to fill the info structures. RIO_OPEN_CACHED reads the
+ *                  file list from the on-disk cache when the player has not changed
+ *                  since it was written and keeps the cache up to date.
+ *
+ *                  RIO_OPEN_LAZY only reads the memory units. file headers are read
+ *                  from the player the first time they are needed.
+ *
+ * the cache lives in $RIOUTIL_CACHE_DIR or ~/.rioutil and is keyed by the player's
+ * serial number. a cached list is used only if the player's memory counters are
+ * unchanged.
  */
+#define RIO_OPEN_FILL   0x01
+#define RIO_OPEN_CACHED 0x02
+#define RIO_OPEN_LAZY   0x04
+
 int open_rio (rios_t *rio, int number, int debug, int fill_structures);
 void close_rio (rios_t *rio);
 
+/*
+ * Cache the info read from MP3 files.
+ *
+ * while enabled, the tags and frame info that add_song_rio (and the sync and
+ * prepare queues) read from an MP3 file are kept in metadata.cache next to the
+ * file list cache, keyed by the file's path, size, modification time and inode.
+ * files that have not changed since are not parsed again. the cache is shared by
+ * every player and thread in the process.
+ *
+ * enable_metadata_cache_rio: returns URIO_SUCCESS or the error that kept the cache
+ *                            from being read or created
+ */
+int  enable_metadata_cache_rio (void);
+void disable_metadata_cache_rio (void);
+
+/*
+ * Exact length of an MP3 file, counted from the samples in each of its frames.
+ *
+ * duration: set to the length in ms
+ * toc:      if not NULL, filled with a Xing compatible seek table. entry i is the
+ *           position of the frame i percent of the way into the file in 256ths of
+ *           the audio data
+ *
+ * returns URIO_SUCCESS, -EINVAL if the file does not contain MPEG audio, or the
+ * error from opening the file
+ */
+int mp3_duration_rio (char *file_name, u_int32_t *duration, unsigned char toc[100]);
+
+/*
+ * Bit rate, sample rate and tags of an MP3 stream, read from its first block so a
+ * stream can be passed to upload_stream_rio without being stored first.
+ *
+ * file: bitrate and samplerate are set. title, artist, album, genre, year and
+ *       track_number are filled in from the id3 tags if they are empty
+ * skip: set to the number of junk bytes at the start of data that should not be
+ *       uploaded
+ *
+ * returns URIO_SUCCESS, -EAGAIN if data ends before the first frames (call again
+ * with more of the stream), or -EINVAL if data does not contain MPEG audio
+ */
+int mp3_stream_info_rio (const unsigned char *data, u_int32_t size, flist_rio_t *file, u_int32_t *skip);
+
+/* returns the number of supported players attached to the system (valid device
+   numbers for open_rio are 0 to count_rio() - 1) or < 0 on error */
+int count_rio (void);
+
 int set_info_rio (rios_t *rio, rio_info_t *info);
 int set_name_rio (rios_t *rio, char *name);
 /*
@@ -185,8 +291,51 @@ int set_name_rio (rios_t *rio, char *name);
  */
 int add_song_rio (rios_t *rio, u_int8_t memory_unit, char *file_name, const char *artist, const char *title, const char *album);
 
+/*
+ * Upload a file from memory or from a callback
+ *
+ * file: describes the file. name is used on the player. title, artist, album,
+ *       genre, year, track_number, time, bitrate, samplerate and mod_date are
+ *       copied as is and may be left 0. type selects how the player treats the
+ *       file: RIO_FILETYPE_MP3, RIO_FILETYPE_PLAYLIST or 0 to go by the extension
+ *       of name. anything else is uploaded as a downloadable file
+ * buffer, size: the contents of the file
+ * callback: called to fill buffer with up to size bytes of the file. returns the
+ *           number of bytes copied, 0 at the end of the file or < 0 to abort the
+ *           upload. for streams file->size is the expected size or 0 if unknown
+ *
+ * returns: URIO_SUCCESS on successful upload, or < 0 on error
+ */
+typedef long (*rio_source_t) (unsigned char *buffer, u_int32_t size, void *ptr);
+int upload_buffer_rio (rios_t *rio, u_int8_t memory_unit, const flist_rio_t *file, const unsigned char *buffer,
+		       u_int32_t size);
+int upload_stream_rio (rios_t *rio, u_int8_t memory_unit, const flist_rio_t *file, rio_source_t callback,
+		       void *ptr);
+
 int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, char *fileName);
 
+/* download a file into a caller supplied buffer
+ *
+ * buffer: receives the file's data
+ * buffer_size: size of buffer
+ * size: receives the size of the file
+ *
+ * returns: URIO_SUCCESS on success, or < 0 on error
+ *          -EOVERFLOW if the file does not fit in buffer. size is set to the size
+ *                     of the file and nothing is downloaded
+ */
+int download_buffer_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, unsigned char *buffer,
+			 u_int32_t buffer_size, u_int32_t *size);
+
+/* download a file to a callback
+ *
+ * callback: called with each piece of the file in order. a return value < 0 aborts
+ *           the download and is returned by download_sink_rio
+ * ptr: passed to callback
+ */
+typedef int (*rio_sink_t) (const unsigned char *data, u_int32_t size, void *ptr);
+int download_sink_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, rio_sink_t callback, void *ptr);
+
 /*
  * Delete a file from the rio
  *
@@ -222,6 +371,117 @@ int get_info_rio (rios_t *rio, rio_info_t **info);
  */
 void set_progress_rio  (rios_t *rio, void (*f)(int x, int X, void *ptr), void *ptr);
 
+/* sets how the library waits for the device to acknowledge a data block
+ *
+ * RIO_HANDSHAKE_POLL:  poll for the acknowledgement with timeouts tuned to the
+ *                      player generation and the measured response time (default)
+ * RIO_HANDSHAKE_SLEEP: sleep 1 ms after each block before reading the
+ *                      acknowledgement and do not pipeline uploads (behavior
+ *                      of rioutil 1.5.3 and older)
+ *
+ * returns URIO_SUCCESS or -EINVAL if the mode is unknown
+ */
+#define RIO_HANDSHAKE_POLL  0
+#define RIO_HANDSHAKE_SLEEP 1
+int set_handshake_rio (rios_t *rio, int mode);
+
+/* sets how download_file_rio writes the downloaded file. the file is always
+ * preallocated and written from a separate thread.
+ *
+ * RIO_DOWNLOAD_DIRECT: bypass the page cache (O_DIRECT) if the system and file
+ *                      system support it
+ *
+ * returns URIO_SUCCESS or -EINVAL if a flag is unknown
+ */
+#define RIO_DOWNLOAD_DIRECT 0x01
+int set_download_flags_rio (rios_t *rio, int flags);
+
+/* sets what happens when a thread calls into the library while another thread
+ * is using the same rio. a thread may call into the library recursively (i.e.
+ * from a progress callback) without blocking.
+ *
+ * RIO_LOCK_TRY:   fail with -EBUSY (default)
+ * RIO_LOCK_BLOCK: wait until the rio is available
+ * RIO_LOCK_TIMED: wait up to timeout ms then fail with -ETIMEDOUT
+ *
+ * must be called after open_rio. returns URIO_SUCCESS or -EINVAL
+ */
+#define RIO_LOCK_TRY   0
+#define RIO_LOCK_BLOCK 1
+#define RIO_LOCK_TIMED 2
+int set_lock_mode_rio (rios_t *rio, int mode, int timeout);
+
+/*
+ * Upload the same files to every attached player in parallel.
+ *
+ * sync_open_rio opens every player found by count_rio, each from its own worker
+ * thread. Files queued with sync_add_rio are uploaded to each player that opened
+ * successfully; every player works through the shared queue at its own pace so a
+ * slow player does not hold up the others.
+ *
+ * sync_open_rio:   returns URIO_SUCCESS if at least one player was opened, -ENOENT
+ *                  if no players are attached, or the error from open_rio
+ * sync_players_rio: returns the number of players found. players that could not
+ *                  be opened are reported by sync_status_rio
+ * sync_add_rio:    queues a file (see add_song_rio). returns URIO_SUCCESS or -ENOMEM
+ * sync_wait_rio:   waits until every player has processed the queue. returns
+ *                  URIO_SUCCESS if all uploads succeeded, the error from a failed
+ *                  database update, or -EIO if an upload failed
+ * sync_status_rio: number of files uploaded to/failed on a player. returns the
+ *                  error that kept the player from opening, or URIO_SUCCESS
+ * sync_close_rio:  finishes the queue, closes all players, and frees sync
+ */
+typedef struct rio_sync rio_sync_t;
+
+int  sync_open_rio (rio_sync_t **sync, int debug);
+int  sync_players_rio (rio_sync_t *sync);
+int  sync_add_rio (rio_sync_t *sync, u_int8_t memory_unit, char *file_name, const char *artist,
+		   const char *title, const char *album);
+int  sync_wait_rio (rio_sync_t *sync);
+int  sync_status_rio (rio_sync_t *sync, int player, int *uploaded, int *failed);
+void sync_close_rio (rio_sync_t *sync);
+
+/*
+ * Read the tags of files on other threads while uploading.
+ *
+ * prepare_open_rio starts threads workers (one per processor if threads is 0)
+ * that parse the MPEG frames and id3 tags of the files queued with
+ * prepare_add_rio, in queue order. add_prepared_song_rio uploads a queued file
+ * with the info the workers found, waiting for them if they have not reached it
+ * yet, so the next files are parsed while the player is busy with this one.
+ *
+ * prepare_open_rio:      returns URIO_SUCCESS, -ENOMEM, or -EAGAIN if no worker
+ *                        could be started
+ * prepare_add_rio:       queues a file (see add_song_rio). returns the index of the
+ *                        file in the queue or -ENOMEM
+ * add_prepared_song_rio: uploads the queued file at index. each file can be
+ *                        uploaded once. returns the same as add_song_rio
+ * prepare_close_rio:     stops the workers and frees prepare along with the info of
+ *                        any file that was not uploaded
+ */
+typedef struct rio_prepare rio_prepare_t;
+
+int  prepare_open_rio (rio_prepare_t **prepare, int threads);
+int  prepare_add_rio (rio_prepare_t *prepare, char *file_name, const char *artist,
+		      const char *title, const char *album);
+int  add_prepared_song_rio (rios_t *rio, u_int8_t memory_unit, rio_prepare_t *prepare, int index);
+void prepare_close_rio (rio_prepare_t *prepare);
+
+/* group several uploads/deletes together
+ *
+ * the Rio Nitrus keeps a database of its songs that librioutil rebuilds and
+ * sends to the player after every upload or delete. between begin_batch_rio
+ * and commit_batch_rio the database is only marked out of date and is sent
+ * once by the commit. batches may be nested; the database is sent when the
+ * outermost batch is committed (or by close_rio if a batch is left open).
+ * has no effect on other players.
+ *
+ * returns URIO_SUCCESS, -EINVAL if no batch is open (commit), or the error
+ * from updating the database
+ */
+int begin_batch_rio (rios_t *rio);
+int commit_batch_rio (rios_t *rio);
+
 /* These only work with S-Series or newer Rios */
 int create_playlist_rio (rios_t *rio, char *name, uint songs[], uint memory_units[], uint nsongs);
 /* Get a playlist from the Rio (newer generation or all?)
@@ -273,9 +533,33 @@ int return_time_rio (rios_t *rio, u_int8_t memory_unit);
 /* retrieve a copy of the file list and store it in flist */
 int return_flist_rio (rios_t *rio, u_int8_t memory_unit, rio_filetype list_flags, flist_rio_t **flist);
 
-/* Free the memory used by flist */
+/* Free the memory used by flist. flist must be the head of a list returned by
+   return_flist_rio */
 void free_flist_rio (flist_rio_t *flist);
 
+/* read-only view of the rio's file list. the view holds pointers to the rio's own entries
+ * so opening a view does not copy them.
+ *
+ * open_flist_view_rio: returns a view of the files on memory_unit whose type is in
+ *                      list_flags. opening the same view again before the list changes
+ *                      returns the existing view with its reference count incremented.
+ * flist_view_size_rio: returns the number of entries in the view
+ * flist_view_entry_rio: returns entry i of the view
+ * close_flist_view_rio: drops a reference to the view
+ *
+ * a view goes stale when the file list changes (uploads, deletes, update_info_rio,
+ * close_rio) because the entries it points to may be gone. a stale view returns -ESTALE
+ * for its size and NULL for its entries and must still be closed. a walk that stops on
+ * NULL before flist_view_size_rio entries (or that size returns -ESTALE afterwards) saw
+ * only part of the list.
+ */
+typedef struct _rio_flist_view rio_flist_view_t;
+
+int open_flist_view_rio (rios_t *rio, u_int8_t memory_unit, rio_filetype list_flags, rio_flist_view_t **view);
+int flist_view_size_rio (rio_flist_view_t *view);
+const flist_rio_t *flist_view_entry_rio (rio_flist_view_t *view, int i);
+void close_flist_view_rio (rio_flist_view_t *view);
+
 char *return_file_name_rio (rios_t *rio, u_int32_t song_id, u_int8_t memory_unit);
 /* returns filesize in KB, or < 0 on error */
 int return_file_size_rio (rios_t *rio, u_int32_t song_id, u_int8_t memory_unit);
@@ -533,6 +533,19 @@ typedef struct _rio_prefs {
   u_int8_t unk5[1952];
 } rio_prefs_t;
 
+/* a data block of a pipelined upload (see rioio.c) */
+struct rio_xfer;
+
+typedef struct _rio_block {
+  unsigned char header[64];
+  unsigned char ack[64];
+
+  unsigned char *data;
+  u_int32_t size;
+
+  struct rio_xfer *xfer[3];
+} rio_block_t;
+
 typedef struct _info_page {
     rio_file_t *data;
 
@@ -602,6 +615,7 @@ typedef struct _rio_lst {
 
 int  wake_rio     (rios_t *rio);
 int  try_lock_rio (rios_t *rio);
+void lock_rio     (rios_t *rio);
 void unlock_rio   (rios_t *rio);
 
 /* rio.c : used to build a rios_t */
@@ -619,36 +633,98 @@ int read_block_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, u_int32_t b
 int write_cksum_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksum_hdr);
 int write_block_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksum_hdr);
 int abort_transfer_rio (rios_t *rio);
+void prepare_block_rio (rios_t *rio, rio_block_t *block, u_int32_t size, char *cksum_hdr);
+int start_block_rio (rios_t *rio, rio_block_t *block);
+int finish_block_rio (rios_t *rio, rio_block_t *block);
 int send_command_rio (rios_t *rio, int request, int value, int index);
 
+/* a file mapped into memory for the MPEG and id3 parsers (see mp3.c) */
+typedef struct _rio_media {
+  const unsigned char *data;
+  size_t size;
+
+  time_t mtime;
+  long mtime_nsec; /* 0 if the system does not have it */
+  dev_t dev;
+  ino_t ino;
+
+  int mapped;
+} rio_media_t;
+
 /* id3.c */
-int get_id3_info (char *file_name, rio_file_t *mp3_file);
+int get_id3_info (rio_media_t *media, char *file_name, rio_file_t *mp3_file);
 int id3v2_size (unsigned char data[14]);
 
 /* mp3.c, downloadable.c */
+int media_open_rio (rio_media_t *media, const char *file_name);
+void media_close_rio (rio_media_t *media);
 int mp3_info (info_page_t *newInfo, char *file_name);
 int downloadable_info (info_page_t *newInfo, char *file_name);
 
 /* file_list.c */
-int generate_flist_riomc (rios_t *rio, u_int8_t memory_unit);
+int generate_flist_riomc (rios_t *rio, u_int8_t memory_unit, uint count);
 int generate_flist_riohd (rios_t *rio);
 int flist_add_rio (rios_t *rio, int memory_unit, info_page_t info);
+int flist_append_rio (rios_t *rio, int memory_unit, const flist_rio_t *entry);
+int flist_add_riohd (rios_t *rio, hd_file_t *hdf);
+int flist_load_rio (rios_t *rio, u_int8_t memory_unit, uint count);
+void flist_discard_rio (rios_t *rio, u_int8_t memory_unit);
 int flist_remove_rio (rios_t *rio, uint memory_unit, uint file_no);
 int flist_get_file_name_rio (rios_t *rio, uint memory_unit, uint file_no, char *file_namep, int file_name_len);
 int flist_get_file_id_rio (rios_t *rio, uint memory_unit, uint file_no);
 int size_flist_rio (rios_t *rio, int memory_unit);
 int flist_first_free_rio (rios_t *rio, int memory_unit);
 flist_rio_t *get_flist_rio (rios_t *rio, uint memory_unit, uint file_no);
+void flist_table_free_rio (rios_t *rio);
+void flist_pool_reset_rio (rios_t *rio);
+void flist_pool_free_rio (rios_t *rio);
+void flist_clear_rio (rios_t *rio);
+void flist_views_detach_rio (rios_t *rio);
 
 /* song_management.c */
-int do_upload (rios_t *rio, u_int8_t memory_unit, int addpipe, info_page_t info, int overwrite);
+/* origin of an upload */
+struct rio_source {
+  rio_source_t read;
+  void *ptr;
+};
+
+int do_upload (rios_t *rio, u_int8_t memory_unit, struct rio_source *source, info_page_t info, int overwrite);
+int song_info_rio (info_page_t *song_info, char *file_name, const char *artist,
+		   const char *title, const char *album);
+int upload_song_info_rio (rios_t *rio, u_int8_t memory_unit, char *file_name, info_page_t *song_info);
+
+/* destination of a download (see download.c) */
+struct rio_sink {
+  /* called with the size of the file before any data is requested */
+  int (*open) (void *ptr, u_int32_t size);
+  /* space for the next RIO_FTS byte block. NULL aborts the download */
+  unsigned char *(*reserve) (void *ptr);
+  /* the first size bytes of the reserved space are file data */
+  int (*commit) (void *ptr, u_int32_t size);
+  /* called once the download ends if open succeeded. returns the result of the download */
+  int (*close) (void *ptr, int ret);
+
+  void *ptr;
+};
+
+int do_download (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, struct rio_sink *sink);
 int update_db_rio (rios_t *rio);
+int db_changed_rio (rios_t *rio);
+/* keep the sorted database index in sync with memory unit 0's file list */
+void db_index_add_rio (rios_t *rio, flist_rio_t *flist);
+void db_index_remove_rio (rios_t *rio, flist_rio_t *flist);
+void db_index_free_rio (rios_t *rio);
+
+/* cache.c */
+int load_flist_cache_rio (rios_t *rio);
+int save_flist_cache_rio (rios_t *rio);
+int metadata_cache_lookup_rio (char *file_name, info_page_t *info);
+int metadata_cache_store_rio (char *file_name, rio_media_t *media, info_page_t *info);
 
 /* cksum.c */
 u_int32_t crc32_rio (u_int8_t *, size_t);
 
 /* playlist.c */
-int new_playlist_info (info_page_t *newInfo, char *name);
 int playlist_info (info_page_t *newInfo, char *file_name);
 
 
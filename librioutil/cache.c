@@ -0,0 +1,770 @@
+/**
+ *   (c) 2026 agent <agent@local>
+ *   v1.5.4 cache.c
+ *
+ *   On-disk caches of the file list, keyed by the player's serial number, and
+ *   of the info read from MP3 files, keyed by their path.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ **/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "rioi.h"
+#include "riolog.h"
+
+/*
+  The cache is a header, one record per memory unit and then the file list entries
+  of each memory unit in list order. It is only meant to be read back on the host
+  that wrote it so everything is stored in host byte order.
+
+  A cached list is used only if the memory counters the player reports still match
+  the ones recorded when the cache was written. Anything that adds or removes a file
+  changes the used and free counters.
+*/
+#define CACHE_MAGIC   "RIOCACHE"
+#define CACHE_VERSION 1
+
+struct cache_header {
+  char magic[8];
+  u_int32_t version;
+  u_int32_t entry_size;
+
+  u_int8_t serial_number[16];
+  u_int32_t type;
+  u_int32_t total_memory_units;
+};
+
+struct cache_unit {
+  u_int32_t size, used, free;
+  char name[32];
+  u_int32_t num_files;
+};
+
+static int cache_dir_rio (char *dir, size_t dir_len) {
+  char *env;
+
+  if ((env = getenv ("RIOUTIL_CACHE_DIR")) != NULL)
+    snprintf (dir, dir_len, "%s", env);
+  else if ((env = getenv ("HOME")) != NULL)
+    snprintf (dir, dir_len, "%s/.rioutil", env);
+  else
+    return -ENOENT;
+
+  if (mkdir (dir, 0700) < 0 && errno != EEXIST)
+    return -errno;
+
+  return URIO_SUCCESS;
+}
+
+static int cache_path_rio (rios_t *rio, char *path, size_t path_len) {
+  char dir[PATH_MAX];
+  int i, len, ret;
+
+  for (i = 0 ; i < 16 && rio->info.serial_number[i] == 0 ; i++);
+
+  /* nothing to key the cache on */
+  if (i == 16)
+    return -ENOENT;
+
+  ret = cache_dir_rio (dir, PATH_MAX);
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  len = snprintf (path, path_len, "%s/", dir);
+
+  for (i = 0 ; i < 16 ; i++)
+    len += snprintf (path + len, path_len - len, "%02x", rio->info.serial_number[i]);
+
+  snprintf (path + len, path_len - len, ".cache");
+
+  return URIO_SUCCESS;
+}
+
+static int cache_read_units (rios_t *rio, FILE *fh, struct cache_header *header, struct cache_unit *units) {
+  rio_mem_t memory;
+  uint i;
+  int ret;
+
+  if (fread (header, sizeof (struct cache_header), 1, fh) != 1)
+    return -EIO;
+
+  if (memcmp (header->magic, CACHE_MAGIC, 8) || header->version != CACHE_VERSION ||
+      header->entry_size != sizeof (flist_rio_t) || header->type != (u_int32_t) return_type_rio (rio) ||
+      memcmp (header->serial_number, rio->info.serial_number, 16) ||
+      header->total_memory_units == 0 || header->total_memory_units > MAX_MEM_UNITS)
+    return -EINVAL;
+
+  if (fread (units, sizeof (struct cache_unit), header->total_memory_units, fh) != header->total_memory_units)
+    return -EIO;
+
+  /* the cache is only good if nothing was added or removed since it was written */
+  for (i = 0 ; i < header->total_memory_units ; i++) {
+    ret = get_memory_info_rio (rio, &memory, i);
+    if (ret != URIO_SUCCESS)
+      return -ESTALE;
+
+    if (memory.size != units[i].size || memory.used != units[i].used || memory.free != units[i].free) {
+      debug ("load_flist_cache_rio: memory unit %d changed since the cache was written", i);
+      return -ESTALE;
+    }
+  }
+
+  /* a memory unit was inserted */
+  if (return_type_rio (rio) != RIORIOT && i < MAX_MEM_UNITS &&
+      get_memory_info_rio (rio, &memory, i) == URIO_SUCCESS)
+    return -ESTALE;
+
+  return URIO_SUCCESS;
+}
+
+/*
+  load_flist_cache_rio:
+
+  Fills in the memory and file lists from the cache. Returns < 0 if the cache does not
+  exist or does not match the player, in which case the lists must be read from the
+  player.
+*/
+int load_flist_cache_rio (rios_t *rio) {
+  struct cache_header header;
+  struct cache_unit units[MAX_MEM_UNITS];
+  flist_rio_t *entries[MAX_MEM_UNITS];
+  char path[PATH_MAX];
+  FILE *fh;
+  uint i, j;
+  int ret;
+
+  ret = cache_path_rio (rio, path, PATH_MAX);
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  fh = fopen (path, "rb");
+  if (fh == NULL)
+    return -errno;
+
+  memset (entries, 0, sizeof (entries));
+
+  ret = cache_read_units (rio, fh, &header, units);
+
+  /* read every entry before touching the file list */
+  for (i = 0 ; ret == URIO_SUCCESS && i < header.total_memory_units ; i++) {
+    if (units[i].num_files > MAX_RIO_FILES) {
+      ret = -EINVAL;
+      break;
+    }
+
+    entries[i] = (flist_rio_t *) malloc ((units[i].num_files + 1) * sizeof (flist_rio_t));
+    if (entries[i] == NULL) {
+      ret = -ENOMEM;
+      break;
+    }
+
+    if (fread (entries[i], sizeof (flist_rio_t), units[i].num_files, fh) != units[i].num_files) {
+      ret = -EIO;
+      break;
+    }
+
+    /* the file table relies on file ids increasing along the list */
+    for (j = 1 ; j < units[i].num_files ; j++)
+      if (entries[i][j].rio_num <= entries[i][j - 1].rio_num) {
+	ret = -EINVAL;
+	break;
+      }
+  }
+
+  fclose (fh);
+
+  if (ret == URIO_SUCCESS) {
+    flist_clear_rio (rio);
+    memset (rio->info.memory, 0, sizeof (mlist_rio_t) * MAX_MEM_UNITS);
+
+    rio->info.total_memory_units = header.total_memory_units;
+
+    for (i = 0 ; ret == URIO_SUCCESS && i < header.total_memory_units ; i++) {
+      rio->info.memory[i].size = units[i].size;
+      rio->info.memory[i].free = units[i].free;
+      strncpy (rio->info.memory[i].name, units[i].name, sizeof (rio->info.memory[i].name) - 1);
+      rio->info.memory[i].name[sizeof (rio->info.memory[i].name) - 1] = '\0';
+
+      for (j = 0 ; j < units[i].num_files ; j++) {
+	ret = flist_append_rio (rio, i, &entries[i][j]);
+	if (ret != URIO_SUCCESS)
+	  break;
+      }
+
+      rio->file_table[i].complete = 1;
+    }
+
+    if (ret != URIO_SUCCESS) {
+      /* throw away the partial list */
+      flist_clear_rio (rio);
+      memset (rio->info.memory, 0, sizeof (mlist_rio_t) * MAX_MEM_UNITS);
+    } else
+      rio->cache_gen = rio->flist_gen;
+  }
+
+  for (i = 0 ; i < MAX_MEM_UNITS ; i++)
+    free (entries[i]);
+
+  if (ret == URIO_SUCCESS)
+    debug ("load_flist_cache_rio: loaded the file list from %s", path);
+  else
+    debug ("load_flist_cache_rio: could not use %s: %d", path, ret);
+
+  return ret;
+}
+
+/*
+  save_flist_cache_rio:
+
+  Writes the memory and file lists to the cache if they changed since the cache was
+  last read or written.
+*/
+int save_flist_cache_rio (rios_t *rio) {
+  struct cache_header header;
+  struct cache_unit unit;
+  rio_mem_t memory;
+  char path[PATH_MAX], tmp_path[PATH_MAX + 8];
+  flist_rio_t entry;
+  uint i, j;
+  FILE *fh;
+  int ret;
+
+  /* no file list to save */
+  if (rio->info.memory[0].size == 0 || rio->info.total_memory_units == 0)
+    return -ENOENT;
+
+  for (i = 0 ; i < rio->info.total_memory_units ; i++)
+    if (!rio->file_table[i].complete)
+      return -ENOENT;
+
+  if (rio->cache_gen == rio->flist_gen)
+    return URIO_SUCCESS;
+
+  ret = cache_path_rio (rio, path, PATH_MAX);
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", path);
+
+  fh = fopen (tmp_path, "wb");
+  if (fh == NULL) {
+    warning ("save_flist_cache_rio: could not create %s: %s", tmp_path, strerror (errno));
+    return -errno;
+  }
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, CACHE_MAGIC, 8);
+  header.version    = CACHE_VERSION;
+  header.entry_size = sizeof (flist_rio_t);
+  memcpy (header.serial_number, rio->info.serial_number, 16);
+  header.type       = return_type_rio (rio);
+  header.total_memory_units = rio->info.total_memory_units;
+
+  if (fwrite (&header, sizeof (header), 1, fh) != 1)
+    ret = -EIO;
+
+  /* record the counters as they are now. uploads and deletes change them */
+  for (i = 0 ; ret == URIO_SUCCESS && i < header.total_memory_units ; i++) {
+    ret = get_memory_info_rio (rio, &memory, i);
+    if (ret != URIO_SUCCESS) {
+      ret = -EIO;
+      break;
+    }
+
+    memset (&unit, 0, sizeof (unit));
+    unit.size = memory.size;
+    unit.used = memory.used;
+    unit.free = memory.free;
+    strncpy (unit.name, rio->info.memory[i].name, sizeof (unit.name) - 1);
+    unit.num_files = size_flist_rio (rio, i);
+
+    if (fwrite (&unit, sizeof (unit), 1, fh) != 1)
+      ret = -EIO;
+  }
+
+  for (i = 0 ; ret == URIO_SUCCESS && i < header.total_memory_units ; i++)
+    for (j = 0 ; j < rio->file_table[i].size ; j++) {
+      entry = *(rio->file_table[i].entries[j]);
+      entry.prev = entry.next = NULL;
+
+      if (fwrite (&entry, sizeof (entry), 1, fh) != 1) {
+	ret = -EIO;
+	break;
+      }
+    }
+
+  if (fclose (fh) != 0 && ret == URIO_SUCCESS)
+    ret = -EIO;
+
+  if (ret == URIO_SUCCESS && rename (tmp_path, path) < 0)
+    ret = -errno;
+
+  if (ret != URIO_SUCCESS) {
+    warning ("save_flist_cache_rio: could not write %s: %d", path, ret);
+    unlink (tmp_path);
+
+    return ret;
+  }
+
+  debug ("save_flist_cache_rio: wrote the file list to %s", path);
+
+  rio->cache_gen = rio->flist_gen;
+
+  return URIO_SUCCESS;
+}
+
+/*
+  The metadata cache is a header followed by a log of records, each a
+  metadata_record, the path, and the used part of the rio_file_t that mp3_info
+  filled in (the rest of it is zero). New records are appended as files are parsed.
+  When a path appears more than once the last record wins. The log is rewritten
+  when it is mostly stale records. Like the file list cache it is stored in host
+  byte order.
+*/
+#define METADATA_MAGIC   "RIOMETA1"
+/* bumped whenever mp3_info changes what it finds */
+#define METADATA_VERSION 3
+
+/* initial number of hash buckets. the table doubles when it has twice as many entries */
+#define METADATA_BUCKETS 1024
+
+struct metadata_header {
+  char magic[8];
+  u_int32_t version;
+  u_int32_t info_size;
+};
+
+struct metadata_record {
+  u_int64_t size, mtime, ino, dev;
+  u_int32_t mtime_nsec;
+  int32_t skip;
+  u_int32_t path_len, data_len;
+};
+
+struct metadata_entry {
+  struct metadata_entry *next;
+  u_int32_t hash;
+
+  struct metadata_record record;
+  char *path;
+  unsigned char *data;
+};
+
+static struct {
+  pthread_mutex_t lock;
+
+  int fd; /* open for appending when enabled, otherwise -1 */
+  struct metadata_entry **buckets;
+  u_int32_t num_buckets, num_entries;
+  /* records read from the log that were replaced by later ones */
+  u_int32_t stale;
+} metadata_cache = {PTHREAD_MUTEX_INITIALIZER, -1, NULL, 0, 0, 0};
+
+static u_int32_t metadata_hash (const char *path) {
+  u_int32_t hash = 2166136261u;
+
+  /* FNV-1a */
+  for ( ; *path ; path++)
+    hash = (hash ^ (unsigned char) *path) * 16777619u;
+
+  return hash;
+}
+
+static struct metadata_entry *metadata_find (const char *path, u_int32_t hash) {
+  struct metadata_entry *entry;
+
+  if (metadata_cache.num_buckets == 0)
+    return NULL;
+
+  for (entry = metadata_cache.buckets[hash % metadata_cache.num_buckets] ; entry ; entry = entry->next)
+    if (entry->hash == hash && strcmp (entry->path, path) == 0)
+      return entry;
+
+  return NULL;
+}
+
+static int metadata_grow (void) {
+  struct metadata_entry **buckets, *entry, *next;
+  u_int32_t i, num_buckets;
+
+  num_buckets = metadata_cache.num_buckets ? metadata_cache.num_buckets * 2 : METADATA_BUCKETS;
+
+  buckets = (struct metadata_entry **) calloc (num_buckets, sizeof (struct metadata_entry *));
+  if (buckets == NULL)
+    return -ENOMEM;
+
+  for (i = 0 ; i < metadata_cache.num_buckets ; i++)
+    for (entry = metadata_cache.buckets[i] ; entry ; entry = next) {
+      next = entry->next;
+      entry->next = buckets[entry->hash % num_buckets];
+      buckets[entry->hash % num_buckets] = entry;
+    }
+
+  free (metadata_cache.buckets);
+
+  metadata_cache.buckets     = buckets;
+  metadata_cache.num_buckets = num_buckets;
+
+  return URIO_SUCCESS;
+}
+
+/* adds or replaces the entry for path. the path and data are copied */
+static int metadata_insert (struct metadata_record *record, const char *path, const unsigned char *data) {
+  struct metadata_entry *entry, **prev;
+  u_int32_t hash = metadata_hash (path);
+
+  /* a table that could not grow still works, just slower */
+  if (metadata_cache.num_entries >= metadata_cache.num_buckets * 2 && metadata_grow () != URIO_SUCCESS &&
+      metadata_cache.num_buckets == 0)
+    return -ENOMEM;
+
+  entry = (struct metadata_entry *) malloc (sizeof (struct metadata_entry) + record->path_len + 1 +
+					    record->data_len);
+  if (entry == NULL)
+    return -ENOMEM;
+
+  entry->hash   = hash;
+  entry->record = *record;
+  entry->path   = (char *) (entry + 1);
+  entry->data   = (unsigned char *) entry->path + record->path_len + 1;
+
+  memcpy (entry->path, path, record->path_len);
+  entry->path[record->path_len] = '\0';
+  memcpy (entry->data, data, record->data_len);
+
+  for (prev = &metadata_cache.buckets[hash % metadata_cache.num_buckets] ; *prev ; prev = &(*prev)->next)
+    if ((*prev)->hash == hash && strcmp ((*prev)->path, path) == 0) {
+      /* replace the old entry */
+      entry->next = (*prev)->next;
+      free (*prev);
+      *prev = entry;
+
+      metadata_cache.stale++;
+
+      return URIO_SUCCESS;
+    }
+
+  entry->next = metadata_cache.buckets[hash % metadata_cache.num_buckets];
+  metadata_cache.buckets[hash % metadata_cache.num_buckets] = entry;
+  metadata_cache.num_entries++;
+
+  return URIO_SUCCESS;
+}
+
+static void metadata_free (void) {
+  struct metadata_entry *entry, *next;
+  u_int32_t i;
+
+  for (i = 0 ; i < metadata_cache.num_buckets ; i++)
+    for (entry = metadata_cache.buckets[i] ; entry ; entry = next) {
+      next = entry->next;
+      free (entry);
+    }
+
+  free (metadata_cache.buckets);
+
+  metadata_cache.buckets     = NULL;
+  metadata_cache.num_buckets = metadata_cache.num_entries = metadata_cache.stale = 0;
+}
+
+static int metadata_write_entry (FILE *fh, struct metadata_entry *entry) {
+  if (fwrite (&entry->record, sizeof (struct metadata_record), 1, fh) != 1 ||
+      fwrite (entry->path, 1, entry->record.path_len, fh) != entry->record.path_len ||
+      fwrite (entry->data, 1, entry->record.data_len, fh) != entry->record.data_len)
+    return -EIO;
+
+  return URIO_SUCCESS;
+}
+
+/* write a fresh log with only the current entries */
+static int metadata_rewrite (const char *path) {
+  struct metadata_header header;
+  struct metadata_entry *entry;
+  char tmp_path[PATH_MAX + 8];
+  int ret = URIO_SUCCESS;
+  u_int32_t i;
+  FILE *fh;
+
+  snprintf (tmp_path, sizeof (tmp_path), "%s.tmp", path);
+
+  fh = fopen (tmp_path, "wb");
+  if (fh == NULL)
+    return -errno;
+
+  memset (&header, 0, sizeof (header));
+  memcpy (header.magic, METADATA_MAGIC, 8);
+  header.version   = METADATA_VERSION;
+  header.info_size = sizeof (rio_file_t);
+
+  if (fwrite (&header, sizeof (header), 1, fh) != 1)
+    ret = -EIO;
+
+  for (i = 0 ; ret == URIO_SUCCESS && i < metadata_cache.num_buckets ; i++)
+    for (entry = metadata_cache.buckets[i] ; ret == URIO_SUCCESS && entry ; entry = entry->next)
+      ret = metadata_write_entry (fh, entry);
+
+  if (fclose (fh) != 0 && ret == URIO_SUCCESS)
+    ret = -EIO;
+
+  if (ret == URIO_SUCCESS && rename (tmp_path, path) < 0)
+    ret = -errno;
+
+  if (ret != URIO_SUCCESS)
+    unlink (tmp_path);
+  else
+    metadata_cache.stale = 0;
+
+  return ret;
+}
+
+/* read the log at path. returns < 0 if it does not exist or is not a metadata cache. damaged is
+   set if the log ends with a partial record */
+static int metadata_load (const char *path, int *damaged) {
+  struct metadata_header header;
+  struct metadata_record record;
+  char entry_path[PATH_MAX];
+  unsigned char data[sizeof (rio_file_t)];
+  int ret = URIO_SUCCESS;
+  long good;
+  FILE *fh;
+
+  fh = fopen (path, "rb");
+  if (fh == NULL)
+    return -errno;
+
+  if (fread (&header, sizeof (header), 1, fh) != 1 || memcmp (header.magic, METADATA_MAGIC, 8) ||
+      header.version != METADATA_VERSION || header.info_size != sizeof (rio_file_t)) {
+    fclose (fh);
+    return -EINVAL;
+  }
+
+  good = ftell (fh);
+
+  /* a record at the end that was cut off while being appended is ignored */
+  while (ret == URIO_SUCCESS && fread (&record, sizeof (record), 1, fh) == 1) {
+    if (record.path_len == 0 || record.path_len >= PATH_MAX || record.data_len > sizeof (rio_file_t))
+      break;
+
+    if (fread (entry_path, 1, record.path_len, fh) != record.path_len ||
+	fread (data, 1, record.data_len, fh) != record.data_len)
+      break;
+
+    entry_path[record.path_len] = '\0';
+
+    ret = metadata_insert (&record, entry_path, data);
+
+    good = ftell (fh);
+  }
+
+  fseek (fh, 0, SEEK_END);
+  *damaged = (ftell (fh) != good);
+
+  fclose (fh);
+
+  return ret;
+}
+
+/*
+  enable_metadata_cache_rio:
+
+  Reads the metadata cache and starts adding the info of newly parsed files to it.
+*/
+int enable_metadata_cache_rio (void) {
+  char dir[PATH_MAX], path[PATH_MAX + 16];
+  int ret, fd, damaged = 0;
+
+  pthread_mutex_lock (&metadata_cache.lock);
+
+  if (metadata_cache.fd >= 0) {
+    pthread_mutex_unlock (&metadata_cache.lock);
+    return URIO_SUCCESS;
+  }
+
+  ret = cache_dir_rio (dir, PATH_MAX);
+  if (ret != URIO_SUCCESS) {
+    pthread_mutex_unlock (&metadata_cache.lock);
+    return ret;
+  }
+
+  snprintf (path, sizeof (path), "%s/metadata.cache", dir);
+
+  ret = metadata_load (path, &damaged);
+  if (ret == URIO_SUCCESS) {
+    /* records can not be appended after a partial one. otherwise rewrite the log once
+       most of it was replaced */
+    if (damaged)
+      ret = metadata_rewrite (path);
+    else if (metadata_cache.stale > 1024 && metadata_cache.stale > metadata_cache.num_entries)
+      (void) metadata_rewrite (path);
+  } else if (ret != -ENOMEM) {
+    debug ("enable_metadata_cache_rio: starting a new cache in %s: %d", path, ret);
+
+    metadata_free ();
+
+    ret = metadata_rewrite (path);
+  }
+
+  if (ret != URIO_SUCCESS) {
+    warning ("enable_metadata_cache_rio: could not use %s: %d", path, ret);
+
+    metadata_free ();
+    pthread_mutex_unlock (&metadata_cache.lock);
+
+    return ret;
+  }
+
+  fd = open (path, O_WRONLY | O_APPEND);
+  if (fd < 0) {
+    ret = -errno;
+
+    metadata_free ();
+    pthread_mutex_unlock (&metadata_cache.lock);
+
+    return ret;
+  }
+
+  metadata_cache.fd = fd;
+
+  debug ("enable_metadata_cache_rio: %u files in %s", metadata_cache.num_entries, path);
+
+  pthread_mutex_unlock (&metadata_cache.lock);
+
+  return URIO_SUCCESS;
+}
+
+void disable_metadata_cache_rio (void) {
+  pthread_mutex_lock (&metadata_cache.lock);
+
+  if (metadata_cache.fd >= 0) {
+    close (metadata_cache.fd);
+    metadata_cache.fd = -1;
+  }
+
+  metadata_free ();
+
+  pthread_mutex_unlock (&metadata_cache.lock);
+}
+
+/*
+  metadata_cache_lookup_rio:
+
+  Fills in info with the cached info of file_name if the file has not changed
+  since it was cached. Returns < 0 if the file has to be parsed.
+*/
+int metadata_cache_lookup_rio (char *file_name, info_page_t *info) {
+  struct metadata_entry *entry;
+  char path[PATH_MAX];
+  struct stat statinfo;
+  u_int32_t mtime_nsec = 0;
+  int ret = -ENOENT;
+
+  /* unlocked check. the cache is only enabled or disabled between uploads */
+  if (metadata_cache.fd < 0)
+    return -ENOENT;
+
+  if (realpath (file_name, path) == NULL || stat (path, &statinfo) < 0)
+    return -ENOENT;
+
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+  mtime_nsec = statinfo.st_mtim.tv_nsec;
+#endif
+
+  pthread_mutex_lock (&metadata_cache.lock);
+
+  entry = metadata_find (path, metadata_hash (path));
+  if (entry != NULL && entry->record.size == (u_int64_t) statinfo.st_size &&
+      entry->record.mtime == (u_int64_t) statinfo.st_mtime && entry->record.mtime_nsec == mtime_nsec &&
+      entry->record.ino == (u_int64_t) statinfo.st_ino && entry->record.dev == (u_int64_t) statinfo.st_dev) {
+    memcpy (info->data, entry->data, entry->record.data_len);
+    memset ((unsigned char *) info->data + entry->record.data_len, 0, sizeof (rio_file_t) - entry->record.data_len);
+    info->skip = entry->record.skip;
+
+    ret = URIO_SUCCESS;
+  }
+
+  pthread_mutex_unlock (&metadata_cache.lock);
+
+  return ret;
+}
+
+/*
+  metadata_cache_store_rio:
+
+  Adds the info parsed from media to the cache.
+*/
+int metadata_cache_store_rio (char *file_name, rio_media_t *media, info_page_t *info) {
+  struct metadata_record record;
+  const unsigned char *data = (const unsigned char *) info->data;
+  char path[PATH_MAX];
+  unsigned char *buffer;
+  size_t buffer_size;
+  int ret;
+
+  if (metadata_cache.fd < 0)
+    return -ENOENT;
+
+  if (realpath (file_name, path) == NULL)
+    return -errno;
+
+  memset (&record, 0, sizeof (record));
+  record.size     = media->size;
+  record.mtime    = media->mtime;
+  record.mtime_nsec = media->mtime_nsec;
+  record.ino      = media->ino;
+  record.dev      = media->dev;
+  record.skip     = info->skip;
+  record.path_len = strlen (path);
+
+  /* only store up to the last byte that is set */
+  for (record.data_len = sizeof (rio_file_t) ; record.data_len && data[record.data_len - 1] == 0 ;
+       record.data_len--);
+
+  buffer_size = sizeof (record) + record.path_len + record.data_len;
+  buffer = (unsigned char *) malloc (buffer_size);
+  if (buffer == NULL)
+    return -ENOMEM;
+
+  memcpy (buffer, &record, sizeof (record));
+  memcpy (buffer + sizeof (record), path, record.path_len);
+  memcpy (buffer + sizeof (record) + record.path_len, data, record.data_len);
+
+  pthread_mutex_lock (&metadata_cache.lock);
+
+  ret = metadata_insert (&record, path, data);
+
+  /* append the whole record with one write so other rioutil processes do not interleave with it */
+  if (ret == URIO_SUCCESS && metadata_cache.fd >= 0 &&
+      write (metadata_cache.fd, buffer, buffer_size) != (ssize_t) buffer_size) {
+    /* the entry is still good for this run */
+    warning ("metadata_cache_store_rio: could not add %s to the cache", path);
+    ret = -EIO;
+  }
+
+  pthread_mutex_unlock (&metadata_cache.lock);
+
+  free (buffer);
+
+  return ret;
+}
@@ -19,25 +19,30 @@
 
 #include <stdlib.h>
 #include <sys/types.h>
+#include <pthread.h>
 
 #include "rioi.h"
 
 #define CRC32POLY 	0x04C11DB7
 
 /*
- * 1024 byte look up table.
+ * 8 kB of look up tables. crc32_table[0] is the classic byte at a time table and
+ * crc32_table[k] advances a byte through k more bytes of zeros. Using all eight
+ * (slicing-by-8) the checksum is computed 8 bytes at a time.
+ *
+ * The rio's checksum feeds the non-reflected polynomial into a reflected
+ * algorithm so it is neither CRC-32 nor CRC-32C and the crc32 instructions
+ * can not be used to compute it.
  */
 static void crc32_init_table(void);
 
-static u_int32_t crc32_table[256];
+static u_int32_t crc32_table[8][256];
 
-static int crc32_initialized = 0;
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
 
 static void crc32_init_table(void) {
   u_int32_t i, j, r;
 
-  crc32_initialized = 1;
-
   for (i = 0 ; i < 256 ; i++) {
     r = i;
 
@@ -48,19 +53,36 @@ static void crc32_init_table(void) {
         r >>= 1;
     }
 
-    crc32_table[i] = r;
+    crc32_table[0][i] = r;
   }
+
+  for (i = 0 ; i < 256 ; i++)
+    for (j = 1 ; j < 8 ; j++)
+      crc32_table[j][i] = (crc32_table[j - 1][i] >> 8) ^ crc32_table[0][crc32_table[j - 1][i] & 0xff];
 }
 
+/* little endian load that works on any alignment and byte order */
+#define LOAD32(p) ((u_int32_t)(p)[0] | (u_int32_t)(p)[1] << 8 | (u_int32_t)(p)[2] << 16 | (u_int32_t)(p)[3] << 24)
+
 u_int32_t crc32_rio (u_int8_t *buf, size_t length) {
-  unsigned long crc = 0;
+  u_int32_t crc = 0, hi;
   size_t i;
 
-  if (crc32_initialized == 0)
-    crc32_init_table();
+  /* uploads to several players may compute checksums at the same time */
+  pthread_once (&crc32_once, crc32_init_table);
+
+  for (i = 0 ; i + 8 <= length ; i += 8) {
+    crc ^= LOAD32(buf + i);
+    hi   = LOAD32(buf + i + 4);
+
+    crc = crc32_table[7][crc & 0xff] ^ crc32_table[6][(crc >> 8) & 0xff] ^
+      crc32_table[5][(crc >> 16) & 0xff] ^ crc32_table[4][crc >> 24] ^
+      crc32_table[3][hi & 0xff] ^ crc32_table[2][(hi >> 8) & 0xff] ^
+      crc32_table[1][(hi >> 16) & 0xff] ^ crc32_table[0][hi >> 24];
+  }
 
-  for (i = 0 ; i < length ; i++)
-    crc = (crc >> 8) ^ crc32_table[(crc ^ buf[i]) & 0xff];
+  for ( ; i < length ; i++)
+    crc = (crc >> 8) ^ crc32_table[0][(crc ^ buf[i]) & 0xff];
 
   crc = big32_2_arch32 (crc);
   return crc;
@@ -0,0 +1,552 @@
+/**
+ *   (c) 2026 agent <agent@local>
+ *   v1.5.4 download.c
+ *
+ *   Download entry points and the destinations (sinks) they write to.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ **/
+
+/* O_DIRECT */
+#if !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include <sys/stat.h>
+
+#include "rioi.h"
+#include "riolog.h"
+
+#if !defined(PATH_MAX)
+#define PATH_MAX 1024
+#endif
+
+/*
+  Blocks read from the player are collected in large aligned buffers. A full buffer is
+  handed to the writer thread and the next one is filled while it is written, so the
+  disk write overlaps the next CRIODATA handshake instead of following it.
+*/
+#define WRITER_BUFFERS     4
+#define WRITER_BUFFER_SIZE (256 * 1024)
+#define WRITER_ALIGN       4096
+
+struct rio_writer {
+  int fd;
+  int direct;
+  /* expected and actual size of the file */
+  u_int32_t size, written;
+
+  pthread_t thread;
+  pthread_mutex_t lock;
+  /* signaled when a buffer is queued or the writer is closing */
+  pthread_cond_t work;
+  /* signaled when the writer thread is done with a buffer */
+  pthread_cond_t space;
+
+  unsigned char *buffers[WRITER_BUFFERS];
+  u_int32_t fill[WRITER_BUFFERS];
+
+  /* the buffers from head to head + queued - 1 belong to the writer thread. the
+     caller fills the buffer at head + queued */
+  int head, queued;
+  int closing;
+
+  /* first write error */
+  int error;
+};
+
+static int writer_write (int fd, unsigned char *ptr, u_int32_t size) {
+  ssize_t ret;
+
+  while (size) {
+    ret = write (fd, ptr, size);
+    if (ret < 0) {
+      if (errno == EINTR)
+	continue;
+
+      return -errno;
+    } else if (ret == 0)
+      return -EIO;
+
+    ptr  += ret;
+    size -= ret;
+  }
+
+  return URIO_SUCCESS;
+}
+
+static void *writer_thread (void *arg) {
+  struct rio_writer *writer = (struct rio_writer *) arg;
+  u_int32_t size;
+  int ret, failed;
+
+  pthread_mutex_lock (&writer->lock);
+
+  for (;;) {
+    if (writer->queued == 0) {
+      if (writer->closing)
+	break;
+
+      pthread_cond_wait (&writer->work, &writer->lock);
+      continue;
+    }
+
+    size   = writer->fill[writer->head];
+    failed = (writer->error != URIO_SUCCESS);
+
+    writer->written += size;
+
+    /* direct writes must be a multiple of the alignment. the file is truncated to
+       its real size when the writer is closed */
+    if (writer->direct)
+      size = (size + WRITER_ALIGN - 1) & ~(WRITER_ALIGN - 1);
+
+    pthread_mutex_unlock (&writer->lock);
+
+    /* keep draining the queue after an error so the caller never blocks */
+    ret = failed ? URIO_SUCCESS : writer_write (writer->fd, writer->buffers[writer->head], size);
+
+    pthread_mutex_lock (&writer->lock);
+
+    if (ret != URIO_SUCCESS && writer->error == URIO_SUCCESS)
+      writer->error = ret;
+
+    writer->fill[writer->head] = 0;
+    writer->head = (writer->head + 1) % WRITER_BUFFERS;
+    writer->queued--;
+
+    pthread_cond_signal (&writer->space);
+  }
+
+  pthread_mutex_unlock (&writer->lock);
+
+  return NULL;
+}
+
+static void writer_free (struct rio_writer *writer) {
+  int i;
+
+  for (i = 0 ; i < WRITER_BUFFERS ; i++)
+    free (writer->buffers[i]);
+
+  pthread_cond_destroy (&writer->space);
+  pthread_cond_destroy (&writer->work);
+  pthread_mutex_destroy (&writer->lock);
+
+  free (writer);
+}
+
+/*
+  writer_open:
+
+  Creates file_name and starts a writer thread for it. size is the expected size of
+  the file and is used to reserve space for it up front, so a full disk is reported
+  before anything is read from the player.
+*/
+static int writer_open (struct rio_writer **writerp, const char *file_name, int mode, u_int32_t size, int flags) {
+  struct rio_writer *writer;
+  int i, ret, oflags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  *writerp = NULL;
+
+  writer = (struct rio_writer *) calloc (1, sizeof (struct rio_writer));
+  if (writer == NULL)
+    return -ENOMEM;
+
+  pthread_mutex_init (&writer->lock, NULL);
+  pthread_cond_init (&writer->work, NULL);
+  pthread_cond_init (&writer->space, NULL);
+
+  writer->size = size;
+  writer->fd   = -1;
+
+  for (i = 0 ; i < WRITER_BUFFERS ; i++)
+    if (posix_memalign ((void **) &writer->buffers[i], WRITER_ALIGN, WRITER_BUFFER_SIZE) != 0) {
+      writer_free (writer);
+      return -ENOMEM;
+    }
+
+#if defined(O_DIRECT)
+  if (flags & RIO_DOWNLOAD_DIRECT) {
+    writer->fd = open (file_name, oflags | O_DIRECT, mode);
+    if (writer->fd >= 0)
+      writer->direct = 1;
+    else if (errno == EINVAL)
+      /* the file system does not support direct i/o */
+      debug ("writer_open: direct i/o not supported for %s", file_name);
+  }
+#endif
+
+  if (writer->fd < 0)
+    writer->fd = open (file_name, oflags, mode);
+
+  if (writer->fd < 0) {
+    ret = -errno;
+    error ("writer_open: could not create file %s: %s", file_name, strerror (errno));
+    writer_free (writer);
+    return ret;
+  }
+
+#if defined(HAVE_POSIX_FALLOCATE)
+  if (size && (ret = posix_fallocate (writer->fd, 0, size)) != 0) {
+    if (ret == ENOSPC || ret == EFBIG) {
+      error ("writer_open: not enough space for %s: %s", file_name, strerror (ret));
+      close (writer->fd);
+      unlink (file_name);
+      writer_free (writer);
+      return -ret;
+    }
+
+    /* not supported by the file system. the file is extended as it is written */
+    debug ("writer_open: could not preallocate %s: %s", file_name, strerror (ret));
+  }
+#endif
+
+  if (pthread_create (&writer->thread, NULL, writer_thread, writer) != 0) {
+    close (writer->fd);
+    writer_free (writer);
+    return -EAGAIN;
+  }
+
+  *writerp = writer;
+
+  return URIO_SUCCESS;
+}
+
+/* hand the buffer being filled to the writer thread and wait for a free one. the
+   lock must be held */
+static void writer_queue (struct rio_writer *writer) {
+  writer->queued++;
+  pthread_cond_signal (&writer->work);
+
+  while (writer->queued == WRITER_BUFFERS)
+    pthread_cond_wait (&writer->space, &writer->lock);
+}
+
+/*
+  writer_reserve:
+
+  Returns space for at least size bytes of file data. Returns NULL if an earlier write
+  failed, the error is returned by writer_close.
+*/
+static unsigned char *writer_reserve (struct rio_writer *writer, u_int32_t size) {
+  unsigned char *ptr;
+  int tail;
+
+  if (size > WRITER_BUFFER_SIZE)
+    return NULL;
+
+  pthread_mutex_lock (&writer->lock);
+
+  tail = (writer->head + writer->queued) % WRITER_BUFFERS;
+
+  if (writer->fill[tail] + size > WRITER_BUFFER_SIZE) {
+    writer_queue (writer);
+    tail = (writer->head + writer->queued) % WRITER_BUFFERS;
+  }
+
+  ptr = (writer->error == URIO_SUCCESS) ? writer->buffers[tail] + writer->fill[tail] : NULL;
+
+  pthread_mutex_unlock (&writer->lock);
+
+  return ptr;
+}
+
+/* adds size bytes of the space returned by writer_reserve to the file */
+static void writer_commit (struct rio_writer *writer, u_int32_t size) {
+  pthread_mutex_lock (&writer->lock);
+  writer->fill[(writer->head + writer->queued) % WRITER_BUFFERS] += size;
+  pthread_mutex_unlock (&writer->lock);
+}
+
+/*
+  writer_close:
+
+  Writes out the remaining data, closes the file and frees the writer. Returns the
+  first error encountered while writing.
+*/
+static int writer_close (struct rio_writer *writer) {
+  int ret;
+
+  pthread_mutex_lock (&writer->lock);
+
+  if (writer->fill[(writer->head + writer->queued) % WRITER_BUFFERS])
+    writer->queued++;
+
+  writer->closing = 1;
+  pthread_cond_signal (&writer->work);
+  pthread_mutex_unlock (&writer->lock);
+
+  pthread_join (writer->thread, NULL);
+
+  ret = writer->error;
+
+  /* drop the padding of the last direct write and any space preallocated for data
+     that never arrived */
+  if ((writer->direct || writer->written != writer->size) &&
+      ftruncate (writer->fd, writer->written) < 0 && ret == URIO_SUCCESS)
+    ret = -errno;
+
+  if (close (writer->fd) < 0 && ret == URIO_SUCCESS)
+    ret = -errno;
+
+  writer_free (writer);
+
+  return ret;
+}
+
+/*
+  Sinks:
+
+  do_download asks the sink for space for each block, reads the block into it and
+  then commits the part of the block that holds file data.
+*/
+
+/* file sink */
+struct file_sink {
+  char *file_name;
+  int flags;
+  struct rio_writer *writer;
+};
+
+static int file_sink_open (void *ptr, u_int32_t size) {
+  struct file_sink *fs = (struct file_sink *) ptr;
+  int mode = S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP;
+
+  return writer_open (&fs->writer, fs->file_name, mode, size, fs->flags);
+}
+
+static unsigned char *file_sink_reserve (void *ptr) {
+  return writer_reserve (((struct file_sink *) ptr)->writer, RIO_FTS);
+}
+
+static int file_sink_commit (void *ptr, u_int32_t size) {
+  writer_commit (((struct file_sink *) ptr)->writer, size);
+
+  return URIO_SUCCESS;
+}
+
+static int file_sink_close (void *ptr, int ret) {
+  struct file_sink *fs = (struct file_sink *) ptr;
+  int wret;
+
+  wret = writer_close (fs->writer);
+  if (wret != URIO_SUCCESS) {
+    error("download.c file_sink_close: could not write file %s: %s", fs->file_name, strerror (-wret));
+
+    if (ret == URIO_SUCCESS || ret == -EINTR)
+      ret = wret;
+  }
+
+  return ret;
+}
+
+/* buffer sink */
+struct buffer_sink {
+  unsigned char *buffer;
+  u_int32_t buffer_size;
+  u_int32_t *size;
+  u_int32_t offset;
+
+  /* the last block of a file may not fit at the end of the buffer */
+  unsigned char *reserved;
+  unsigned char bounce[RIO_FTS];
+};
+
+static int buffer_sink_open (void *ptr, u_int32_t size) {
+  struct buffer_sink *bs = (struct buffer_sink *) ptr;
+
+  *(bs->size) = size;
+
+  return (size > bs->buffer_size) ? -EOVERFLOW : URIO_SUCCESS;
+}
+
+static unsigned char *buffer_sink_reserve (void *ptr) {
+  struct buffer_sink *bs = (struct buffer_sink *) ptr;
+
+  if (bs->buffer_size - bs->offset >= RIO_FTS)
+    bs->reserved = bs->buffer + bs->offset;
+  else
+    bs->reserved = bs->bounce;
+
+  return bs->reserved;
+}
+
+static int buffer_sink_commit (void *ptr, u_int32_t size) {
+  struct buffer_sink *bs = (struct buffer_sink *) ptr;
+
+  if (size > bs->buffer_size - bs->offset)
+    return -EOVERFLOW;
+
+  if (bs->reserved == bs->bounce)
+    memcpy (bs->buffer + bs->offset, bs->bounce, size);
+
+  bs->offset += size;
+
+  return URIO_SUCCESS;
+}
+
+static int buffer_sink_close (void *ptr, int ret) {
+  struct buffer_sink *bs = (struct buffer_sink *) ptr;
+
+  /* the number of bytes actually received */
+  *(bs->size) = bs->offset;
+
+  return ret;
+}
+
+/* callback sink */
+struct callback_sink {
+  rio_sink_t sink;
+  void *ptr;
+
+  unsigned char block[RIO_FTS];
+};
+
+static int callback_sink_open (void *ptr, u_int32_t size) {
+  (void) ptr;
+  (void) size;
+
+  return URIO_SUCCESS;
+}
+
+static unsigned char *callback_sink_reserve (void *ptr) {
+  return ((struct callback_sink *) ptr)->block;
+}
+
+static int callback_sink_commit (void *ptr, u_int32_t size) {
+  struct callback_sink *cs = (struct callback_sink *) ptr;
+  int ret;
+
+  ret = cs->sink (cs->block, size, cs->ptr);
+
+  return (ret < 0) ? ret : URIO_SUCCESS;
+}
+
+static int callback_sink_close (void *ptr, int ret) {
+  (void) ptr;
+
+  return ret;
+}
+
+/*
+  download_file_rio:
+
+  Downloads a file to disk. If file_name is NULL the file is written to the current
+  directory under the name it has on the player.
+*/
+int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, char *file_name) {
+  struct file_sink fs;
+  struct rio_sink sink = {file_sink_open, file_sink_reserve, file_sink_commit, file_sink_close, &fs};
+  char tmp_np[PATH_MAX];
+  int i, ret;
+
+  if ((ret = try_lock_rio (rio)) != 0)
+    return ret;
+
+  /* generate a filename if one was not supplied */
+  if (file_name == NULL) {
+    if ((ret = flist_get_file_name_rio (rio, memory_unit, file_num, tmp_np, PATH_MAX)) != URIO_SUCCESS)
+      UNLOCK(ret);
+
+    for ( i = strlen (tmp_np) - 1 ; i > 0 && tmp_np[i] != '\\' && tmp_np[i] != '/' ; i--);
+
+    file_name = &tmp_np[i];
+  }
+
+  debug("download.c download_file_rio: downloading to file %s", file_name);
+
+  memset (&fs, 0, sizeof (fs));
+  fs.file_name = file_name;
+  fs.flags     = rio->download_flags;
+
+  ret = do_download (rio, memory_unit, file_num, &sink);
+
+  /* an aborted download has always been reported as a success */
+  if (ret == -EINTR)
+    ret = URIO_SUCCESS;
+
+  UNLOCK(ret);
+}
+
+int download_buffer_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, unsigned char *buffer,
+			 u_int32_t buffer_size, u_int32_t *size) {
+  struct buffer_sink *bs;
+  struct rio_sink sink = {buffer_sink_open, buffer_sink_reserve, buffer_sink_commit, buffer_sink_close, NULL};
+  int ret;
+
+  if (buffer == NULL || size == NULL)
+    return -EINVAL;
+
+  bs = (struct buffer_sink *) calloc (1, sizeof (struct buffer_sink));
+  if (bs == NULL)
+    return -ENOMEM;
+
+  bs->buffer      = buffer;
+  bs->buffer_size = buffer_size;
+  bs->size        = size;
+  sink.ptr        = bs;
+
+  if ((ret = try_lock_rio (rio)) != 0) {
+    free (bs);
+    return ret;
+  }
+
+  ret = do_download (rio, memory_unit, file_num, &sink);
+
+  unlock_rio (rio);
+
+  free (bs);
+
+  return ret;
+}
+
+int download_sink_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, rio_sink_t callback, void *ptr) {
+  struct callback_sink *cs;
+  struct rio_sink sink = {callback_sink_open, callback_sink_reserve, callback_sink_commit, callback_sink_close, NULL};
+  int ret;
+
+  if (callback == NULL)
+    return -EINVAL;
+
+  cs = (struct callback_sink *) calloc (1, sizeof (struct callback_sink));
+  if (cs == NULL)
+    return -ENOMEM;
+
+  cs->sink = callback;
+  cs->ptr  = ptr;
+  sink.ptr = cs;
+
+  if ((ret = try_lock_rio (rio)) != 0) {
+    free (cs);
+    return ret;
+  }
+
+  ret = do_download (rio, memory_unit, file_num, &sink);
+
+  unlock_rio (rio);
+
+  free (cs);
+
+  return ret;
+}
@@ -34,8 +34,6 @@ int downloadable_info (info_page_t *newInfo, char *file_name) {
   newInfo->skip = 0;
   
   if (strstr(file_name, ".bin") == NULL) {
-    strncpy((char *)misc_file->title, (char *)misc_file->title, 63);
-    
     misc_file->bits     = 0x11000110; /* this matches rio taxi file bits */
     misc_file->type     = 0x54415849; /* TAXI. matches rio taxi file type */
   } else {
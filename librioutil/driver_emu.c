@@ -0,0 +1,1014 @@
+/**
+ *   (c) 2026 agent <agent@local>
+ *   v1.5.4 driver_emu.c
+ *
+ *   Software emulated Rio. Speaks the same command/bulk protocol as a real
+ *   player so librioutil can be exercised (and timed) without hardware.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Library Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ **/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "rioi.h"
+#include "driver.h"
+#include "riolog.h"
+
+char driver_method[] = "emulator";
+
+#define EMU_MAX_DEVICES 16
+#define EMU_MAX_FILES   MAX_RIO_FILES
+
+/* timing model of a player generation. all times are in usec */
+struct emu_model {
+  int gen;
+  int latency;   /* fixed cost of every bulk/control transfer */
+  int bandwidth; /* bytes/sec the bus sustains */
+  int ack_delay; /* time the player spends committing a data block before it answers */
+};
+
+static struct emu_model emu_models[] = {
+  /* Rio 600/800/900, psa[play and Riot. full speed USB and slow flash */
+  {3, 125, 900000, 700},
+  /* S-Series */
+  {4, 125, 1000000, 400},
+  /* Fuse, Chiba, Cali, Nitrus */
+  {5, 125, 1100000, 250},
+  {0, 0, 0, 0}
+};
+
+enum emu_state {
+  EMU_IDLE,
+  EMU_UPLOAD,     /* waiting for CRIODATA/CRIOINFO */
+  EMU_UPLOAD_BLK, /* waiting for a data block */
+  EMU_UPLOAD_HDR, /* waiting for the file header */
+  EMU_DL_HDR,     /* waiting for the header of the file to send */
+  EMU_DOWNLOAD,
+  EMU_DELETE,
+  EMU_PREFS,
+  EMU_RIOT_LIST,
+  EMU_FIRMWARE
+};
+
+struct emu_file {
+  rio_file_t hdr; /* device byte order */
+  unsigned char *data;
+};
+
+struct emu_unit {
+  u_int32_t size;
+  u_int32_t used;
+  char name[64];
+
+  struct emu_file *files[EMU_MAX_FILES];
+  int num_files;
+};
+
+struct emu_device {
+  struct player_device_info *entry;
+  struct emu_model model;
+
+  struct emu_unit units[MAX_MEM_UNITS];
+  int num_units;
+
+  unsigned char prefs[RIO_MTS];
+  u_int8_t serial_number[16];
+
+  /* protocol state */
+  enum emu_state state;
+  int unit;
+  int overwrite;
+  u_int32_t cksum;
+  unsigned char *upload;
+  u_int32_t upload_size, upload_alloc;
+  struct emu_file *xfer;
+  u_int32_t xfer_offset;
+  u_int32_t fw_size, fw_received;
+  u_int32_t next_start;
+  /* position of the next file in a Nitrus list walk. 0 when no walk is under way */
+  int walk_unit, walk_pos;
+
+  /* data waiting to be read by the host */
+  unsigned char *out;
+  u_int32_t out_len, out_pos, out_alloc;
+
+  /* timing model: time at which the player will be able to answer */
+  u_int64_t ready_at;
+  u_int64_t block_start;
+
+  struct emu_stats stats;
+};
+
+static struct emu_device *emu_devices[EMU_MAX_DEVICES];
+static struct emu_config emu_cfg;
+static int emu_cfg_set = 0;
+/* protects the configuration and emu_devices. each player is used by one thread at a time */
+static pthread_mutex_t emu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static u_int64_t emu_now (void) {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return (u_int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void emu_sleep_until (u_int64_t when) {
+  struct timespec ts;
+  u_int64_t now;
+
+  while ((now = emu_now ()) < when) {
+    ts.tv_sec  = (when - now) / 1000000;
+    ts.tv_nsec = ((when - now) % 1000000) * 1000;
+    nanosleep (&ts, NULL);
+  }
+}
+
+/* modeled duration of a transfer of size bytes */
+static u_int64_t emu_transfer_time (struct emu_device *emu, u_int32_t size) {
+  u_int64_t cost = emu->model.latency;
+
+  if (emu->model.bandwidth > 0)
+    cost += ((u_int64_t) size * 1000000) / emu->model.bandwidth;
+
+  return cost;
+}
+
+/* returns the time at which a transfer of size bytes started now will complete */
+static u_int64_t emu_schedule (struct emu_device *emu, u_int32_t size) {
+  u_int64_t start = emu_now ();
+
+  if (emu->ready_at > start)
+    start = emu->ready_at;
+
+  emu->ready_at = start + emu_transfer_time (emu, size);
+
+  return emu->ready_at;
+}
+
+static void emu_charge (struct emu_device *emu, u_int32_t size) {
+  emu_sleep_until (emu_schedule (emu, size));
+}
+
+/* reference (bit at a time) implementation of the rio's checksum. kept separate
+   from cksum.c so the emulator catches a bad crc32_rio */
+static u_int32_t emu_crc32 (const unsigned char *buf, u_int32_t size) {
+  u_int32_t crc = 0, i, j;
+
+  for (i = 0 ; i < size ; i++) {
+    crc ^= buf[i];
+
+    for (j = 0 ; j < 8 ; j++)
+      crc = (crc & 1) ? (crc >> 1) ^ 0x04C11DB7 : crc >> 1;
+  }
+
+  crc = big32_2_arch32 (crc);
+  return crc;
+}
+
+/* reads from the host are satisfied from this queue */
+static int emu_queue (struct emu_device *emu, const void *data, u_int32_t size) {
+  unsigned char *tmp;
+
+  if (emu->out_len + size > emu->out_alloc) {
+    tmp = realloc (emu->out, emu->out_len + size + RIO_FTS);
+    if (tmp == NULL)
+      return -ENOMEM;
+
+    emu->out = tmp;
+    emu->out_alloc = emu->out_len + size + RIO_FTS;
+  }
+
+  if (data)
+    memcpy (emu->out + emu->out_len, data, size);
+  else
+    memset (emu->out + emu->out_len, 0, size);
+
+  emu->out_len += size;
+
+  return 0;
+}
+
+static int emu_respond (struct emu_device *emu, const char *response) {
+  unsigned char buffer[64];
+
+  memset (buffer, 0, 64);
+  memcpy (buffer, response, strlen (response));
+
+  return emu_queue (emu, buffer, 64);
+}
+
+static void emu_reset_state (struct emu_device *emu) {
+  emu->state = EMU_IDLE;
+  emu->out_len = emu->out_pos = 0;
+  emu->upload_size = 0;
+  emu->xfer = NULL;
+}
+
+static u_int32_t emu_file_no (rio_file_t *hdr) {
+  return little32_2_arch32 (hdr->file_no);
+}
+
+/* the player hands out the first unused file number. this mirrors flist_first_free_rio */
+static u_int32_t emu_first_free (struct emu_device *emu, struct emu_unit *unit, int *index) {
+  u_int32_t file_incr = (emu->entry->gen < 4) ? 0x01 : 0x10;
+  u_int32_t next_num = file_incr;
+  int i;
+
+  for (i = 0 ; i < unit->num_files ; i++, next_num += file_incr)
+    if (next_num < emu_file_no (&unit->files[i]->hdr))
+      break;
+
+  *index = i;
+
+  return next_num;
+}
+
+static int emu_find_file (struct emu_device *emu, struct emu_unit *unit, u_int32_t file_no) {
+  int i;
+
+  /* the Riot identifies files by their position in the list it sends */
+  if (emu->entry->type == RIORIOT)
+    return (file_no < (u_int32_t) unit->num_files) ? (int) file_no : -1;
+
+  for (i = 0 ; i < unit->num_files ; i++)
+    if (emu_file_no (&unit->files[i]->hdr) == file_no)
+      return i;
+
+  return -1;
+}
+
+static void emu_free_file (struct emu_file *file) {
+  free (file->data);
+  free (file);
+}
+
+static void emu_remove_file (struct emu_unit *unit, int i) {
+  unit->used -= little32_2_arch32 (unit->files[i]->hdr.size);
+  emu_free_file (unit->files[i]);
+
+  memmove (&unit->files[i], &unit->files[i + 1], (unit->num_files - i - 1) * sizeof (struct emu_file *));
+  unit->num_files--;
+}
+
+/* called when the host sends the header that ends an upload */
+static int emu_store_file (struct emu_device *emu, unsigned char *data) {
+  struct emu_unit *unit = &emu->units[emu->unit];
+  struct emu_file *file;
+  u_int32_t size, file_no;
+  int i, dummy = 0;
+
+  file = calloc (1, sizeof (struct emu_file));
+  if (file == NULL)
+    return -ENOMEM;
+
+  memcpy (&file->hdr, data, sizeof (rio_file_t));
+
+  size = little32_2_arch32 (file->hdr.size);
+  if (size == 0 || size > emu->upload_size)
+    size = emu->upload_size;
+
+  if (emu->upload_size == 0) {
+    /* a header without data is a dummy used by older players to make an existing
+       file downloadable. it shares the data of the file it was copied from */
+    for (i = 0 ; i < unit->num_files ; i++)
+      if (unit->files[i]->hdr.start == file->hdr.start)
+	break;
+
+    if (i < unit->num_files) {
+      dummy = 1;
+      size = little32_2_arch32 (unit->files[i]->hdr.size);
+      emu->upload = malloc (size);
+      if (emu->upload == NULL) {
+	free (file);
+	return -ENOMEM;
+      }
+
+      memcpy (emu->upload, unit->files[i]->data, size);
+    }
+  }
+
+  file->hdr.size = arch32_2_little32 (size);
+  file->data = emu->upload;
+  emu->upload = NULL;
+  emu->upload_alloc = emu->upload_size = 0;
+
+  if (emu->overwrite && (i = emu_find_file (emu, unit, emu_file_no (&file->hdr))) >= 0) {
+    unit->used -= little32_2_arch32 (unit->files[i]->hdr.size);
+    emu_free_file (unit->files[i]);
+    unit->files[i] = file;
+  } else {
+    if (unit->num_files == EMU_MAX_FILES) {
+      emu_free_file (file);
+      return 0;
+    }
+
+    file_no = emu_first_free (emu, unit, &i);
+    file->hdr.file_no = arch32_2_little32 (file_no);
+    /* older players use the start field to locate the data of a file */
+    if (!dummy)
+      file->hdr.start = arch32_2_little32 (++emu->next_start);
+
+    memmove (&unit->files[i + 1], &unit->files[i], (unit->num_files - i) * sizeof (struct emu_file *));
+    unit->files[i] = file;
+    unit->num_files++;
+  }
+
+  unit->used += size;
+
+  return 0;
+}
+
+static int emu_queue_riot_block (struct emu_device *emu) {
+  struct emu_unit *unit = &emu->units[0];
+  hd_file_t hdf[RIO_FTS / sizeof (hd_file_t)];
+  rio_file_t *hdr;
+  u_int32_t i, first = emu->xfer_offset;
+
+  memset (hdf, 0, sizeof (hdf));
+
+  for (i = 0 ; i < RIO_FTS / sizeof (hd_file_t) && (int)(first + i) < unit->num_files ; i++) {
+    hdr = &unit->files[first + i]->hdr;
+
+    hdf[i].unk0 = arch32_2_little32 (1);
+    hdf[i].unk4 = 0x20;
+    hdf[i].size = hdr->size;
+    hdf[i].time = hdr->time;
+    hdf[i].trackno = hdr->trackno2;
+    memcpy (hdf[i].file_name, hdr->name, sizeof (hdf[i].file_name) - 1);
+    memcpy (hdf[i].title, hdr->title, sizeof (hdf[i].title) - 1);
+    memcpy (hdf[i].artist, hdr->artist, sizeof (hdf[i].artist) - 1);
+    memcpy (hdf[i].album, hdr->album, sizeof (hdf[i].album) - 1);
+  }
+
+  emu->xfer_offset += RIO_FTS / sizeof (hd_file_t);
+
+  return emu_queue (emu, hdf, RIO_FTS);
+}
+
+/* device-side handling of data written by the host */
+static int emu_host_write (struct emu_device *emu, unsigned char *buffer, u_int32_t size) {
+  struct emu_unit *unit = &emu->units[emu->unit];
+  u_int32_t block_size, len;
+  char progress[16];
+  unsigned char *tmp;
+  int i, ret = 0;
+
+  if (size == 64 && memcmp (buffer, "CRIOABRT", 8) == 0) {
+    emu_reset_state (emu);
+    return 0;
+  }
+
+  switch (emu->state) {
+  case EMU_UPLOAD:
+    if (size == 64 && memcmp (buffer, "CRIODATA", 8) == 0) {
+      memcpy (&emu->cksum, buffer + 8, 4);
+      emu->state = EMU_UPLOAD_BLK;
+      emu->block_start = emu->ready_at;
+    } else if (size == 64 && memcmp (buffer, "CRIOINFO", 8) == 0) {
+      if (emu->unit >= 0) {
+	emu->state = EMU_UPLOAD_HDR;
+	break;
+      }
+
+      /* the nitrus song database is not followed by a header. nothing to store */
+      free (emu->upload);
+      emu->upload = NULL;
+      emu->upload_alloc = emu->upload_size = 0;
+
+      ret = emu_respond (emu, "SRIODONE");
+      emu->state = EMU_IDLE;
+    }
+
+    break;
+  case EMU_UPLOAD_BLK:
+    if (emu->entry->type != RIONITRUS && emu->cksum != emu_crc32 (buffer, size)) {
+      error("driver_emu.c: checksum mismatch on uploaded block");
+      ret = emu_respond (emu, "SRIOCKER");
+      emu->state = EMU_UPLOAD;
+      break;
+    }
+
+    if (emu->upload_size + size > emu->upload_alloc) {
+      tmp = realloc (emu->upload, 2 * (emu->upload_size + size));
+      if (tmp == NULL) {
+	ret = -ENOMEM;
+	break;
+      }
+
+      emu->upload = tmp;
+      emu->upload_alloc = 2 * (emu->upload_size + size);
+    }
+
+    memcpy (emu->upload + emu->upload_size, buffer, size);
+    emu->upload_size += size;
+    emu->stats.blocks++;
+
+    /* the answer is not available until the player has committed the block */
+    emu->ready_at += emu->model.ack_delay;
+    ret = emu_respond (emu, "SRIODATA");
+    emu->state = EMU_UPLOAD;
+
+    break;
+  case EMU_UPLOAD_HDR:
+    if ((ret = emu_store_file (emu, buffer)) == 0)
+      ret = emu_respond (emu, "SRIODONE");
+    emu->state = EMU_IDLE;
+
+    break;
+  case EMU_DL_HDR:
+    i = emu_find_file (emu, unit, emu_file_no ((rio_file_t *) buffer));
+    if (i < 0) {
+      ret = emu_respond (emu, "SRIONOFL");
+      emu->state = EMU_IDLE;
+    } else {
+      ret = emu_respond (emu, "SRIODATA");
+      emu->xfer = unit->files[i];
+      emu->xfer_offset = 0;
+      emu->state = EMU_DOWNLOAD;
+    }
+
+    break;
+  case EMU_DOWNLOAD:
+    if (size != 64 || memcmp (buffer, "CRIODATA", 8) != 0)
+      break;
+
+    /* older players send file data in 4k chunks but the host always reads RIO_FTS bytes */
+    block_size = (emu->entry->gen >= 4) ? RIO_FTS : 4096;
+
+    emu->out_len = emu->out_pos = 0;
+
+    if (emu->xfer_offset >= little32_2_arch32 (emu->xfer->hdr.size)) {
+      ret = emu_respond (emu, "SRIODONE");
+      emu->state = EMU_IDLE;
+      break;
+    }
+
+    ret = emu_respond (emu, "SRIODATA");
+
+    len = little32_2_arch32 (emu->xfer->hdr.size) - emu->xfer_offset;
+    if (len > RIO_FTS)
+      len = RIO_FTS;
+
+    if (ret == 0)
+      ret = emu_queue (emu, emu->xfer->data + emu->xfer_offset, len);
+    if (ret == 0)
+      ret = emu_queue (emu, NULL, RIO_FTS - len);
+
+    emu->xfer_offset += block_size;
+    emu->stats.blocks++;
+    emu->block_start = emu->ready_at;
+
+    break;
+  case EMU_DELETE:
+    i = emu_find_file (emu, unit, emu_file_no ((rio_file_t *) buffer));
+    if (i >= 0)
+      emu_remove_file (unit, i);
+
+    ret = emu_respond (emu, "SRIODELD");
+    emu->state = EMU_IDLE;
+
+    break;
+  case EMU_PREFS:
+    memcpy (emu->prefs, buffer, (size < RIO_MTS) ? size : RIO_MTS);
+    ret = emu_respond (emu, "SRIODONE");
+    emu->state = EMU_IDLE;
+
+    break;
+  case EMU_RIOT_LIST:
+    if (size != 64 || memcmp (buffer, "CRIODATA", 8) != 0)
+      break;
+
+    emu->out_len = emu->out_pos = 0;
+
+    if ((int) emu->xfer_offset >= unit->num_files) {
+      ret = emu_respond (emu, "SRIODONE");
+      emu->state = EMU_IDLE;
+    } else {
+      if ((ret = emu_respond (emu, "SRIODATA")) == 0)
+	ret = emu_queue_riot_block (emu);
+    }
+
+    break;
+  case EMU_FIRMWARE:
+    if (emu->fw_size == 0 && size == 64) {
+      memcpy (&emu->fw_size, buffer, 4);
+      emu->fw_size = little32_2_arch32 (emu->fw_size);
+    } else
+      emu->fw_received += size;
+
+    if (emu->entry->gen == 5 && emu->fw_size) {
+      if (emu->fw_received >= emu->fw_size)
+	ret = emu_respond (emu, "SRIODONE");
+      else {
+	snprintf (progress, 16, "SRIOPR%02d", (int)(((u_int64_t) emu->fw_received * 100) / emu->fw_size));
+	ret = emu_respond (emu, progress);
+      }
+    } else
+      ret = emu_respond (emu, "SRIODATA");
+
+    break;
+  default:
+    /* the player ignores data it was not expecting */
+    break;
+  }
+
+  return ret;
+}
+
+/* device-side handling of a command (control message) */
+static int emu_command (struct emu_device *emu, u_int8_t request, u_int16_t value, u_int16_t index) {
+  unsigned char buffer[RIO_MTS];
+  rio_mem_t *mem;
+  rio_file_t *file;
+  int ret = 0;
+
+  emu_reset_state (emu);
+  emu->stats.commands++;
+
+  /* the host wakes the player between the steps of a list walk. anything else ends it */
+  if (request != RIO_FILEI && request != UNKNOWN00 && request != RIO_POLLD &&
+      request != UNKNOWN01 && request != UNKNOWN02)
+    emu->walk_pos = 0;
+
+  switch (request) {
+  case RIO_TYPEQ:
+    ret = emu_queue (emu, NULL, 128);
+    break;
+  case RIO_DESCP:
+    memset (buffer, 0, 256);
+    /* firmware version: major in byte 5, BCD minor in byte 4 */
+    buffer[5] = (emu->entry->gen > 3) ? 2 : 1;
+    buffer[4] = (emu->entry->gen > 3) ? 0x10 : 0x55;
+    memcpy (&buffer[0x60], emu->serial_number, 16);
+    ret = emu_queue (emu, buffer, 256);
+    break;
+  case RIO_MEMRI:
+    memset (buffer, 0, 256);
+    mem = (rio_mem_t *) buffer;
+
+    if (value < emu->num_units) {
+      struct emu_unit *unit = &emu->units[value];
+
+      /* the Riot reports its sizes in kiB */
+      mem->size = unit->size;
+      mem->used = unit->used;
+      mem->free = unit->size - unit->used;
+
+      if (emu->entry->type == RIORIOT) {
+	mem->size /= 1024;
+	mem->used /= 1024;
+	mem->free /= 1024;
+      }
+
+      strncpy (mem->name, unit->name, sizeof (mem->name) - 1);
+      mem_to_arch (mem);
+    }
+
+    ret = emu_queue (emu, buffer, 256);
+    break;
+  case RIO_FILEI:
+    memset (buffer, 0, RIO_MTS);
+
+    if (value < emu->num_units) {
+      struct emu_unit *unit = &emu->units[value];
+      int i = index;
+
+      /* the Nitrus list is walked by position starting at 0 while single files are
+	 asked for by id. ids are multiples of 0x10 so they never start a walk */
+      if (emu->entry->type == RIONITRUS) {
+	if (index == 0 || (value == emu->walk_unit && index == emu->walk_pos)) {
+	  emu->walk_unit = value;
+	  emu->walk_pos  = index + 1;
+	} else {
+	  emu->walk_pos = 0;
+	  i = emu_find_file (emu, unit, index);
+	}
+      }
+
+      if (i >= 0 && i < unit->num_files) {
+	file = &unit->files[i]->hdr;
+	memcpy (buffer, file, sizeof (rio_file_t));
+      } else
+	/* an empty header ends the walk */
+	emu->walk_pos = 0;
+    }
+
+    ret = emu_queue (emu, buffer, RIO_MTS);
+    break;
+  case RIO_FORMT:
+    if (value < emu->num_units)
+      while (emu->units[value].num_files)
+	emu_remove_file (&emu->units[value], emu->units[value].num_files - 1);
+
+    if (emu->entry->gen == 5)
+      ret = emu_respond (emu, "SRIOPR50");
+
+    if (ret == 0)
+      ret = emu_respond (emu, "SRIOFMTD");
+    break;
+  case RIO_UPDAT:
+    emu->state = EMU_FIRMWARE;
+    emu->fw_size = emu->fw_received = 0;
+    ret = emu_respond (emu, "SRIORDY");
+    break;
+  case RIO_WRITE:
+  case RIO_OVWRT:
+  case RIO_NINFO:
+    if (request != RIO_NINFO && value >= emu->num_units) {
+      ret = emu_respond (emu, "SRIOBUSY");
+      break;
+    }
+
+    emu->state = EMU_UPLOAD;
+    emu->unit = (request == RIO_NINFO) ? -1 : value;
+    emu->overwrite = (request == RIO_OVWRT);
+
+    if ((ret = emu_respond (emu, (request == RIO_NINFO) ? "SRIORDY." : "SRIORDY")) == 0)
+      ret = emu_respond (emu, "SRIODATA");
+    break;
+  case RIO_READF:
+    emu->state = EMU_DL_HDR;
+    emu->unit = (value < emu->num_units) ? value : 0;
+    ret = emu_respond (emu, "SRIORDY");
+    break;
+  case RIO_DELET:
+    emu->state = EMU_DELETE;
+    emu->unit = (value < emu->num_units) ? value : 0;
+    ret = emu_respond (emu, "SRIODELS");
+    break;
+  case RIO_PREFS:
+    emu->state = EMU_PREFS;
+    ret = emu_respond (emu, "SRIORDY");
+    break;
+  case RIO_PREFR:
+    ret = emu_queue (emu, emu->prefs, RIO_MTS);
+    break;
+  case RIO_RIOTF:
+    emu->state = EMU_RIOT_LIST;
+    emu->unit = 0;
+    emu->xfer_offset = 0;
+    ret = emu_respond (emu, "SRIORDY");
+    break;
+  default:
+    /* everything else is acknowledged and otherwise ignored */
+    break;
+  }
+
+  return ret;
+}
+
+static struct emu_model *emu_model_lookup (int gen) {
+  struct emu_model *m;
+
+  for (m = emu_models ; m->gen && m->gen != gen ; m++);
+
+  return m->gen ? m : &emu_models[0];
+}
+
+static void emu_default_config (void) {
+  char *env;
+
+  if (emu_cfg_set)
+    return;
+
+  memset (&emu_cfg, 0, sizeof (emu_cfg));
+
+  emu_cfg.player    = "Rio Fuse";
+  emu_cfg.devices   = 1;
+  emu_cfg.latency   = -1;
+  emu_cfg.bandwidth = -1;
+  emu_cfg.ack_delay = -1;
+  emu_cfg.mem_size  = 256 * 1024 * 1024;
+
+  if ((env = getenv ("RIOUTIL_EMU_PLAYER")) != NULL)
+    emu_cfg.player = env;
+  if ((env = getenv ("RIOUTIL_EMU_DEVICES")) != NULL)
+    emu_cfg.devices = strtol (env, NULL, 10);
+  if ((env = getenv ("RIOUTIL_EMU_LATENCY")) != NULL)
+    emu_cfg.latency = strtol (env, NULL, 10);
+  if ((env = getenv ("RIOUTIL_EMU_BANDWIDTH")) != NULL)
+    emu_cfg.bandwidth = strtol (env, NULL, 10);
+  if ((env = getenv ("RIOUTIL_EMU_ACK")) != NULL)
+    emu_cfg.ack_delay = strtol (env, NULL, 10);
+  if ((env = getenv ("RIOUTIL_EMU_MEMORY")) != NULL)
+    emu_cfg.mem_size = strtoul (env, NULL, 10) * 1024 * 1024;
+
+  emu_cfg_set = 1;
+}
+
+void emu_set_config (struct emu_config *config) {
+  pthread_mutex_lock (&emu_lock);
+
+  if (config == NULL) {
+    emu_cfg_set = 0;
+  } else {
+    emu_cfg = *config;
+    emu_cfg_set = 1;
+  }
+
+  pthread_mutex_unlock (&emu_lock);
+}
+
+static struct emu_device *emu_device_create (int number) {
+  struct player_device_info *p;
+  struct emu_device *emu;
+  struct emu_model *model;
+  rio_prefs_t *prefs;
+  int i;
+
+  for (p = &player_devices[0] ; p->vendor_id ; p++)
+    if (strcasecmp (p->name, emu_cfg.player) == 0)
+      break;
+
+  if (p->vendor_id == 0) {
+    error("driver_emu.c: unknown player \"%s\"", emu_cfg.player);
+    return NULL;
+  }
+
+  emu = calloc (1, sizeof (struct emu_device));
+  if (emu == NULL)
+    return NULL;
+
+  emu->entry = p;
+
+  model = emu_model_lookup (p->gen);
+  emu->model = *model;
+
+  if (emu_cfg.latency >= 0)
+    emu->model.latency = emu_cfg.latency;
+  if (emu_cfg.bandwidth >= 0)
+    emu->model.bandwidth = emu_cfg.bandwidth;
+  if (emu_cfg.ack_delay >= 0)
+    emu->model.ack_delay = emu_cfg.ack_delay;
+
+  /* flash players from the 3rd generation had a backpack slot */
+  emu->num_units = (p->gen == 3 && p->type != RIORIOT) ? 2 : 1;
+
+  for (i = 0 ; i < emu->num_units ; i++) {
+    emu->units[i].size = (i == 0) ? emu_cfg.mem_size : emu_cfg.mem_size / 2;
+    snprintf (emu->units[i].name, 64, (i == 0) ? "Internal Memory" : "External Memory");
+  }
+
+  memcpy (emu->serial_number, "RIOUTIL-EMULATOR", 16);
+  emu->serial_number[15] = '0' + number;
+
+  prefs = (rio_prefs_t *) emu->prefs;
+  snprintf (prefs->name, 16, "Emulated %d", number);
+  prefs->volume = 10;
+  prefs->contrast = 5;
+
+  return emu;
+}
+
+int usb_open_rio (rios_t *rio, int number) {
+  struct rioutil_usbdevice *plyr;
+
+  debug("librioutil/driver_emu.c:usb_open_rio(rio=%x,number=%d)", rio, number);
+
+  pthread_mutex_lock (&emu_lock);
+
+  emu_default_config ();
+
+  if (number < 0 || number >= emu_cfg.devices || number >= EMU_MAX_DEVICES) {
+    pthread_mutex_unlock (&emu_lock);
+    return -ENOENT;
+  }
+
+  /* emulated players keep their contents until the process exits */
+  if (emu_devices[number] == NULL)
+    emu_devices[number] = emu_device_create (number);
+
+  pthread_mutex_unlock (&emu_lock);
+
+  if (emu_devices[number] == NULL)
+    return -ENOENT;
+
+  plyr = (struct rioutil_usbdevice *) calloc (1, sizeof (struct rioutil_usbdevice));
+  if (plyr == NULL)
+    return -ENOMEM;
+
+  plyr->dev   = emu_devices[number];
+  plyr->entry = emu_devices[number]->entry;
+
+  emu_reset_state (emu_devices[number]);
+
+  rio->dev = (void *) plyr;
+
+  return 0;
+}
+
+int usb_count_rio (void) {
+  int count;
+
+  pthread_mutex_lock (&emu_lock);
+
+  emu_default_config ();
+  count = (emu_cfg.devices < EMU_MAX_DEVICES) ? emu_cfg.devices : EMU_MAX_DEVICES;
+
+  pthread_mutex_unlock (&emu_lock);
+
+  return count;
+}
+
+void usb_close_rio (rios_t *rio) {
+  struct rioutil_usbdevice *dev = (struct rioutil_usbdevice *)rio->dev;
+
+  if (NULL == dev)
+    return;
+
+  free (dev);
+
+  rio->dev = NULL;
+}
+
+int control_msg (rios_t *rio, u_int8_t request, u_int16_t value,
+		 u_int16_t index, u_int16_t length, unsigned char *buffer) {
+  struct emu_device *emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  int ret;
+
+  emu_charge (emu, length);
+  if ((ret = emu_command (emu, request, value, index)) < 0)
+    return ret;
+
+  memset (buffer, 0, length);
+  buffer[0] = 0x1;
+
+  return URIO_SUCCESS;
+}
+
+/* returns the number of bytes written or -ENOMEM if the player could not store them */
+static int emu_write (struct emu_device *emu, unsigned char *buffer, u_int32_t size, u_int64_t *done) {
+  int ret;
+
+  *done = emu_schedule (emu, size);
+
+  emu->stats.bulk_out++;
+  emu->stats.bytes_out += size;
+
+  ret = emu_host_write (emu, buffer, size);
+
+  return (ret < 0) ? ret : (int) size;
+}
+
+/* returns the number of bytes read or -1 if the player has nothing to send */
+static int emu_read (struct emu_device *emu, unsigned char *buffer, u_int32_t size, u_int64_t *done) {
+  u_int32_t avail = emu->out_len - emu->out_pos;
+  u_int64_t rtt;
+
+  if (avail == 0)
+    return -1;
+
+  if (size > avail)
+    size = avail;
+
+  *done = emu_schedule (emu, size);
+
+  memcpy (buffer, emu->out + emu->out_pos, size);
+  emu->out_pos += size;
+
+  emu->stats.bulk_in++;
+  emu->stats.bytes_in += size;
+
+  /* a block round trip ends when the host has the answer (and data) for it */
+  if (emu->block_start && emu->out_pos == emu->out_len) {
+    rtt = *done - emu->block_start;
+    emu->block_start = 0;
+
+    emu->stats.block_time += rtt;
+    if (rtt > emu->stats.block_max)
+      emu->stats.block_max = rtt;
+    if (emu->stats.block_min == 0 || rtt < emu->stats.block_min)
+      emu->stats.block_min = rtt;
+  }
+
+  return size;
+}
+
+int write_bulk (rios_t *rio, unsigned char *buffer, u_int32_t size) {
+  struct emu_device *emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  u_int64_t done;
+  int ret;
+
+  ret = emu_write (emu, buffer, size, &done);
+
+  emu_sleep_until (done);
+
+  return ret;
+}
+
+int read_bulk (rios_t *rio, unsigned char *buffer, u_int32_t size) {
+  struct emu_device *emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  u_int64_t done;
+  int ret;
+
+  ret = emu_read (emu, buffer, size, &done);
+  if (ret < 0) {
+    /* a real device would time out here */
+    error("librioutil/driver_emu.c:read_bulk() nothing to read. size = %i", size);
+    return -1;
+  }
+
+  emu_sleep_until (done);
+
+  return ret;
+}
+
+int read_bulk_timeout (rios_t *rio, unsigned char *buffer, u_int32_t size, u_int32_t timeout) {
+  struct emu_device *emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  u_int64_t deadline = emu_now () + timeout;
+
+  /* the response is not available until the player is ready */
+  if (emu->out_len == emu->out_pos || emu->ready_at > deadline) {
+    emu_sleep_until (deadline);
+    return -ETIMEDOUT;
+  }
+
+  return read_bulk (rio, buffer, size);
+}
+
+/* asynchronous transfers are carried out by the player when they are submitted. the
+   host only waits for their modeled completion when they are reaped */
+struct rio_xfer {
+  int result;
+  u_int64_t done;
+};
+
+int usb_submit_bulk (rios_t *rio, int direction, unsigned char *buffer, u_int32_t size,
+		     u_int32_t timeout, struct rio_xfer **xferp) {
+  struct emu_device *emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  struct rio_xfer *xfer;
+
+  xfer = (struct rio_xfer *) calloc (1, sizeof (struct rio_xfer));
+  if (xfer == NULL)
+    return -ENOMEM;
+
+  if (direction == RIO_BULK_OUT) {
+    xfer->result = emu_write (emu, buffer, size, &xfer->done);
+  } else {
+    xfer->result = emu_read (emu, buffer, size, &xfer->done);
+    if (xfer->result < 0) {
+      xfer->result = -ETIMEDOUT;
+      xfer->done   = emu_now () + timeout;
+    }
+  }
+
+  *xferp = xfer;
+
+  return 0;
+}
+
+int usb_reap_bulk (rios_t *rio, struct rio_xfer *xfer) {
+  int ret = xfer->result;
+
+  (void) rio;
+
+  emu_sleep_until (xfer->done);
+  free (xfer);
+
+  return ret;
+}
+
+int emu_get_stats (rios_t *rio, struct emu_stats *stats) {
+  struct emu_device *emu;
+
+  if (rio == NULL || rio->dev == NULL || stats == NULL)
+    return -EINVAL;
+
+  emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  *stats = emu->stats;
+
+  return 0;
+}
+
+void emu_reset_stats (rios_t *rio) {
+  struct emu_device *emu;
+
+  if (rio == NULL || rio->dev == NULL)
+    return;
+
+  emu = (struct emu_device *)((struct rioutil_usbdevice *) rio->dev)->dev;
+  memset (&emu->stats, 0, sizeof (emu->stats));
+}
+
+void usb_setdebug (int i) {
+  (void) i;
+}
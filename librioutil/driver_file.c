@@ -22,6 +22,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
 
 #include <errno.h>
 
@@ -84,6 +86,26 @@ int read_bulk (rios_t *rio, unsigned char *buffer, u_int32_t size) {
     return -1;
 }
 
+int read_bulk_timeout (rios_t *rio, unsigned char *buffer, u_int32_t size, u_int32_t timeout) {
+  struct rioutil_usbdevice *dev = (struct rioutil_usbdevice *)rio->dev;
+  struct pollfd pfd;
+  int ret;
+
+  if (!dev)
+    return -1;
+
+  pfd.fd     = (int)dev->dev;
+  pfd.events = POLLIN;
+
+  ret = poll (&pfd, 1, (timeout + 999) / 1000);
+  if (ret == 0)
+    return -ETIMEDOUT;
+  else if (ret < 0)
+    return -errno;
+
+  return read ((int)dev->dev, buffer, size);
+}
+
 int write_bulk (rios_t *rio, unsigned char *buffer, u_int32_t size) {
   struct rioutil_usbdevice *dev = (struct rioutil_usbdevice *)rio->dev;
 
@@ -93,6 +115,39 @@ int write_bulk (rios_t *rio, unsigned char *buffer, u_int32_t size) {
     return -1;
 }
 
+/* the device file interface is synchronous. transfers are performed when submitted */
+struct rio_xfer {
+  int result;
+};
+
+int usb_submit_bulk (rios_t *rio, int direction, unsigned char *buffer, u_int32_t size,
+		     u_int32_t timeout, struct rio_xfer **xferp) {
+  struct rio_xfer *xfer;
+
+  xfer = (struct rio_xfer *)calloc(1, sizeof(struct rio_xfer));
+  if (xfer == NULL)
+    return -ENOMEM;
+
+  if (direction == RIO_BULK_IN)
+    xfer->result = read_bulk_timeout (rio, buffer, size, timeout);
+  else
+    xfer->result = write_bulk (rio, buffer, size);
+
+  *xferp = xfer;
+
+  return 0;
+}
+
+int usb_reap_bulk (rios_t *rio, struct rio_xfer *xfer) {
+  int ret = xfer->result;
+
+  (void) rio;
+
+  free (xfer);
+
+  return ret;
+}
+
 int usb_open_rio (rios_t *rio, int number) {
   char fileName[FILENAME_MAX+2];
   struct rioutil_usbdevice *plyr;
@@ -141,6 +196,21 @@ int usb_open_rio (rios_t *rio, int number) {
   return 0;
 }
 
+int usb_count_rio (void) {
+  char fileName[FILENAME_MAX+2];
+  int count;
+
+  /* device minors are assigned in order starting at 0 */
+  for (count = 0 ; ; count++) {
+    snprintf(fileName, FILENAME_MAX, "%s%i", RIODEVICE, count);
+
+    if (access (fileName, R_OK | W_OK) != 0)
+      break;
+  }
+
+  return count;
+}
+
 int control_msg(rios_t *rio, u_int8_t request, u_int16_t value,
 		u_int16_t index, u_int16_t length, unsigned char *buffer) {
   struct rioutil_usbdevice *dev = (struct rioutil_usbdevice *)rio->dev;
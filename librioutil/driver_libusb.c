@@ -19,7 +19,9 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <libusb.h>
 
@@ -29,50 +31,111 @@
 char driver_method[] = "libusb";
 static int usb_rio_open_count = 0;
 static int usb_debug_level = 0;
+/* protects usb_rio_open_count. players may be opened from several threads */
+static pthread_mutex_t usb_rio_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* take a reference on the default libusb context, initializing it if needed */
+static int usb_init_rio (void) {
+  int ret = LIBUSB_SUCCESS;
+
+  pthread_mutex_lock (&usb_rio_lock);
+
+  if (!usb_rio_open_count) {
+    ret = libusb_init (NULL);
+
+    if (LIBUSB_SUCCESS == ret && usb_debug_level)
+      libusb_set_debug (NULL, usb_debug_level);
+  }
+
+  if (LIBUSB_SUCCESS == ret)
+    usb_rio_open_count++;
+
+  pthread_mutex_unlock (&usb_rio_lock);
+
+  return ret;
+}
+
+static void usb_exit_rio (void) {
+  pthread_mutex_lock (&usb_rio_lock);
+
+  if (!--usb_rio_open_count)
+    libusb_exit (NULL);
+
+  pthread_mutex_unlock (&usb_rio_lock);
+}
+
+static struct player_device_info *usb_match_rio (libusb_device *device) {
+  struct libusb_device_descriptor descriptor;
+  struct player_device_info *p;
+
+  if (LIBUSB_SUCCESS != libusb_get_device_descriptor (device, &descriptor))
+    return NULL;
+
+  debug("USB Device: idVendor = %08x, idProduct = %08x", descriptor.idVendor, descriptor.idProduct);
+
+  for (p = &player_devices[0] ; p->vendor_id ; p++)
+    if (descriptor.idVendor == p->vendor_id && descriptor.idProduct == p->product_id)
+      return p;
+
+  return NULL;
+}
+
+int usb_count_rio (void) {
+  libusb_device **device_list;
+  int i, count, found = 0;
+
+  if (LIBUSB_SUCCESS != usb_init_rio ())
+    return -1;
+
+  count = libusb_get_device_list (NULL, &device_list);
+  if (0 > count) {
+    error("librioutil/driver_libusb.c:usb_count_rio() error getting device list");
+    usb_exit_rio ();
+    return -1;
+  }
+
+  for (i = 0 ; i < count ; i++)
+    if (usb_match_rio (device_list[i]))
+      found++;
+
+  libusb_free_device_list (device_list, 1);
+
+  usb_exit_rio ();
+
+  return found;
+}
 
 int usb_open_rio (rios_t *rio, int number) {
   struct rioutil_usbdevice *plyr;
 
   libusb_device **device_list;
-  struct libusb_device_descriptor descriptor;
 
   int current = 0, ret, i, count;
-  struct player_device_info *p;
+  struct player_device_info *p = NULL;
 
   libusb_device *plyr_device = NULL;
 
   debug("librioutil/driver_libusb.c:usb_open_rio(rio=%x,number=%d)", rio, number);
 
-  do {
-    if (!usb_rio_open_count++) {
-      ret = libusb_init (NULL);
-      if (LIBUSB_SUCCESS != ret)
-        return -1;
-
-      if (usb_debug_level)
-	libusb_set_debug (NULL, usb_debug_level);
-    }
+  if (LIBUSB_SUCCESS != usb_init_rio ())
+    return -1;
 
+  do {
     /* find a suitable device based on device table and player number */
     count = libusb_get_device_list (NULL, &device_list);
     if (0 > count) {
       error("librioutil/driver_libusb.c:usb_open_rio() error getting device list");
+      ret = -1;
       break;
     }
 
-    for (i = 0 ; device_list[i] && !plyr_device ; ++i) {
-      ret = libusb_get_device_descriptor (device_list[i], &descriptor);
-
-      debug("USB Device: idVendor = %08x, idProduct = %08x", descriptor.idVendor, descriptor.idProduct);
-
-      for (p = &player_devices[0] ; p->vendor_id && !plyr_device ; p++) {
-        if (descriptor.idVendor == p->vendor_id && descriptor.idProduct == p->product_id &&
-            current++ == number)
-          plyr_device = device_list[i];
-      }
+    for (i = 0 ; device_list[i] ; ++i) {
+      p = usb_match_rio (device_list[i]);
 
       /* found it */
-      if (plyr_device) {
+      if (p && current++ == number) {
+        plyr_device = device_list[i];
+
         /* reference this device so it isn't freed by libusb_free_device_list (, 1) */
         libusb_ref_device (plyr_device);
         break;
@@ -82,7 +145,7 @@ int usb_open_rio (rios_t *rio, int number) {
     /* have libusb unreference all devices */
     libusb_free_device_list (device_list, 1);
 
-    if (plyr_device == NULL || p->product_id == 0) {
+    if (plyr_device == NULL) {
       ret = -ENOENT;
       break;
     }
@@ -96,6 +159,9 @@ int usb_open_rio (rios_t *rio, int number) {
 
     plyr->entry = p;
 
+    /* from here on usb_close_rio cleans up after a failure */
+    rio->dev    = (void *)plyr;
+
     /* open the device */
     ret = libusb_open (plyr_device, (libusb_device_handle **) &plyr->dev);
     if (LIBUSB_SUCCESS != ret) {
@@ -106,6 +172,7 @@ int usb_open_rio (rios_t *rio, int number) {
 
     /* we can release our reference to the device now */
     libusb_unref_device (plyr_device);
+    plyr_device = NULL;
 
     ret = libusb_set_configuration ((libusb_device_handle *) plyr->dev, 1);
     if (LIBUSB_SUCCESS != ret) {
@@ -121,8 +188,6 @@ int usb_open_rio (rios_t *rio, int number) {
       break;
     }
 
-    rio->dev    = (void *)plyr;
-
     debug("librioutil/driver_libusb.c:usb_open_rio() Success");
 
     return 0;
@@ -132,7 +197,10 @@ int usb_open_rio (rios_t *rio, int number) {
     libusb_unref_device (plyr_device);
   }
 
-  usb_close_rio (rio);
+  if (rio->dev)
+    usb_close_rio (rio);
+  else
+    usb_exit_rio ();
 
   return ret;
 }
@@ -153,9 +221,7 @@ void usb_close_rio (rios_t *rio) {
 
   rio->dev = NULL;
 
-  if (!--usb_rio_open_count) {
-    libusb_exit (NULL);
-  }
+  usb_exit_rio ();
 }
 
 /* direction is unused  here */
@@ -208,6 +274,156 @@ int read_bulk(rios_t *rio, unsigned char *buffer, u_int32_t buffer_size){
   return transferred;
 }
 
+int read_bulk_timeout (rios_t *rio, unsigned char *buffer, u_int32_t buffer_size, u_int32_t timeout) {
+  struct rioutil_usbdevice *dev = (struct rioutil_usbdevice *)rio->dev;
+
+  int ret, transferred = 0;
+
+  /* libusb timeouts have a granularity of 1 ms */
+  ret = libusb_bulk_transfer ((libusb_device_handle *) dev->dev, dev->entry->iep | 0x80,
+                              buffer, buffer_size, &transferred, (timeout + 999) / 1000);
+  if (LIBUSB_ERROR_TIMEOUT == ret && 0 == transferred) {
+    /* the device has not responded yet. this is not an error */
+    return -ETIMEDOUT;
+  }
+
+  if (LIBUSB_SUCCESS != ret) {
+    error("librioutil/driver_libusb.c:read_bulk_timeout() error reading from device (rc = %i). size = %i. resetting..\n", ret, buffer_size);
+
+    libusb_reset_device ((libusb_device_handle *) dev->dev);
+    return -1;
+  }
+
+  return transferred;
+}
+
+/* libusb transfers go through a buffer owned by the transfer, so a transfer that can not
+   be drained never points at the caller's memory (block buffers are often on the stack) */
+struct rio_xfer {
+  struct libusb_transfer *transfer;
+  unsigned char *buffer;
+  /* where the data of a read is copied to when it is reaped */
+  unsigned char *user_buffer;
+  int completed;
+  /* given up on by usb_reap_bulk. the callback frees the transfer if it ever runs */
+  int abandoned;
+};
+
+static void rio_xfer_free (struct rio_xfer *xfer) {
+  libusb_free_transfer (xfer->transfer);
+  free (xfer->buffer);
+  free (xfer);
+}
+
+static void LIBUSB_CALL bulk_complete (struct libusb_transfer *transfer) {
+  struct rio_xfer *xfer = (struct rio_xfer *) transfer->user_data;
+
+  if (xfer->abandoned) {
+    rio_xfer_free (xfer);
+    return;
+  }
+
+  xfer->completed = 1;
+}
+
+int usb_submit_bulk (rios_t *rio, int direction, unsigned char *buffer, u_int32_t buffer_size,
+		     u_int32_t timeout, struct rio_xfer **xferp) {
+  struct rioutil_usbdevice *dev = (struct rioutil_usbdevice *)rio->dev;
+  struct rio_xfer *xfer;
+  unsigned char endpoint;
+  int ret;
+
+  xfer = (struct rio_xfer *) calloc (1, sizeof (struct rio_xfer));
+  if (NULL == xfer)
+    return -ENOMEM;
+
+  xfer->buffer = (unsigned char *) malloc (buffer_size ? buffer_size : 1);
+  xfer->transfer = libusb_alloc_transfer (0);
+  if (NULL == xfer->buffer || NULL == xfer->transfer) {
+    libusb_free_transfer (xfer->transfer);
+    free (xfer->buffer);
+    free (xfer);
+    return -ENOMEM;
+  }
+
+  if (RIO_BULK_IN == direction) {
+    endpoint = dev->entry->iep | 0x80;
+    xfer->user_buffer = buffer;
+  } else {
+    endpoint = dev->entry->oep;
+    memcpy (xfer->buffer, buffer, buffer_size);
+  }
+
+  libusb_fill_bulk_transfer (xfer->transfer, (libusb_device_handle *) dev->dev, endpoint, xfer->buffer,
+                             buffer_size, bulk_complete, xfer, (timeout + 999) / 1000);
+
+  ret = libusb_submit_transfer (xfer->transfer);
+  if (LIBUSB_SUCCESS != ret) {
+    error("librioutil/driver_libusb.c:usb_submit_bulk() error submitting transfer: %s", libusb_error_name(ret));
+
+    rio_xfer_free (xfer);
+    return -EIO;
+  }
+
+  *xferp = xfer;
+
+  return 0;
+}
+
+/* consecutive event handling failures before a transfer is given up on */
+#define REAP_MAX_ERRORS 16
+
+int usb_reap_bulk (rios_t *rio, struct rio_xfer *xfer) {
+  int ret, cancelled = 0, errors = 0;
+
+  (void) rio;
+
+  /* once event handling fails the transfer is cancelled and events are handled until
+     the cancellation completes */
+  while (!xfer->completed) {
+    ret = libusb_handle_events_completed (NULL, &xfer->completed);
+    if (LIBUSB_SUCCESS == ret || LIBUSB_ERROR_INTERRUPTED == ret) {
+      errors = 0;
+      continue;
+    }
+
+    if (!cancelled) {
+      libusb_cancel_transfer (xfer->transfer);
+      cancelled = 1;
+    }
+
+    if (++errors == REAP_MAX_ERRORS) {
+      error("librioutil/driver_libusb.c:usb_reap_bulk() error handling events: %s", libusb_error_name(ret));
+
+      /* libusb still owns the transfer. it only refers to its own buffer so the caller's
+	 memory is safe to release. the transfer is leaked unless it completes later */
+      xfer->abandoned = 1;
+
+      return -EIO;
+    }
+  }
+
+  switch (xfer->transfer->status) {
+  case LIBUSB_TRANSFER_COMPLETED:
+    ret = xfer->transfer->actual_length;
+
+    if (xfer->user_buffer != NULL)
+      memcpy (xfer->user_buffer, xfer->buffer, ret);
+    break;
+  case LIBUSB_TRANSFER_TIMED_OUT:
+    ret = -ETIMEDOUT;
+    break;
+  default:
+    error("librioutil/driver_libusb.c:usb_reap_bulk() transfer failed (status = %i). size = %i",
+	  xfer->transfer->status, xfer->transfer->length);
+    ret = -EIO;
+  }
+
+  rio_xfer_free (xfer);
+
+  return ret;
+}
+
 void usb_setdebug (int i) {
   usb_debug_level = i;
 }
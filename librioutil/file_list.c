@@ -35,6 +35,7 @@
 
 #include "rioi.h"
 #include "riolog.h"
+#include "driver.h"
 
 #if defined (HAVE_LIBGEN_H)
 #include <libgen.h>
@@ -43,9 +44,13 @@
 /*
   get_flist_riomc:
     Downloads the file list off of flash based players (Rio600, Rio800, S-Series, etc.).
+    Headers are read in order starting after the last one already in the list until
+    count files are in the list or the end of the list is reached.
 */
-int generate_flist_riomc (rios_t *rio, u_int8_t memory_unit) {
-  int i, ret;
+int generate_flist_riomc (rios_t *rio, u_int8_t memory_unit, uint count) {
+  rio_file_table_t *table = &rio->file_table[memory_unit];
+  uint i;
+  int ret;
   rio_file_t file;
   
   info_page_t info;
@@ -61,48 +66,47 @@ int generate_flist_riomc (rios_t *rio, u_int8_t memory_unit) {
     the data in the file headers is garbage. This state can result in the termination
     condition (file number == 0) never being reached.
   */
-  for (i = 0 ; i < MAX_RIO_FILES ; i++) {
+  for (i = table->size ; i < count && i < MAX_RIO_FILES ; i++) {
     ret = get_file_info_rio(rio, &file, memory_unit, i);
 
     if (ret != URIO_SUCCESS) {
-      if (ret == -ENOENT) 
+      if (ret == -ENOENT) {
 	ret = URIO_SUCCESS;  /* not an error */
+	table->complete = 1;
+      }
       break;
     }
 
     flist_add_rio (rio, memory_unit, info);
   }
+
+  if (i == MAX_RIO_FILES)
+    table->complete = 1;
   
   debug("generate_flist_riomc(): complete\n");
 
   return ret;
 }
 
-int hdfile_to_mcfile  (hd_file_t *hdf, rio_file_t *file, int file_no) {
-  if (!hdf || !file)
-    return -EINVAL;
-
-  file->file_no = file_no;
-  file->size = hdf->size;
-
-  strncpy(file->artist, (char *)hdf->artist, 48);
-  strncpy(file->title, (char *)hdf->title, 48);
-  strncpy(file->album, (char *)hdf->album, 48);
-  strncpy(file->name, (char *)hdf->file_name, 27);
-
-  file->type = TYPE_MP3;
-
-  return 0;
+/* copy a fixed length string from a Riot file header. they are not always terminated */
+static void riohd_strcpy (char *dst, u_int8_t *src, size_t len) {
+  memcpy (dst, src, len);
+  dst[len] = '\0';
 }
 
 /*
   get_flist_riohd:
    Downloads the file list off of a hard drive based player (Rio Riot).
+
+   The player sends the list in RIO_FTS blocks of hd_file_t, one block for each
+   CRIODATA request. The request for the next block is submitted before the current
+   block is parsed so the player's round trip overlaps the parsing. Entries are parsed
+   straight into the file list.
 */
 int generate_flist_riohd (rios_t *rio) {
-  int ret, i, block_count;
-  rio_file_t file;
-  info_page_t info;
+  int ret, i;
+  u_int8_t request[64], response[64];
+  struct rio_xfer *xfer[2];
 
   hd_file_t *hdf;
   u_int8_t read_buffer[RIO_FTS];
@@ -117,43 +121,151 @@ int generate_flist_riohd (rios_t *rio) {
   }
 
   hdf = (hd_file_t *)read_buffer;
-  info.data = &file;
-  block_count = 0;
 
   read_block_rio (rio, read_buffer, 0x40, RIO_FTS);
 
+  memset (request, 0, 64);
+  memcpy (request, "CRIODATA", 8);
+
+  ret = usb_submit_bulk (rio, RIO_BULK_OUT, request, 64, 8000000, &xfer[0]);
+  if (ret < 0)
+    return ret;
+
+  ret = usb_submit_bulk (rio, RIO_BULK_IN, response, 64, 8000000, &xfer[1]);
+  if (ret < 0) {
+    (void)usb_reap_bulk (rio, xfer[0]);
+    return ret;
+  }
+
   while (1) {
-    sprintf ((char *)rio->buffer, "CRIODATA");
+    /* response to the last CRIODATA */
+    ret = usb_reap_bulk (rio, xfer[0]);
+    i = usb_reap_bulk (rio, xfer[1]);
+    if (ret >= 0 && i < 0)
+      ret = i;
+    if (ret < 0)
+      break;
 
-    ret = write_block_rio (rio, rio->buffer, 0x40, NULL);
+    memcpy (rio->buffer, response, 64);
+    rio_log_data ("In", response, 64);
 
     /* device returns SRIODONE when the transfer is complete */
-    if (strstr ((char *)rio->buffer, "SRIODONE") != NULL)
+    if (strstr ((char *)response, "SRIODONE") != NULL) {
+      ret = URIO_SUCCESS;
+      rio->file_table[0].complete = 1;
       break;
+    }
 
     ret = read_block_rio (rio, read_buffer, RIO_FTS, RIO_FTS);
+    if (ret != URIO_SUCCESS)
+      break;
+
+    /* ask for the next block while this one is parsed */
+    ret = usb_submit_bulk (rio, RIO_BULK_OUT, request, 64, 8000000, &xfer[0]);
+    if (ret < 0)
+      break;
+
+    ret = usb_submit_bulk (rio, RIO_BULK_IN, response, 64, 8000000, &xfer[1]);
+    if (ret < 0) {
+      (void)usb_reap_bulk (rio, xfer[0]);
+      break;
+    }
 
     /* 0x40 is RIO_FTS/hdr_size */
     for (i = 0 ; i < 0x40 ; i++) {
-      if (hdf->unk0 == 0) /* blank song entry */
+      if (hdf[i].unk0 == 0) /* blank song entry */
 	continue;
 
       /* add to the file list */
-      hdfile_to_mcfile (&hdf[i], &file, i + block_count);
-      flist_add_rio (rio, 0, info);
+      if (flist_add_riohd (rio, &hdf[i]) != URIO_SUCCESS)
+	error("create_flist_riohd: could not add a file to the list");
     }
-
-    block_count += i;
   }
 
   debug("create_flist_riohd: complete");
 
-  return ret;
+  return (ret < 0) ? ret : URIO_SUCCESS;
+}
+
+/*
+  The file table holds the files on each memory unit in list order so a file's
+  position (inum) is its index in the table. File numbers (num) and player file
+  ids (rio_num) only ever increase along the list so both can be found with a
+  binary search.
+*/
+static int flist_table_grow (rios_t *rio, rio_file_table_t *table) {
+  flist_rio_t **tmp;
+  uint alloc;
+
+  if (table->size < table->alloc)
+    return URIO_SUCCESS;
+
+  alloc = table->alloc ? table->alloc * 2 : 64;
+
+  tmp = (flist_rio_t **) realloc (table->entries, alloc * sizeof (flist_rio_t *));
+  if (tmp == NULL) {
+    error ("flist_table_grow: realloc returned an error (%s).", strerror (errno));
+    return -ENOMEM;
+  }
+
+  table->entries = tmp;
+  table->alloc   = alloc;
+
+  /* the entries moved */
+  rio->flist_gen++;
+
+  return URIO_SUCCESS;
+}
+
+/* returns the table index of the file with the given num or -1 if there is none */
+static int flist_table_find (rio_file_table_t *table, uint file_no) {
+  uint low = 0, high = table->size, mid;
+
+  while (low < high) {
+    mid = low + (high - low) / 2;
+
+    if (table->entries[mid]->num < file_no)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  if (low < table->size && table->entries[low]->num == file_no)
+    return low;
+
+  return -1;
+}
+
+/* returns the index of the first file whose id is past the first unused file id */
+static uint flist_table_first_gap (rio_file_table_t *table, uint file_incr) {
+  uint low = 0, high = table->size, mid;
+
+  /* ids are unique and increasing so every file before the first gap has id (index + 1) * file_incr */
+  while (low < high) {
+    mid = low + (high - low) / 2;
+
+    if (table->entries[mid]->rio_num == (mid + 1) * file_incr)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+void flist_table_free_rio (rios_t *rio) {
+  int i;
+
+  rio->flist_gen++;
+
+  for (i = 0 ; i < MAX_MEM_UNITS ; i++) {
+    free (rio->file_table[i].entries);
+    memset (&rio->file_table[i], 0, sizeof (rio_file_table_t));
+  }
 }
 
 int flist_first_free_rio (rios_t *rio, int memory_unit) {
-  flist_rio_t *prev;
-  uint file_incr, next_num;
+  uint file_incr;
 
   if (!rio || memory_unit >= MAX_MEM_UNITS)
     return -EINVAL;
@@ -161,11 +273,128 @@ int flist_first_free_rio (rios_t *rio, int memory_unit) {
   /* older devices increment the file id by 1 while newer devices increment the file id by 16 */
   file_incr = (return_generation_rio (rio) < 4) ? 0x01 : 0x10;
 
-  for (prev = rio->info.memory[memory_unit].files, next_num = file_incr ; prev ; prev = prev->next, next_num += file_incr)
-    if (next_num < prev->rio_num)
-      break;
+  (void)flist_load_rio (rio, memory_unit, MAX_RIO_FILES);
+
+  return (flist_table_first_gap (&rio->file_table[memory_unit], file_incr) + 1) * file_incr;
+}
+
+/*
+  flist nodes are carved out of slabs owned by the rio instance. Removed nodes are kept
+  on a free list for the next upload and all of the slabs are released at once when the
+  file list is thrown away. The first slab after a refresh is sized to hold the whole
+  previous list so regenerating the list costs a single allocation.
+*/
+struct flist_slab {
+  struct flist_slab *next;
+  uint size, used;
+  flist_rio_t *nodes;
+};
+
+struct flist_pool {
+  struct flist_slab *slabs;
+  flist_rio_t *free_nodes;
+
+  uint capacity; /* nodes in all slabs */
+  uint in_use;
+  uint hint;     /* nodes in use when the pool was last reset */
+};
+
+static flist_rio_t *flist_alloc (rios_t *rio) {
+  struct flist_pool *pool = (struct flist_pool *) rio->flist_pool;
+  struct flist_slab *slab;
+  flist_rio_t *flist;
+  uint size;
+
+  if (pool == NULL) {
+    pool = (struct flist_pool *) calloc (1, sizeof (struct flist_pool));
+    if (pool == NULL)
+      return NULL;
+
+    rio->flist_pool = pool;
+  }
 
-  return next_num;
+  if (pool->free_nodes) {
+    flist = pool->free_nodes;
+    pool->free_nodes = flist->next;
+  } else {
+    slab = pool->slabs;
+
+    if (slab == NULL || slab->used == slab->size) {
+      /* grow geometrically but start with room for the last full list */
+      size = (pool->capacity > 64) ? pool->capacity : 64;
+      if (pool->hint > pool->capacity + size)
+	size = pool->hint - pool->capacity;
+
+      slab = (struct flist_slab *) malloc (sizeof (struct flist_slab) + size * sizeof (flist_rio_t));
+      if (slab == NULL)
+	return NULL;
+
+      slab->nodes = (flist_rio_t *)(slab + 1);
+      slab->size  = size;
+      slab->used  = 0;
+      slab->next  = pool->slabs;
+
+      pool->slabs     = slab;
+      pool->capacity += size;
+    }
+
+    flist = &slab->nodes[slab->used++];
+  }
+
+  pool->in_use++;
+
+  memset (flist, 0, sizeof (flist_rio_t));
+
+  return flist;
+}
+
+static void flist_release (rios_t *rio, flist_rio_t *flist) {
+  struct flist_pool *pool = (struct flist_pool *) rio->flist_pool;
+
+  flist->next = pool->free_nodes;
+  pool->free_nodes = flist;
+  pool->in_use--;
+}
+
+void flist_pool_reset_rio (rios_t *rio) {
+  struct flist_pool *pool = (struct flist_pool *) rio->flist_pool;
+  struct flist_slab *slab, *next;
+
+  if (pool == NULL)
+    return;
+
+  for (slab = pool->slabs ; slab ; slab = next) {
+    next = slab->next;
+    free (slab);
+  }
+
+  pool->hint       = pool->in_use;
+  pool->slabs      = NULL;
+  pool->free_nodes = NULL;
+  pool->capacity   = 0;
+  pool->in_use     = 0;
+}
+
+void flist_pool_free_rio (rios_t *rio) {
+  flist_pool_reset_rio (rio);
+
+  free (rio->flist_pool);
+  rio->flist_pool = NULL;
+}
+
+/* throw away the file list of every memory unit. called before the list is rebuilt */
+void flist_clear_rio (rios_t *rio) {
+  int i;
+
+  /* the database index points into the file list */
+  db_index_free_rio (rio);
+  flist_table_free_rio (rio);
+
+  /* every file list entry came from the pool */
+  flist_pool_reset_rio (rio);
+
+  for (i = 0 ; i < MAX_MEM_UNITS ; i++)
+    rio->info.memory[i].files = NULL;
 }
 
 /*
@@ -180,10 +409,10 @@ static flist_rio_t* flist_create (rios_t *rio, info_page_t info)
 
     debug("file_list.c flist_create: entering...");
 
-    flist = calloc (1, sizeof (flist_rio_t));
+    flist = flist_alloc (rio);
     if (flist == NULL)
     {
-        error("flist_create: calloc returned an error (%s).", strerror(errno));
+        error("flist_create: could not allocate a file list entry (%s).", strerror(errno));
 
         return NULL;
     }
@@ -234,11 +463,12 @@ static flist_rio_t* flist_create (rios_t *rio, info_page_t info)
   adds a file to the rio's internal file list
 */
 int flist_add_rio (rios_t *rio, int memory_unit, info_page_t info) {
+  rio_file_table_t *table;
   flist_rio_t *flist;
   flist_rio_t *next = NULL, *prev = NULL;
-  flist_rio_t *files;
-  
-  uint next_num, file_incr;
+
+  uint pos, i, file_incr;
+  int ret;
 
   debug("flist_add_rio(rio=%x,memory_unit=%d,info)", rio, memory_unit);
 
@@ -248,78 +478,262 @@ int flist_add_rio (rios_t *rio, int memory_unit, info_page_t info) {
   /* older devices increment the file id by 1 while newer devices increment the file id by 16 */
   file_incr = (return_generation_rio (rio) < 4) ? 0x01 : 0x10;
 
+  table = &rio->file_table[memory_unit];
+
   flist = flist_create( rio, info );
   if (flist == NULL) {
     error("flist_add_rio: flist_create failed.");
     return -EINVAL;
   }
 
-  files = rio->info.memory[memory_unit].files;
-
-  if (files == NULL) /* this is the first file added */
-  {
-    rio->info.memory[memory_unit].files = flist;
-
-    flist->prev = NULL;
-    flist->next = NULL;
-    flist->rio_num = file_incr;
-
-    rio->info.memory[memory_unit].num_files = 1;
-    rio->info.memory[memory_unit].total_time = flist->time;
-
-    return URIO_SUCCESS;
+  ret = flist_table_grow (rio, table);
+  if (ret != URIO_SUCCESS) {
+    flist_release (rio, flist);
+    return ret;
   }
 
-  for (next = files, next_num = file_incr ; next ; next = next->next, next_num += file_incr)
-  {
-      if ((info.data->file_no == 0 && next_num < next->rio_num) || info.data->file_no == next_num)
-	break;
+  /* new files take the first unused file id. files read from the player go in the slot
+     matching their id or at the end of the list */
+  if (info.data->file_no == 0)
+    pos = flist_table_first_gap (table, file_incr);
+  else if (info.data->file_no % file_incr == 0 && info.data->file_no / file_incr <= table->size)
+    pos = info.data->file_no / file_incr - 1;
+  else
+    pos = table->size;
 
-      prev = next;
-  }
+  if (pos > 0)
+    prev = table->entries[pos - 1];
+  if (pos < table->size)
+    next = table->entries[pos];
 
   flist->prev = prev;
   flist->next = next;
 
   if (prev)
     prev->next = flist;
+  else
+    rio->info.memory[memory_unit].files = flist;
 
   if (next)
     next->prev = flist;
 
+  /* a file read from the player keeps its id. ids that follow a deleted file are not
+     (pos + 1) * file_incr */
+  flist->rio_num = info.data->file_no ? info.data->file_no : (pos + 1) * file_incr;
+  flist->inum    = pos;
+  flist->num     = prev ? prev->num + 1 : 0;
 
-  flist->rio_num = next_num;
+  memmove (&table->entries[pos + 1], &table->entries[pos], (table->size - pos) * sizeof (flist_rio_t *));
+  table->entries[pos] = flist;
+  table->size++;
 
-  if (prev) {
-    flist->num  = prev->inum + 1;
-    flist->inum = prev->inum + 1;
+  /* increment all subsequent file numbers. nothing to do when appending */
+  for (i = pos + 1 ; i < table->size ; i++) {
+    table->entries[i]->inum = i;
+    table->entries[i]->num++;
   }
 
-  /* increment all subsequent file numbers */
-  for ( ; next ; next = next->next)
-  {
-    next->inum++;
-    next->num++;
-  }
- 
   rio->info.memory[memory_unit].num_files  += 1;
   rio->info.memory[memory_unit].total_time += flist->time;
+  rio->flist_gen++;
+
+  if (memory_unit == 0)
+    db_index_add_rio (rio, flist);
 
   debug("flist_add_rio: success");
 
   return 0;
 }
 
+/*
+  flist_append_rio:
+
+  appends a copy of entry to the end of the rio's internal file list. the entry keeps
+  its file id and is numbered the same way as a file read from the player. used when
+  the file list is read from the cache
+*/
+static int flist_table_append (rios_t *rio, int memory_unit, flist_rio_t *flist) {
+  rio_file_table_t *table = &rio->file_table[memory_unit];
+  flist_rio_t *prev;
+  int ret;
+
+  ret = flist_table_grow (rio, table);
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  prev = table->size ? table->entries[table->size - 1] : NULL;
+
+  flist->prev = prev;
+  flist->next = NULL;
+  flist->inum = table->size;
+  flist->num  = table->size;
+
+  if (prev)
+    prev->next = flist;
+  else
+    rio->info.memory[memory_unit].files = flist;
+
+  table->entries[table->size++] = flist;
+
+  rio->info.memory[memory_unit].num_files  += 1;
+  rio->info.memory[memory_unit].total_time += flist->time;
+  rio->flist_gen++;
+
+  if (memory_unit == 0)
+    db_index_add_rio (rio, flist);
+
+  return URIO_SUCCESS;
+}
+
+int flist_append_rio (rios_t *rio, int memory_unit, const flist_rio_t *entry) {
+  flist_rio_t *flist;
+  int ret;
+
+  if (!rio || !entry || memory_unit >= MAX_MEM_UNITS)
+    return -EINVAL;
+
+  flist = flist_alloc (rio);
+  if (flist == NULL)
+    return -ENOMEM;
+
+  *flist = *entry;
+
+  ret = flist_table_append (rio, memory_unit, flist);
+  if (ret != URIO_SUCCESS)
+    flist_release (rio, flist);
+
+  return ret;
+}
+
+/*
+  flist_add_riohd:
+
+  appends a file from a Riot file header to the end of the rio's internal file list.
+*/
+int flist_add_riohd (rios_t *rio, hd_file_t *hdf) {
+  flist_rio_t *flist;
+  int ret;
+
+  flist = flist_alloc (rio);
+  if (flist == NULL)
+    return -ENOMEM;
+
+  riohd_strcpy (flist->artist, hdf->artist, sizeof (hdf->artist));
+  riohd_strcpy (flist->title, hdf->title, sizeof (hdf->title));
+  riohd_strcpy (flist->album, hdf->album, sizeof (hdf->album));
+  riohd_strcpy (flist->name, hdf->file_name, sizeof (hdf->file_name));
+
+  flist->size         = little32_2_arch32 (hdf->size);
+  flist->time         = little32_2_arch32 (hdf->time);
+  flist->track_number = hdf->trackno;
+  flist->type         = RIO_FILETYPE_MP3;
+
+  /* the Riot numbers files from 1 */
+  flist->rio_num = rio->file_table[0].size + 1;
+
+  ret = flist_table_append (rio, 0, flist);
+  if (ret != URIO_SUCCESS)
+    flist_release (rio, flist);
+
+  return ret;
+}
+
+/*
+  flist_load_rio:
+
+  makes sure the first count files on a memory unit (or all of them if there are fewer)
+  have been read from the player. file headers are only read on demand when the rio was
+  opened with RIO_OPEN_LAZY. pass MAX_RIO_FILES to read the whole list.
+*/
+int flist_load_rio (rios_t *rio, u_int8_t memory_unit, uint count) {
+  rio_file_table_t *table;
+  int ret;
+
+  if (rio == NULL || memory_unit >= MAX_MEM_UNITS)
+    return -EINVAL;
+
+  table = &rio->file_table[memory_unit];
+
+  if (table->complete || table->size >= count)
+    return URIO_SUCCESS;
+
+  if ((ret = try_lock_rio (rio)) != 0)
+    return ret;
+
+  /* build memory list if needed */
+  if (rio->info.memory[0].size == 0)
+    if ((ret = generate_mem_list_rio (rio)) != URIO_SUCCESS)
+      UNLOCK(ret);
+
+  if (table->complete || table->size >= count)
+    UNLOCK(URIO_SUCCESS);
+
+  if (memory_unit >= rio->info.total_memory_units) {
+    table->complete = 1;
+    UNLOCK(URIO_SUCCESS);
+  }
+
+  debug("flist_load_rio: reading files %d to %d on memory unit %d", table->size, count, memory_unit);
+
+  (void)wake_rio (rio);
+
+  /* the Riot sends its whole list at once. the Nitrus is asked for list positions and
+     file ids with the same command so its list is read in a single pass that is never
+     interrupted by a request for a file id */
+  if (return_type_rio (rio) == RIORIOT)
+    ret = generate_flist_riohd (rio);
+  else if (return_type_rio (rio) == RIONITRUS) {
+    /* a pass that failed part way is started over */
+    if (table->size)
+      flist_discard_rio (rio, memory_unit);
+
+    ret = generate_flist_riomc (rio, memory_unit, MAX_RIO_FILES);
+  } else
+    ret = generate_flist_riomc (rio, memory_unit, count);
+
+  UNLOCK(ret);
+}
+
+/*
+  flist_discard_rio:
+
+  throws away the part of a memory unit's file list that has been read. used when the
+  player changes under a list that was not completely read. the list is read again
+  on demand.
+*/
+void flist_discard_rio (rios_t *rio, u_int8_t memory_unit) {
+  rio_file_table_t *table = &rio->file_table[memory_unit];
+  uint i;
+
+  /* rebuilt the next time the database is */
+  if (memory_unit == 0)
+    db_index_free_rio (rio);
+
+  for (i = 0 ; i < table->size ; i++)
+    flist_release (rio, table->entries[i]);
+
+  table->size     = 0;
+  table->complete = 0;
+
+  rio->info.memory[memory_unit].files      = NULL;
+  rio->info.memory[memory_unit].num_files  = 0;
+  rio->info.memory[memory_unit].total_time = 0;
+  rio->flist_gen++;
+}
+
 flist_rio_t *get_flist_rio (rios_t *rio, uint memory_unit, uint file_no) {
-  flist_rio_t *tmp;
+  int i;
 
-  if (!rio)
+  if (!rio || memory_unit >= MAX_MEM_UNITS)
     return NULL;
 
-  for (tmp = rio->info.memory[memory_unit].files ; tmp ; tmp = tmp->next) {
-    if (tmp->num == file_no)
-      return tmp;
-  }
+  /* file numbers start at 0 and are never smaller than the file's position */
+  if (file_no < MAX_RIO_FILES)
+    (void)flist_load_rio (rio, memory_unit, file_no + 1);
+
+  i = flist_table_find (&rio->file_table[memory_unit], file_no);
+  if (i >= 0)
+    return rio->file_table[memory_unit].entries[i];
 
   warning("get_flist_rio: couldn't find file with num=%d", file_no);
 
@@ -362,34 +776,48 @@ int flist_get_file_name_rio (rios_t *rio, uint memory_unit, uint file_no, char *
   removes a file from the rio's internal file list
 */
 int flist_remove_rio (rios_t *rio, uint memory_unit, uint file_no) {
-  flist_rio_t *flist, *tmp;
+  rio_file_table_t *table;
+  flist_rio_t *flist;
+  int pos;
+  uint i;
 
   if (rio == NULL || memory_unit >= MAX_MEM_UNITS)
     return -EINVAL;
 
-  for (flist = rio->info.memory[memory_unit].files ; flist ; flist = flist->next)
-    if (flist->num == file_no)
-      break;
+  table = &rio->file_table[memory_unit];
 
-  if (flist == NULL)
+  if (file_no < MAX_RIO_FILES)
+    (void)flist_load_rio (rio, memory_unit, file_no + 1);
+
+  pos = flist_table_find (table, file_no);
+  if (pos < 0)
     return -EINVAL;
 
+  flist = table->entries[pos];
+
+  if (memory_unit == 0)
+    db_index_remove_rio (rio, flist);
+
   if (flist->prev)
     flist->prev->next = flist->next;
   if (flist->next)
     flist->next->prev = flist->prev;
 
+  table->size--;
+  memmove (&table->entries[pos], &table->entries[pos + 1], (table->size - pos) * sizeof (flist_rio_t *));
+
   /* The file number used to access the file is reduced when a file is deleted */
-  for (tmp = flist->next ; tmp ; tmp = tmp->next)
-    tmp->inum--;
+  for (i = pos ; i < table->size ; i++)
+    table->entries[i]->inum = i;
 
   rio->info.memory[memory_unit].num_files  -= 1;
   rio->info.memory[memory_unit].total_time -= flist->time;
+  rio->flist_gen++;
 
   if (flist == rio->info.memory[memory_unit].files)
     rio->info.memory[memory_unit].files = flist->next;
 
-  free (flist);
+  flist_release (rio, flist);
  
   return 0;
 }
@@ -419,8 +847,8 @@ int return_flist_rio (rios_t *rio, u_int8_t memory_unit, rio_filetype list_flags
   flist_rio_t *tmp;
   flist_rio_t *bflist;
   flist_rio_t *prev = NULL;
-  flist_rio_t *head = NULL;
-  int first = 1, ret;
+  uint count = 0;
+  int ret;
 
   debug("return_flist_rio(rio=%x,memory_unit=%d,list_flags=%x,flist=%x)", \
         rio, memory_unit, list_flags, flist);
@@ -431,63 +859,218 @@ int return_flist_rio (rios_t *rio, u_int8_t memory_unit, rio_filetype list_flags
     return -EINVAL;
   }
 
+  *flist = NULL;
+
   /* build file list if needed */
-  if (rio->info.memory[0].size == 0) 
-    if ((ret = generate_mem_list_rio(rio)) != URIO_SUCCESS)
-      return ret;
+  if ((ret = flist_load_rio (rio, memory_unit, MAX_RIO_FILES)) != URIO_SUCCESS)
+    return ret;
+
+  if (rio->file_table[memory_unit].size == 0)
+    return URIO_SUCCESS;
+
+  /* the copy is a single block with the head of the list first (see free_flist_rio) */
+  bflist = (flist_rio_t *) malloc (rio->file_table[memory_unit].size * sizeof (flist_rio_t));
+  if (bflist == NULL) {
+    error("return_flist_rio: malloc returned an error (%s).", strerror (errno));
+
+    return -errno;
+  }
 
   /* make a copy of the file list with only what we want in it */
   for (tmp = rio->info.memory[memory_unit].files ; tmp ; tmp = tmp->next) {
     if (list_flags & tmp->type)
     {
-      if ((bflist = malloc(sizeof(flist_rio_t))) == NULL) {
-	error("return_flist_rio: malloc returned an error (%s).", strerror (errno));
+      debug("Adding file to list: %d: %s", tmp->rio_num, tmp->name);
 
-	return -errno;
-      }
+      bflist[count] = *(tmp);
 
-      debug("Adding file to list: %d: %s", tmp->rio_num, tmp->name);
+      bflist[count].prev = prev;
+      bflist[count].next = NULL;
 
-      *(bflist) = *(tmp);
-      
-      bflist->prev = prev;
-      bflist->next = NULL;
-      
-      if (bflist->prev != NULL)
-	bflist->prev->next = bflist;
-      
-      if (first != 0) {
-	first = 0;
-	head = bflist;
-      }
-      
-      prev = bflist;
+      if (prev != NULL)
+	prev->next = &bflist[count];
+
+      prev = &bflist[count++];
     }
   }
-  
-  *flist = head;
+
+  if (count)
+    *flist = bflist;
+  else
+    free (bflist);
 
   debug("return_flist_rio: success");
 
   return URIO_SUCCESS;
 }
 
-int size_flist_rio (rios_t *rio, int memory_unit) {
-  int i;
-  flist_rio_t *flist;
-  
-  for (i = 0, flist = rio->info.memory[memory_unit].files ; flist ; flist = flist->next, i++);
+struct _rio_flist_view {
+  rios_t *rio; /* NULL once the rio is closed */
+  struct _rio_flist_view *next;
+  int refcount;
 
-  return i;
+  /* value of rio->flist_gen when the view was made */
+  uint gen;
+  u_int8_t memory_unit;
+  rio_filetype list_flags;
+
+  /* copy of the matching entry pointers. the table itself moves when it grows */
+  uint size;
+  flist_rio_t **entries;
+};
+
+/* call with the rio locked */
+static int flist_view_stale (rio_flist_view_t *view) {
+  return (view->rio == NULL || view->rio->flist_gen != view->gen);
 }
 
+int open_flist_view_rio (rios_t *rio, u_int8_t memory_unit, rio_filetype list_flags, rio_flist_view_t **viewp) {
+  rio_file_table_t *table;
+  rio_flist_view_t *view;
+  uint i;
+  int ret;
 
-void free_flist_rio (flist_rio_t *flist) {
-  flist_rio_t *tmp, *ntmp;
+  if (rio == NULL || memory_unit >= MAX_MEM_UNITS || viewp == NULL)
+    return -EINVAL;
+
+  *viewp = NULL;
+
+  if ((ret = try_lock_rio (rio)) != 0)
+    return ret;
+
+  /* build file list if needed */
+  if ((ret = flist_load_rio (rio, memory_unit, MAX_RIO_FILES)) != URIO_SUCCESS)
+    UNLOCK(ret);
+
+  for (view = (rio_flist_view_t *) rio->flist_views ; view ; view = view->next)
+    if (view->memory_unit == memory_unit && view->list_flags == list_flags && !flist_view_stale (view)) {
+      view->refcount++;
+      *viewp = view;
+
+      UNLOCK(URIO_SUCCESS);
+    }
+
+  view = (rio_flist_view_t *) calloc (1, sizeof (rio_flist_view_t));
+  if (view == NULL)
+    UNLOCK(-ENOMEM);
+
+  table = &rio->file_table[memory_unit];
+
+  view->rio         = rio;
+  view->refcount    = 1;
+  view->gen         = rio->flist_gen;
+  view->memory_unit = memory_unit;
+  view->list_flags  = list_flags;
+
+  view->entries = (flist_rio_t **) malloc ((table->size ? table->size : 1) * sizeof (flist_rio_t *));
+  if (view->entries == NULL) {
+    free (view);
+    UNLOCK(-ENOMEM);
+  }
+
+  for (i = 0 ; i < table->size ; i++)
+    if (list_flags & table->entries[i]->type)
+      view->entries[view->size++] = table->entries[i];
+
+  view->next = (rio_flist_view_t *) rio->flist_views;
+  rio->flist_views = view;
+
+  *viewp = view;
+
+  UNLOCK(URIO_SUCCESS);
+}
+
+int flist_view_size_rio (rio_flist_view_t *view) {
+  int ret;
+
+  if (view == NULL)
+    return -EINVAL;
+
+  if (view->rio == NULL)
+    return -ESTALE;
+
+  lock_rio (view->rio);
+  ret = flist_view_stale (view) ? -ESTALE : (int) view->size;
+  unlock_rio (view->rio);
 
-  for (tmp = flist ; tmp ; tmp = ntmp) {
-    ntmp = tmp->next;
-    free(tmp);
+  return ret;
+}
+
+const flist_rio_t *flist_view_entry_rio (rio_flist_view_t *view, int i) {
+  const flist_rio_t *entry = NULL;
+
+  if (view == NULL || view->rio == NULL || i < 0 || (uint) i >= view->size)
+    return NULL;
+
+  lock_rio (view->rio);
+  if (!flist_view_stale (view))
+    entry = view->entries[i];
+  unlock_rio (view->rio);
+
+  return entry;
+}
+
+void close_flist_view_rio (rio_flist_view_t *view) {
+  rio_flist_view_t **tmp;
+  rios_t *rio;
+
+  if (view == NULL)
+    return;
+
+  /* views of a closed rio are no longer on its list. dropping a reference must not fail so
+     this waits for the lock whatever the lock mode is */
+  rio = view->rio;
+  if (rio)
+    lock_rio (rio);
+
+  if (--view->refcount > 0) {
+    if (rio)
+      unlock_rio (rio);
+
+    return;
+  }
+
+  if (rio) {
+    for (tmp = (rio_flist_view_t **) &rio->flist_views ; *tmp ; tmp = &(*tmp)->next)
+      if (*tmp == view) {
+	*tmp = view->next;
+	break;
+      }
+
+    unlock_rio (rio);
   }
+
+  free (view->entries);
+  free (view);
+}
+
+/* called by close_rio. views that are still open go stale and are freed by their last
+   close_flist_view_rio */
+void flist_views_detach_rio (rios_t *rio) {
+  rio_flist_view_t *view, *next;
+
+  for (view = (rio_flist_view_t *) rio->flist_views ; view ; view = next) {
+    next = view->next;
+
+    view->rio  = NULL;
+    view->next = NULL;
+  }
+
+  rio->flist_views = NULL;
+}
+
+int size_flist_rio (rios_t *rio, int memory_unit) {
+  if (rio == NULL || memory_unit >= MAX_MEM_UNITS)
+    return 0;
+
+  (void)flist_load_rio (rio, memory_unit, MAX_RIO_FILES);
+
+  return rio->file_table[memory_unit].size;
+}
+
+
+void free_flist_rio (flist_rio_t *flist) {
+  /* return_flist_rio allocates the whole list in one block */
+  free (flist);
 }
 
@@ -41,11 +41,31 @@
 #endif
 
 #include "rioi.h"
+#include "riolog.h"
 #include "genre.h"
 
+#define ID3FLAG_UNSYNC   0x80
 #define ID3FLAG_EXTENDED 0x40
 #define ID3FLAG_FOOTER   0x10
 
+/* id3v2.3 frame format flags */
+#define ID3V23_COMPRESSED 0x80
+#define ID3V23_ENCRYPTED  0x40
+#define ID3V23_GROUPED    0x20
+
+/* id3v2.4 frame format flags */
+#define ID3V24_GROUPED    0x40
+#define ID3V24_COMPRESSED 0x08
+#define ID3V24_ENCRYPTED  0x04
+#define ID3V24_UNSYNC     0x02
+#define ID3V24_LENGTH     0x01
+
+/* text frame encodings */
+#define ID3_LATIN1  0x00
+#define ID3_UTF16   0x01
+#define ID3_UTF16BE 0x02
+#define ID3_UTF8    0x03
+
 #define MIN(x,y) (((x) > (y)) ? (y) : (x))
 
                        /* v2.2 v2.3 */
@@ -62,10 +82,21 @@ char *ID3_YEARNEW[2] = {"TYE", "TDRC"};
 char *ID3_DISC[2]    = {"TPA", "TPOS"};
 char *ID3_ARTWORK[2] = {"PIC", "APIC"};
 
-static int find_id3 (int version, FILE *fh, unsigned char *tag_data, int *tag_datalen,
-		     int *id3_len, int *major_version);
-static int one_pass_parse_id3v2 (FILE *fh, unsigned char *tag_data, int tag_datalen, int id3v2_majorversion,
-				  rio_file_t *mp3_file);
+/* an id3v2 tag. the frames are parsed straight out of the mapped file */
+struct id3v2_tag {
+  int major_version;
+  unsigned char flags;
+
+  /* everything after the 10 byte header */
+  const unsigned char *data;
+  size_t size;
+
+  /* private copy of data made the first time part of it has to be resynchronised */
+  unsigned char *copy;
+};
+
+static int find_id3 (int version, rio_media_t *media, unsigned char *tag_data, struct id3v2_tag *tag);
+static int parse_id3v2 (struct id3v2_tag *tag, rio_file_t *mp3_file);
 static int synchsafe_to_int (unsigned char *buf, int nbytes);
 
 static int synchsafe_to_int (unsigned char *buf, int nbytes) {
@@ -88,6 +119,16 @@ static int synchsafe_to_int (unsigned char *buf, int nbytes) {
   return id3v2_len;
 }
 
+static size_t big_to_size (const unsigned char *buf, int nbytes) {
+  size_t value;
+  int i;
+
+  for (i = 0, value = 0 ; i < nbytes ; i++)
+    value = (value << 8) | buf[i];
+
+  return value;
+}
+
 int id3v2_size (unsigned char data[14]) {
   int major_version;
   unsigned char id3v2_flags;
@@ -119,67 +160,38 @@ int id3v2_size (unsigned char data[14]) {
 }
 
 /*
-  find_id3 takes in a file descriptor, a pointer to where the tag data is to be put,
-  and a pointer to where the data length is to be put.
+  find_id3 takes in a mapped file and looks for a tag of the given version.
 
   find_id3 returns:
     0 for no id3 tags
-    1 for id3v1 tag
-    2 for id3v2 tag
-
-  The file descriptor is reset to the start of the file on completion.
+    1 for id3v1 tag (the 128 byte tag is copied into tag_data)
+    2 for id3v2 tag (the tag is described by tag)
 */
-static int find_id3 (int version, FILE *fh, unsigned char *tag_data, int *tag_datalen,
-		     int *id3_len, int *major_version) {
-    int head;
-    unsigned char data[10];
-
-    char id3v2_flags;
-    int  id3v2_len;
-    int  id3v2_extendedlen;
+static int find_id3 (int version, rio_media_t *media, unsigned char *tag_data, struct id3v2_tag *tag) {
+    int id3v2_len;
 
     if (version == 2) {
-      fread(&head, 4, 1, fh);
-      head = big32_2_arch32(head);
+      if (media->size >= 10 && memcmp (media->data, "ID3", 3) == 0) {
+	memset (tag, 0, sizeof (struct id3v2_tag));
+
+	tag->major_version = media->data[3];
+	tag->flags         = media->data[5];
+	tag->data          = media->data + 10;
+
+	/* the size does not include the header or footer */
+	id3v2_len = synchsafe_to_int ((unsigned char *) media->data + 6, 4);
+
+	/* truncated file */
+	if (id3v2_len < 0 || (size_t) id3v2_len > media->size - 10)
+	  tag->size = media->size - 10;
+	else
+	  tag->size = id3v2_len;
 
-      /* version 2 */
-      if ((head & 0xffffff00) == 0x49443300) {
-	fread(data, 1, 10, fh);
-	
-	*major_version = head & 0xff;
-	
-	id3v2_flags = data[1];
-	
-	id3v2_len = *id3_len = synchsafe_to_int (&data[2], 4);
-
-	*id3_len += 10; /* total length = id3v2len + 010 + footer (if present) */
-	*id3_len += (id3v2_flags & 0x10) ? 10 : 0; /* ID3v2 footer */
-
-	/* the 6th bit of the flag field being set indicates that an
-	   extended header is present */
-	if (id3v2_flags & 0x40) {
-	  /* Skip extended header */
-	  id3v2_extendedlen = synchsafe_to_int (&data[6], 4);
-	  
-	  fseek(fh, 0xa + id3v2_extendedlen, SEEK_SET);
-	  *tag_datalen = id3v2_len - id3v2_extendedlen;
-	} else {
-	  /* Skip standard header */
-	  fseek(fh, 0xa, SEEK_SET);
-	  *tag_datalen = id3v2_len;
-	}
-	
 	return 2;
       }
     } else if (version == 1) {
-      fseek(fh, -128, SEEK_END);
-      fread(&head, 1, 4, fh);
-      fseek(fh, -128, SEEK_END);
-	
-      head = big32_2_arch32(head);
-      
-      if ((head & 0xffffff00) == 0x54414700) {
-	fread(tag_data, 1, 128, fh);
+      if (media->size >= 128 && memcmp (media->data + media->size - 128, "TAG", 3) == 0) {
+	memcpy (tag_data, media->data + media->size - 128, 128);
 	
 	return 1;
       }
@@ -189,9 +201,8 @@ static int find_id3 (int version, FILE *fh, unsigned char *tag_data, int *tag_da
     return 0;
 }
 
-static char *id3v1_string (unsigned char *unclean) {
+static char *id3v1_string (unsigned char *unclean, char buffer[31]) {
   int i;
-  static char buffer[31];
 
   memset (buffer, 0, 31);
 
@@ -204,171 +215,303 @@ static char *id3v1_string (unsigned char *unclean) {
   return buffer;
 }
 
-static int check_id_id3v2 (FILE *fh, int offset) {
-  int i, current_offset;
-  char identifier[5];
+/* undo unsynchronisation ($ff $00 -> $ff) in place. returns the new length */
+static size_t id3v2_resync (unsigned char *data, size_t length) {
+  size_t i, j;
 
-  current_offset = ftell (fh);
+  for (i = 0, j = 0 ; i < length ; i++) {
+    data[j++] = data[i];
 
-  identifier[4] = '\0';
+    if (data[i] == 0xff && i + 1 < length && data[i + 1] == 0x00)
+      i++;
+  }
+
+  return j;
+}
 
-  fseek (fh, offset, SEEK_SET);
-  fread (identifier, 1, 4, fh);
-  fseek (fh, current_offset, SEEK_SET);
+/* returns a writable pointer to length bytes at offset in the tag after resynchronising them */
+static unsigned char *id3v2_resync_range (struct id3v2_tag *tag, size_t offset, size_t *length) {
+  if (tag->copy == NULL) {
+    if ((tag->copy = (unsigned char *) malloc (tag->size)) == NULL)
+      return NULL;
+
+    memcpy (tag->copy, tag->data, tag->size);
+    tag->data = tag->copy;
+  }
+
+  *length = id3v2_resync (tag->copy + offset, *length);
+
+  return tag->copy + offset;
+}
+
+/* check that a frame identifier (or the padding/end of the tag) is at offset */
+static int id3v2_frame_follows (struct id3v2_tag *tag, size_t offset) {
+  int i;
+
+  if (offset == tag->size || (offset < tag->size && tag->data[offset] == '\0'))
+    return 1;
+
+  if (offset > tag->size || tag->size - offset < 4)
+    return 0;
 
   for (i = 0 ; i < 4 ; i++)
-    if (identifier[i] != ' ' && (identifier[i] < 'A' || identifier[i] > 'Z') &&
-	(identifier[i] < '0' && identifier[i] > '9'))
-      return -1;
+    if ((tag->data[offset + i] < 'A' || tag->data[offset + i] > 'Z') &&
+	(tag->data[offset + i] < '0' || tag->data[offset + i] > '9'))
+      return 0;
 
-  return 0;
+  return 1;
+}
+
+/* decode one UTF-8 sequence. bytes that do not start a valid sequence are taken as ISO-8859-1 */
+static u_int32_t utf8_char (const unsigned char *data, size_t length, size_t *pos) {
+  u_int32_t c = data[(*pos)++];
+  int i, count;
+
+  count = (c >= 0xf0) ? 3 : (c >= 0xe0) ? 2 : (c >= 0xc0) ? 1 : 0;
+
+  if (count == 0 || length - *pos < (size_t) count)
+    return c;
+
+  for (i = 0 ; i < count ; i++)
+    if ((data[*pos + i] & 0xc0) != 0x80)
+      return c;
+
+  for (c &= 0x3f >> count, i = 0 ; i < count ; i++)
+    c = (c << 6) | (data[(*pos)++] & 0x3f);
+
+  return c;
 }
 
 /*
-  parse_id3
+  id3v2_text:
+
+  Copy the first string of a text frame into buffer as a nul-terminated ISO-8859-1
+  string (the character set of id3v1 tags and of the players). Characters that
+  ISO-8859-1 does not have are replaced with '?'.
 */
-static int one_pass_parse_id3v2 (FILE *fh, unsigned char *tag_data, int tag_datalen, int id3v2_majorversion,
-				 rio_file_t *mp3_file) {
-  int i;
-  unsigned char *tag_temp;
-  char *slash;
-  char encoding[11], identifier[5];
-  int newv = (id3v2_majorversion > 2) ? 1 : 0;
-  int id3v2_offset, genre_index;
+static char *id3v2_text (const unsigned char *data, size_t length, char *buffer, size_t size) {
+  int encoding = ID3_LATIN1, big_endian = 0;
+  size_t i = 0, j = 0;
+  u_int32_t c, low;
+
+  /* frames without a valid encoding byte are taken as ISO-8859-1 */
+  if (length && data[0] <= ID3_UTF8)
+    encoding = data[i++];
+
+  if (encoding == ID3_UTF16BE)
+    big_endian = 1;
+
+  while (i < length && j < size - 1) {
+    switch (encoding) {
+    case ID3_UTF16:
+    case ID3_UTF16BE:
+      if (length - i < 2) {
+	i = length;
+	continue;
+      }
 
-  memset (identifier, 0, 5);
-    
-  id3v2_offset = ftell (fh);
-  
-  for (i = 0 ; i < tag_datalen ; ) {
-    size_t length = 0;
-      
-    fseek (fh, id3v2_offset + i, SEEK_SET);
-    fread (tag_data, 1, 6 + 4 * newv, fh);
+      c = big_endian ? (data[i] << 8 | data[i + 1]) : (data[i + 1] << 8 | data[i]);
+      i += 2;
+
+      /* byte order mark. frames without one are usually little endian */
+      if (c == 0xfeff)
+	continue;
+      else if (c == 0xfffe) {
+	big_endian = !big_endian;
+	continue;
+      }
+
+      if (c >= 0xd800 && c < 0xdc00 && length - i >= 2) {
+	low = big_endian ? (data[i] << 8 | data[i + 1]) : (data[i + 1] << 8 | data[i]);
+
+	if (low >= 0xdc00 && low < 0xe000) {
+	  c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+	  i += 2;
+	}
+      }
+
+      break;
+    case ID3_UTF8:
+      c = utf8_char (data, length, &i);
+      break;
+    default:
+      c = data[i++];
+    }
 
-    i += 6 + 4 * newv;
+    if (c == 0) {
+      /* not all programs write id3v2 frames correctly. leading \0's can be ignored */
+      if (j == 0)
+	continue;
 
-    if (tag_data[0] == 0)
+      break;
+    }
+
+    buffer[j++] = (c > 0xff) ? '?' : (char) c;
+  }
+
+  buffer[j] = '\0';
+
+  return buffer;
+}
+
+/*
+  parse_id3v2:
+
+  Walks the frames of a tag in memory. The tag is only copied if it has to be resynchronised.
+*/
+static int parse_id3v2 (struct id3v2_tag *tag, rio_file_t *mp3_file) {
+  int newv = (tag->major_version > 2) ? 1 : 0;
+  size_t header_size = newv ? 10 : 6;
+  size_t offset = 0, length, data_length;
+  const unsigned char *frame, *data;
+  unsigned char frame_flags;
+  char identifier[5], text[64];
+  int genre_index;
+
+  /* v2.2 and v2.3 unsynchronise the whole tag. v2.4 flags each frame */
+  if ((tag->flags & ID3FLAG_UNSYNC) && tag->major_version < 4 && tag->size) {
+    length = tag->size;
+
+    if (id3v2_resync_range (tag, 0, &length) == NULL)
+      return -ENOMEM;
+
+    tag->size = length;
+  }
+
+  if (tag->flags & ID3FLAG_EXTENDED) {
+    /* in v2.2 this flag means the tag is compressed. no compression was ever defined */
+    if (tag->major_version == 2 || tag->size < 4)
       return -1;
-      
-    memmove (identifier, tag_data, 3 + newv);
- 
-    switch (id3v2_majorversion) {
+
+    /* the v2.3 size does not include the size field itself */
+    if (tag->major_version == 3)
+      offset = 4 + big_to_size (tag->data, 4);
+    else
+      offset = synchsafe_to_int ((unsigned char *) tag->data, 4);
+  }
+
+  memset (identifier, 0, 5);
+
+  for ( ; offset < tag->size && tag->size - offset >= header_size ; offset += header_size + length) {
+    frame = tag->data + offset;
+
+    /* start of the padding */
+    if (frame[0] == '\0')
+      break;
+
+    memmove (identifier, frame, 3 + newv);
+
+    switch (tag->major_version) {
     case 1:
     case 2:
-      length = (tag_data[3] << 16) | (tag_data[4] << 8) | tag_data[5];
+      length = big_to_size (&frame[3], 3);
+      frame_flags = 0;
       break;
     case 3:
-      length = big32_2_arch32(((int *)tag_data)[1]);
+      length = big_to_size (&frame[4], 4);
+      frame_flags = frame[9];
       break;
     case 4:
     default:
-      length = synchsafe_to_int (&tag_data[4], 4);
+      length = (unsigned int) synchsafe_to_int ((unsigned char *) &frame[4], 4);
+      frame_flags = frame[9];
 
-      if (check_id_id3v2 (fh, i + length) < 0)
+      if (!id3v2_frame_follows (tag, offset + 10 + length) &&
+	  id3v2_frame_follows (tag, offset + 10 + big_to_size (&frame[4], 4)))
 	/* tag was probably written by iTunes (not to spec) */
-	length = big32_2_arch32(((int *)tag_data)[1]);
+	length = big_to_size (&frame[4], 4);
     }
 
-    if (length == (size_t) -1) {
-      fprintf (stderr, "id3.c/parse_id3v2: tag %s has bad length... Aborting!\n", identifier);
-
+    if (length > tag->size - offset - header_size) {
+      debug ("parse_id3v2: frame %s has bad length %lu", identifier, (unsigned long) length);
       return -1;
     }
 
-    i += length;
-    
-    /* read the first 128 bytes of data */
-    memset (tag_data, 0, 128);
-    fread (tag_data, 1, MIN(length, 128), fh);
+    if (strcmp (identifier, ID3_TITLE[newv]) && strcmp (identifier, ID3_ARTIST[newv]) &&
+	strcmp (identifier, ID3_ALBUM[newv]) && strcmp (identifier, ID3_TRACK[newv]) &&
+	strcmp (identifier, ID3_GENRE[newv]) && strcmp (identifier, ID3_YEAR[newv]) &&
+	strcmp (identifier, ID3_YEARNEW[newv]))
+      continue;
 
-    if (length > 128)
-      length = 128;
+    data = frame + header_size;
+    data_length = length;
 
-    tag_temp = tag_data;
+    if (tag->major_version == 3) {
+      if (frame_flags & (ID3V23_COMPRESSED | ID3V23_ENCRYPTED))
+	continue;
 
-    /* check tag encoding */
-    switch (tag_temp[0]) {
-    case 0x00:
-      sprintf (encoding, "ISO-8859-1");
-      tag_temp++;
-      break;
-    case 0x01:
-      sprintf (encoding, "UTF-16LE");
-      tag_temp += 3;
-      break;
-    case 0x03:
-      sprintf (encoding, "UTF-16BE");
-      tag_temp++;
-      break;
-    case 0x04:
-      sprintf (encoding, "UTF-8");
-      tag_temp++;
-      break;
-    default:
-      sprintf (encoding, "ISO-8859-1");
-    }
+      /* group identifier */
+      if (frame_flags & ID3V23_GROUPED) {
+	data++;
+	data_length = data_length ? data_length - 1 : 0;
+      }
+    } else if (tag->major_version > 3) {
+      if (frame_flags & (ID3V24_COMPRESSED | ID3V24_ENCRYPTED))
+	continue;
+
+      /* group identifier and data length indicator */
+      if (frame_flags & ID3V24_GROUPED) {
+	data++;
+	data_length = data_length ? data_length - 1 : 0;
+      }
 
-    if (strcmp (identifier, "APIC") != 0 && strcmp (identifier, "PIC") != 0)
-      /* find the start of the string. this should not be needed but not all
-	 programs write id3v2 frames correctly. excess trailing \0's can be
-	 ignored. */
-      for ( ; length && tag_temp[0] == '\0' ; tag_temp++, length--);
+      if (frame_flags & ID3V24_LENGTH) {
+	data += MIN(data_length, 4);
+	data_length -= MIN(data_length, 4);
+      }
 
-    if (length == 0)
-      /* empty tag*/
+      if ((frame_flags & ID3V24_UNSYNC) || (tag->flags & ID3FLAG_UNSYNC))
+	if ((data = id3v2_resync_range (tag, data - tag->data, &data_length)) == NULL)
+	  return -ENOMEM;
+    }
+
+    if (id3v2_text (data, data_length, text, sizeof (text))[0] == '\0')
+      /* empty tag */
       continue;
 
     if (strcmp (identifier, ID3_TRACK[newv]) == 0) {
       /* some id3 tags have track/total tracks in the TRK field */
-      slash = strchr ((char *)tag_temp, '/');
-	
-      mp3_file->trackno2 = strtol ((char *)tag_temp, NULL, 10);
+      mp3_file->trackno2 = strtol (text, NULL, 10);
     } else if (strcmp (identifier, ID3_GENRE[newv]) == 0) {
-      if (tag_temp[0] == '(' || (tag_temp[0] >= '0' && tag_temp[0] <= '9') ) {
-
-	if (tag_temp[0] == '(')
-	  genre_index = strtol ((char *)&tag_temp[1], NULL, 10);
-	else
-	  genre_index = strtol ((char *)&tag_temp[0], NULL, 10);
+      if (text[0] == '(' || (text[0] >= '0' && text[0] <= '9') ) {
+	genre_index = strtol ((text[0] == '(') ? &text[1] : text, NULL, 10);
 
-	if (genre_index > genre_count)
+	if (genre_index < 0 || genre_index > genre_count)
 	  genre_index = genre_count;
 
-	tag_temp = (unsigned char *)genre_table[genre_index];
-	length   = strlen ((char *)tag_temp);
+	strncpy (text, genre_table[genre_index], sizeof (text) - 1);
       }
 
-      strncpy ((char *)mp3_file->genre2, (char *)tag_temp, MIN(length, 22));
+      strncpy ((char *)mp3_file->genre2, text, sizeof (mp3_file->genre2) - 1);
     } else if (strcmp (identifier, ID3_YEARNEW[newv]) == 0 || strcmp (identifier, ID3_YEAR[newv]) == 0)
       /* the recording year is always the first 4 characters */
-      memmove (mp3_file->year2, tag_temp, 4);
+      strncpy ((char *)mp3_file->year2, text, 4);
     else if (strcmp (identifier, ID3_TITLE[newv]) == 0)
-      strncpy ((char *)mp3_file->title, (char *)tag_temp, MIN(length, 63));
+      strncpy ((char *)mp3_file->title, text, 63);
     else if (strcmp (identifier, ID3_ARTIST[newv]) == 0)
-      strncpy ((char *)mp3_file->artist, (char *)tag_temp, MIN(length, 63));
+      strncpy ((char *)mp3_file->artist, text, 63);
     else if (strcmp (identifier, ID3_ALBUM[newv]) == 0)
-      strncpy ((char *)mp3_file->album, (char *)tag_temp, MIN(length, 63));
+      strncpy ((char *)mp3_file->album, text, 63);
   }
 
   return 0;
 }
 
 int parse_id3v1 (unsigned char tag_data[128], rio_file_t *mp3_file) {
-  char *tmp;
+  char buffer[31], *tmp;
 
   if (strlen (mp3_file->title) == 0) {
-    tmp = id3v1_string (&tag_data[3]);
+    tmp = id3v1_string (&tag_data[3], buffer);
     strncpy (mp3_file->title, tmp, strlen (tmp));
   }
 
   if (strlen (mp3_file->artist) == 0) {
-    tmp = id3v1_string (&tag_data[33]);
+    tmp = id3v1_string (&tag_data[33], buffer);
     strncpy (mp3_file->artist, tmp, strlen (tmp));
   }
 
   if (strlen (mp3_file->album) == 0) {
-    tmp = id3v1_string (&tag_data[63]);
+    tmp = id3v1_string (&tag_data[63], buffer);
     strncpy (mp3_file->album, tmp, strlen (tmp));
   }
 
@@ -386,30 +529,22 @@ int parse_id3v1 (unsigned char tag_data[128], rio_file_t *mp3_file) {
   return 0;
 }
 
-int get_id3_info (char *file_name, rio_file_t *mp3_file) {
-  int tag_datalen = 0, id3_len = 0;
+int get_id3_info (rio_media_t *media, char *file_name, rio_file_t *mp3_file) {
   unsigned char tag_data[128];
-  int version;
-  int id3v2_majorversion;
+  struct id3v2_tag tag;
   int has_v2 = 0;
-  FILE *fh;
-
-  if ((fh = fopen (file_name, "r")) == NULL)
-    return errno;
 
   /* built-in id3tag reading -- id3v2, id3v1 */
-  if ((version = find_id3(2, fh, tag_data, &tag_datalen, &id3_len, &id3v2_majorversion)) != 0) {
-    one_pass_parse_id3v2 (fh, tag_data, tag_datalen, id3v2_majorversion, mp3_file);
+  if (find_id3 (2, media, NULL, &tag) != 0) {
+    parse_id3v2 (&tag, mp3_file);
+    free (tag.copy);
     has_v2 = 1;
   }
 
   /* some mp3's have both tags so check v1 even if v2 is available */
-  if ((version = find_id3(1, fh, tag_data, &tag_datalen, NULL, &id3v2_majorversion)) != 0)
+  if (find_id3 (1, media, tag_data, NULL) != 0)
     parse_id3v1 (tag_data, mp3_file);
   
-  /* Set the file descriptor at the end of the id3v2 header (if one exists) */
-  fseek (fh, id3_len, SEEK_SET);
-  
   if (strlen (mp3_file->title) == 0) {
     char *tfile_name = strdup (file_name);
     char *tmp = (char *)basename(tfile_name);
@@ -424,8 +559,6 @@ int get_id3_info (char *file_name, rio_file_t *mp3_file) {
     memmove (mp3_file->title, tmp, (strlen(tmp) > 63) ? 63 : strlen(tmp));
     free (tfile_name);
   }
- 
-  fclose (fh);
   
   return (has_v2) ? 2 : 1;
 }
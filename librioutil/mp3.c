@@ -35,16 +35,27 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <pthread.h>
+
 #include "rioi.h"
 
+#if defined(HAVE_MMAP)
+#include <sys/mman.h>
+#endif
+
 #ifdef HAVE_LIBGEN_H
 #include <libgen.h>
 #endif
 
 #define MP3_DEBUG(...) if (0) {fprintf (stderr, __VA_ARGS__ );}
 
+/* bytes of a stream wanted after the id3v2 tag to find the first frames */
+#define MP3_STREAM_PROBE 8192
+
 struct mp3_file {
-  FILE *fh;
+  const unsigned char *data;
+  int pos;        /* current scan position */
+  int next_sync;  /* next 0xff found by mp3_next_sync */
 
   int file_size;  /* Bytes */
   int tagv2_size; /* Bytes */
@@ -58,6 +69,13 @@ struct mp3_file {
 
   int frames;
   int xdata_size;
+  /* the first frame is a Xing/VBRI header and holds no audio */
+  int info_frame;
+
+  /* offsets of the audio frames. only recorded if offsets is not NULL going into
+     mp3_scan (see mp3_duration_rio) */
+  int *offsets;
+  int num_offsets, offsets_size;
 
   int layer;
   int version;
@@ -103,11 +121,20 @@ int samplerate_table[4][4] = {
   {44100, 48000, 32000, -1}
 };
 
+/* offset of the Xing header from the end of the frame header [version][channels] */
 int xing_offsets[4][4] = {
-  {32, 32, 32, 17},
+  {17, 17, 17,  9},
   {-1, -1, -1, -1},
   {17, 17, 17,  9},
-  {17, 17, 17,  9}
+  {32, 32, 32, 17}
+};
+
+/* [version][layer] */
+int samples_table[4][4] = {
+  {-1,  576, 1152, 384},
+  {-1,   -1,   -1,  -1},
+  {-1,  576, 1152, 384},
+  {-1, 1152, 1152, 384}
 };
 
 double version_table[] = {
@@ -134,26 +161,29 @@ size_t layer_table[] = {
    2 = dual channel
    3 = mono
 */
-#define MPEG_CHANNELS(header) ((header & 0x000000c0) >> 7)
+#define MPEG_CHANNELS(header) ((header & 0x000000c0) >> 6)
 
 #define BITRATE(header) bitrate_table[MPEG_VERSION(header)][MPEG_LAYER(header)][MPEG_BITRATEI(header)]
 #define SAMPLERATE(header) samplerate_table[MPEG_VERSION(header)][MPEG_SAMPLERATEI(header)]
+#define SAMPLES(header) samples_table[MPEG_VERSION(header)][MPEG_LAYER(header)]
 #define PADDING(header) ((MPEG_LAYER(header) == 3) ? 4 : 1)
 
+/* frames after the first must have the same version, layer, and sample rate */
+#define MPEG_STREAM_MASK 0xfffe0c00
+
+/* the header bits (9-20) that determine the length of a frame */
+#define FRAME_INDEX(header) (((header) >> 9) & 0xfff)
+
 static size_t mpeg_frame_length (int header) {
-  double bitrate = (double)BITRATE(header) * 1000.0;
-  double samplerate = (double)SAMPLERATE(header);
-  double padding = (double)MPEG_PADDING(header);
-  char layer = MPEG_LAYER(header);
-  size_t frame_length;
-
-  if (layer == 0x11)
-    frame_length = 144.0 * bitrate/samplerate + padding;
-  else
-    frame_length = (12 * bitrate/samplerate + padding) * 4.0;
+  int bitrate = BITRATE(header) * 1000;
+  int samplerate = SAMPLERATE(header);
+  int padding = MPEG_PADDING(header);
 
-  return (size_t)((layer != 0x11) ? (144.0 * bitrate/samplerate + padding)
-	  : (12 * bitrate/samplerate + padding) * 4.0);
+  /* Layer I frames are made of 4 byte slots */
+  if (MPEG_LAYER(header) == 3)
+    return (12 * bitrate/samplerate + padding) * 4;
+
+  return SAMPLES(header)/8 * bitrate/samplerate + padding;
 }
 
 /* check_mp3_header: returns 0 on success */
@@ -167,13 +197,73 @@ static int check_mp3_header (int header) {
     return 1;
 }
 
+/* length of the frame for every FRAME_INDEX. 0 if the header is not valid */
+static unsigned short frame_table[4096];
+static pthread_once_t frame_table_once = PTHREAD_ONCE_INIT;
+
+static void frame_table_init (void) {
+  int i, header;
+
+  for (i = 0 ; i < 4096 ; i++) {
+    header = MPEG_SYNC | (i << 9);
+
+    if (check_mp3_header (header) == 0 && SAMPLES(header) > 0)
+      frame_table[i] = mpeg_frame_length (header);
+  }
+}
+
+/* read a big-endian 32-bit value at offset. returns -1 past the end of the file */
+static int mp3_read32 (struct mp3_file *mp3, int offset, int *value) {
+  const unsigned char *p;
+
+  if (offset < 0 || offset + 4 > mp3->file_size)
+    return -1;
+
+  p = mp3->data + offset;
+  *value = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+  return 0;
+}
+
+/*
+  mp3_next_sync:
+
+  Returns the first position at or after pos that could start a frame header (0xff)
+  or an MLLT frame ('M'), or the end of the file if there is none. memchr compares a
+  whole block of bytes at a time so runs of junk are skipped quickly.
+*/
+static int mp3_next_sync (struct mp3_file *mp3, int pos) {
+  const unsigned char *sync, *mllt;
+  int end = mp3->file_size - 3; /* a header does not fit past here */
+
+  /* a bad id3v2 size can put pos outside the file. mp3_read32 rejects it */
+  if (pos < 0 || pos >= end)
+    return pos;
+
+  /* the 0xff found last time is still ahead unless pos moved past it */
+  if (mp3->next_sync <= pos) {
+    sync = memchr (mp3->data + pos, 0xff, end - pos);
+    mp3->next_sync = (sync != NULL) ? sync - mp3->data : end;
+  }
+
+  end = mp3->next_sync;
+
+  mllt = memchr (mp3->data + pos, 'M', end - pos);
+  if (mllt != NULL)
+    return mllt - mp3->data;
+
+  return end;
+}
+
 static int find_first_frame (struct mp3_file *mp3) {
   int header, buffer, ret, xing_offset;
+  int start = mp3->pos;
 
   mp3->skippage = 0;
 
-  while (fread (&header, 4, 1, mp3->fh)) {
-    header = big32_2_arch32(header);
+  for (mp3->pos = mp3_next_sync (mp3, mp3->pos) ; mp3_read32 (mp3, mp3->pos, &header) == 0 ;
+       mp3->pos = mp3_next_sync (mp3, mp3->pos + 1)) {
+    mp3->skippage = mp3->pos - start;
 
     /* MPEG-1 Layer III */
     if ((ret = check_mp3_header (header)) == 0) {
@@ -181,41 +271,46 @@ static int find_first_frame (struct mp3_file *mp3) {
 
       xing_offset = xing_offsets[MPEG_VERSION(header)][MPEG_CHANNELS(header)];
 
-      fseek (mp3->fh, xing_offset, SEEK_CUR);
-      fread (&buffer, 4, 1, mp3->fh);
-
-      buffer = big32_2_arch32(buffer);
-
-      if (buffer == ('X' << 24 | 'i' << 16 | 'n' << 8 | 'g') ||
-	  buffer == ('I' << 24 | 'n' << 16 | 'f' << 8 | 'o') ){
-	int xstart = ftell (mp3->fh);
-	int xflags;
+      if (mp3_read32 (mp3, mp3->pos + 4 + xing_offset, &buffer) == 0 &&
+	  (buffer == ('X' << 24 | 'i' << 16 | 'n' << 8 | 'g') ||
+	   buffer == ('I' << 24 | 'n' << 16 | 'f' << 8 | 'o'))) {
+	int xstart = mp3->pos + 8 + xing_offset;
+	int xflags = 0, field = xstart + 4;
 
 	/* an mp3 with an Xing header is ALWAYS vbr */
 	mp3->vbr = 1;
+	mp3->info_frame = 1;
 
-	fread (&xflags, 4, 1, mp3->fh);
+	(void) mp3_read32 (mp3, xstart, &xflags);
 
 	MP3_DEBUG("Xing flags = %08x\n", xflags);
 
-	if (xflags & 0x00000001) {
-	  fread (&buffer, 4, 1, mp3->fh);
-	  
-	  /* the frame field does not include the Xing header
-	     which is a valid frame */
-	  mp3->frames = buffer + 1;
+	/* the frame count does not include the Xing frame, which holds no audio */
+	if ((xflags & 0x00000001) && mp3_read32 (mp3, field, &buffer) == 0) {
+	  mp3->frames = buffer;
+	  field += 4;
 
 	  MP3_DEBUG("MPEG file has %i frames\n", mp3->frames);
 	}
 
-	if (xflags & 0x00000002) {
-	  fread (&buffer, 4, 1, mp3->fh);
+	if ((xflags & 0x00000002) && mp3_read32 (mp3, field, &buffer) == 0) {
 	  mp3->xdata_size = buffer;
 
 	  MP3_DEBUG("MPEG file has %i bytes of data\n", mp3->xdata_size);
 	}
+      } else if (mp3_read32 (mp3, mp3->pos + 36, &buffer) == 0 &&
+		 buffer == ('V' << 24 | 'B' << 16 | 'R' << 8 | 'I')) {
+	/* Fraunhofer VBRI header: version, delay, and quality (2 bytes each) then the byte
+	   and frame counts */
+	mp3->vbr = 1;
+	mp3->info_frame = 1;
+
+	if (mp3_read32 (mp3, mp3->pos + 46, &buffer) == 0)
+	  mp3->xdata_size = buffer;
+	if (mp3_read32 (mp3, mp3->pos + 50, &buffer) == 0)
+	  mp3->frames = buffer;
 
-	fseek (mp3->fh, xstart, SEEK_SET);
+	MP3_DEBUG("VBRI: %i frames, %i bytes of data\n", mp3->frames, mp3->xdata_size);
       }
 
       mp3->initial_header = header;
@@ -224,46 +319,34 @@ static int find_first_frame (struct mp3_file *mp3) {
 
       MP3_DEBUG("Inital bitrate = %i\n", BITRATE(header));
 
-      fseek (mp3->fh, -(xing_offset + 8), SEEK_CUR);
       return 0;
-    } else if (ret == 2)
+    } else if (ret == 2) {
+      mp3->pos += 4;
       return -2;
-    
-    fseek (mp3->fh, -3, SEEK_CUR);
-    mp3->skippage++;
+    }
   }
 
   return -1;
 }
 
 
-static int mp3_open (char *file_name, struct mp3_file *mp3) {
-  struct stat statinfo;
-
-  char buffer[14];
+static int mp3_open (rio_media_t *media, struct mp3_file *mp3) {
+  unsigned char buffer[14];
+  const unsigned char *end;
   int has_v1 = 0;
 
   MP3_DEBUG("mp3_open: Entering...\n");
 
   memset (mp3, 0 , sizeof (struct mp3_file));
 
-  if (stat (file_name, &statinfo) < 0)
-    return -errno;
-
-  mp3->file_size = mp3->data_size = statinfo.st_size;
-  mp3->mtime  = statinfo.st_mtime;
-  mp3->ctime  = statinfo.st_ctime;
+  mp3->data = media->data;
+  mp3->file_size = mp3->data_size = media->size;
+  mp3->mtime  = media->mtime;
 
-  mp3->fh = fopen (file_name, "r");
-  if (mp3->fh == NULL) 
-    return -errno;
+  end = media->data + media->size;
 
   /* Adjust total_size if an id3v1 tag exists */
-  fseek (mp3->fh, -128, SEEK_END);
-  memset (buffer, 0, 5);
-
-  fread (buffer, 1, 3, mp3->fh);
-  if (strncmp (buffer, "TAG", 3) == 0) {
+  if (media->size >= 128 && memcmp (end - 128, "TAG", 3) == 0) {
     mp3->data_size -= 128;
 
     has_v1 = 1;
@@ -273,32 +356,29 @@ static int mp3_open (char *file_name, struct mp3_file *mp3) {
   /*                                          */
 
   /* Check for Lyrics v2.00 */
-  fseek (mp3->fh, -9 - (has_v1 ? 128 : 0), SEEK_END);
-  memset (buffer, 0, 10);
-  fread (buffer, 1, 9, mp3->fh);
-
-  if (strncmp (buffer, "LYRICS200", 9) == 0) {
+  if (media->size >= (size_t) (15 + (has_v1 ? 128 : 0)) &&
+      memcmp (end - 9 - (has_v1 ? 128 : 0), "LYRICS200", 9) == 0) {
+    char size_field[7];
     int lyrics_size;
     MP3_DEBUG("mp3_open: Found Lyrics v2.00\n");
 
     /* Get the size of the Lyrics */
-    fseek (mp3->fh, -15, SEEK_CUR);
-    memset (buffer, 0, 7);
-    fread (buffer, 1, 6, mp3->fh);
+    memcpy (size_field, end - 15 - (has_v1 ? 128 : 0), 6);
+    size_field[6] = '\0';
 
     /* Include the size if LYRICS200 (9) and the size field (6) */
-    lyrics_size = strtol (buffer, NULL, 10) + 15;
+    lyrics_size = strtol (size_field, NULL, 10) + 15;
     mp3->data_size -= lyrics_size;
 
     MP3_DEBUG("mp3_open: Lyrics are 0x%x Bytes in length.\n", lyrics_size);
   }
 
   /* find and skip id3v2 tag if it exists */
-  fseek (mp3->fh, 0, SEEK_SET);
-  fread (buffer, 1, 14, mp3->fh);    
-  mp3->tagv2_size = id3v2_size ((unsigned char *) buffer);
+  memset (buffer, 0, 14);
+  memcpy (buffer, media->data, (media->size < 14) ? media->size : 14);
+  mp3->tagv2_size = id3v2_size (buffer);
 
-  fseek (mp3->fh, mp3->tagv2_size, SEEK_SET);
+  mp3->pos = mp3->tagv2_size;
 
   MP3_DEBUG("mp3_open: id3v2 size: 0x%08x\n", mp3->tagv2_size);
   /****************************************/
@@ -310,74 +390,85 @@ static int mp3_open (char *file_name, struct mp3_file *mp3) {
   return find_first_frame (mp3);
 }
 
-#define FRAME_COUNT 30
+/*
+  mp3_scan:
 
+  Walks every frame after the first to count the samples in the file, unless the
+  Xing or VBRI header already gave the number of frames and bytes and no offsets
+  are wanted. Frame lengths come from frame_table so each frame costs one load.
+*/
 static int mp3_scan (struct mp3_file *mp3) {
-  int header;
-  int ret;
-  int frames = 0;
+  int header, first = mp3->initial_header;
+  int pos = mp3->pos;
+  int frames = 0, bytes = 0;
   int last_bitrate = -1, bitrate;
-  int total_framesize = 0;
-  int frame_size;
+  int frame_size, *tmp;
+  u_int64_t samples;
 
   MP3_DEBUG("mp3_scan: Entering...\n");
 
-  if (mp3->frames == 0 || mp3->xdata_size == 0) {
-    while (ftell (mp3->fh) < mp3->data_size && (frames < FRAME_COUNT || mp3->vbr)) {
-      fread (&header, 4, 1, mp3->fh);
+  pthread_once (&frame_table_once, frame_table_init);
 
-      header = big32_2_arch32 (header);
-      
-      if (check_mp3_header (header) != 0) {
-	fseek (mp3->fh, -4, SEEK_CUR);
+  if (mp3->frames == 0 || mp3->xdata_size == 0 || mp3->offsets != NULL) {
+    /* the Xing/VBRI frame is not part of the audio */
+    if (mp3->info_frame)
+      pos += frame_table[FRAME_INDEX(first)];
 
-	MP3_DEBUG("mp3_scan: Invalid header %08x %08x Bytes into the file.\n",
-                  (unsigned int) header, (unsigned int) ftell(mp3->fh));
-	
-	if ((ret = find_first_frame (mp3)) == -1) {
-	  MP3_DEBUG("mp3_scan: An error occured at line: %i\n", __LINE__);
-	  
-	  /* This is hack-ish, but there might be junk at the end of the file. */
-	  
-	  break;
-	} else if (ret == -2) {
+    while (pos < mp3->data_size) {
+      if (mp3_read32 (mp3, pos, &header) < 0)
+	break;
+
+      frame_size = frame_table[FRAME_INDEX(header)];
+
+      if ((header & MPEG_STREAM_MASK) != (first & MPEG_STREAM_MASK) || frame_size == 0) {
+	if (header == 0x4d4c4c54) {
 	  MP3_DEBUG("mp3_scan: Ran into MLLT frame.\n");
-	  
-	  mp3->data_size -= (mp3->file_size) - ftell (mp3->fh);
-	  
+
+	  mp3->data_size = pos;
 	  break;
 	}
-	
+
+	MP3_DEBUG("mp3_scan: Invalid header %08x %08x Bytes into the file.\n",
+                  (unsigned int) header, (unsigned int) pos);
+
+	/* there might be junk between frames or at the end of the file */
+	pos = mp3_next_sync (mp3, pos + 1);
 	continue;
       }
-      
-      bitrate = BITRATE(header);
-      
+
+      bitrate = MPEG_BITRATEI(header);
+
       if (!mp3->vbr && (last_bitrate != -1) && (bitrate != last_bitrate))
 	mp3->vbr = 1;
       else
 	last_bitrate = bitrate;
-      
-      frame_size = mpeg_frame_length (header);
-      total_framesize += frame_size;
-      fseek (mp3->fh, frame_size - 4, SEEK_CUR);      
-      frames++;
-    }
 
-    if (frames == FRAME_COUNT) {
-      frames = (int)((double)((mp3->data_size - mp3->tagv2_size) * FRAME_COUNT) / (double)total_framesize);
-      total_framesize = mp3->data_size - mp3->tagv2_size;
-    }
+      if (mp3->offsets != NULL) {
+	if (mp3->num_offsets == mp3->offsets_size) {
+	  tmp = (int *) realloc (mp3->offsets, 2 * mp3->offsets_size * sizeof (int));
+	  if (tmp == NULL)
+	    return -1;
 
-    if (mp3->frames == 0)
-      mp3->frames = frames;
+	  mp3->offsets = tmp;
+	  mp3->offsets_size *= 2;
+	}
+
+	mp3->offsets[mp3->num_offsets++] = pos;
+      }
+
+      bytes += frame_size;
+      pos   += frame_size;
+      frames++;
+    }
 
-    if (mp3->xdata_size == 0)
-      mp3->xdata_size = total_framesize;
+    mp3->frames     = frames;
+    mp3->xdata_size = bytes;
   }
 
-  mp3->length     = (int)((double)mp3->frames * 26.12245); /* each mpeg frame represents 26.12245ms */
-  mp3->bitrate    = (int)(((float)mp3->xdata_size * 8.0)/(float)mp3->length);
+  samples = (u_int64_t) mp3->frames * SAMPLES(first);
+
+  mp3->length  = (int) (samples * 1000 / mp3->samplerate);
+  mp3->bitrate = (mp3->length > 0) ? (int)(((float)mp3->xdata_size * 8.0)/(float)mp3->length) : 0;
 
   MP3_DEBUG("mp3_scan: Finished scan. SampleRate: %i, BitRate: %i, Length: %i, Frames: %i.\n",
             mp3->samplerate, mp3->bitrate, mp3->length, mp3->frames);
@@ -388,18 +479,13 @@ static int mp3_scan (struct mp3_file *mp3) {
   return 0;
 }
 
-static void mp3_close (struct mp3_file *mp3) {
-  fclose (mp3->fh);
-}
-
-static int get_mp3_info (char *file_name, rio_file_t *mp3_file) {
+static int get_mp3_info (rio_media_t *media, rio_file_t *mp3_file) {
   struct mp3_file mp3;
 
-  if (mp3_open (file_name, &mp3) < 0)
+  if (mp3_open (media, &mp3) < 0)
     return -1;
 
   mp3_scan (&mp3);
-  mp3_close (&mp3);
 
   mp3_file->bit_rate    = mp3.bitrate << 7;
   mp3_file->sample_rate = mp3.samplerate;
@@ -409,6 +495,223 @@ static int get_mp3_info (char *file_name, rio_file_t *mp3_file) {
   return mp3.skippage;
 }
 
+/*
+  mp3_duration_rio:
+
+  Finds the exact length of an MP3 file and optionally builds a Xing style table of
+  contents for it. Entry i of the table is the position of the frame i percent of
+  the way into the file, in 256ths of the audio data.
+*/
+int mp3_duration_rio (char *file_name, u_int32_t *duration, unsigned char toc[100]) {
+  struct mp3_file mp3;
+  rio_media_t media;
+  int i, ret, frame;
+  double position;
+
+  if (file_name == NULL || duration == NULL)
+    return -EINVAL;
+
+  ret = media_open_rio (&media, file_name);
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  if (mp3_open (&media, &mp3) < 0) {
+    media_close_rio (&media);
+    return -EINVAL;
+  }
+
+  if (toc != NULL) {
+    mp3.offsets_size = 1024;
+    mp3.offsets = (int *) malloc (mp3.offsets_size * sizeof (int));
+    if (mp3.offsets == NULL) {
+      media_close_rio (&media);
+      return -ENOMEM;
+    }
+  }
+
+  ret = mp3_scan (&mp3);
+
+  if (ret == 0 && toc != NULL)
+    for (i = 0 ; i < 100 ; i++) {
+      frame = (int) ((double) i * mp3.num_offsets / 100.0);
+      position = (double) (mp3.offsets[frame] - mp3.offsets[0]) * 256.0 / (double) mp3.xdata_size;
+
+      toc[i] = (position < 255.0) ? (unsigned char) position : 255;
+    }
+
+  free (mp3.offsets);
+  media_close_rio (&media);
+
+  if (ret < 0)
+    return -EINVAL;
+
+  *duration = mp3.length;
+
+  return URIO_SUCCESS;
+}
+
+/*
+  mp3_stream_info_rio:
+
+  Fills in file from the first block of an MP3 stream, whose size is not known
+  yet. The bit and sample rates are measured over the frames in the block and the
+  id3 tags fill in any text fields that are still empty. The junk before the first
+  frame is skipped as in mp3_info.
+*/
+int mp3_stream_info_rio (const unsigned char *data, u_int32_t size, flist_rio_t *file, u_int32_t *skip) {
+  struct mp3_file mp3;
+  rio_media_t media;
+  rio_file_t tags;
+
+  if (data == NULL || file == NULL || skip == NULL)
+    return -EINVAL;
+
+  *skip = 0;
+
+  memset (&media, 0, sizeof (media));
+  media.data = data;
+  media.size = size;
+
+  if (mp3_open (&media, &mp3) < 0) {
+    /* the id3v2 tag (or the frames after it) run past the end of the block */
+    if ((u_int32_t) mp3.tagv2_size + MP3_STREAM_PROBE > size)
+      return -EAGAIN;
+
+    return -EINVAL;
+  }
+
+  (void) mp3_scan (&mp3);
+
+  if (mp3.bitrate <= 0 || mp3.samplerate <= 0)
+    return -EINVAL;
+
+  file->bitrate    = mp3.bitrate;
+  file->samplerate = mp3.samplerate;
+
+  memset (&tags, 0, sizeof (tags));
+
+  if (get_id3_info (&media, file->name, &tags) < 2 && mp3.skippage > 0)
+    /* dont want to not copy the id3v2 tags */
+    *skip = mp3.skippage;
+
+  if (file->title[0] == '\0') {
+    strncpy (file->title, tags.title, sizeof (file->title) - 1);
+    file->title[sizeof (file->title) - 1] = '\0';
+  }
+  if (file->artist[0] == '\0') {
+    strncpy (file->artist, tags.artist, sizeof (file->artist) - 1);
+    file->artist[sizeof (file->artist) - 1] = '\0';
+  }
+  if (file->album[0] == '\0') {
+    strncpy (file->album, tags.album, sizeof (file->album) - 1);
+    file->album[sizeof (file->album) - 1] = '\0';
+  }
+  if (file->genre[0] == '\0') {
+    strncpy (file->genre, (char *) tags.genre2, sizeof (file->genre) - 1);
+    file->genre[sizeof (file->genre) - 1] = '\0';
+  }
+  if (file->year[0] == '\0') {
+    memcpy (file->year, tags.year2, sizeof (tags.year2));
+    file->year[sizeof (tags.year2)] = '\0';
+  }
+  if (file->track_number == 0)
+    file->track_number = tags.trackno2;
+
+  return URIO_SUCCESS;
+}
+
+/*
+  media_open_rio:
+
+  Maps file_name into memory so the MPEG and id3 parsers can scan it without
+  reading it piece by piece. Falls back on reading the whole file if it can not
+  be mapped.
+*/
+int media_open_rio (rio_media_t *media, const char *file_name) {
+  struct stat statinfo;
+  unsigned char *data;
+  ssize_t amount;
+  size_t total;
+  int fd, ret;
+
+  memset (media, 0, sizeof (rio_media_t));
+
+  fd = open (file_name, O_RDONLY);
+  if (fd < 0)
+    return -errno;
+
+  if (fstat (fd, &statinfo) < 0) {
+    ret = -errno;
+    close (fd);
+    return ret;
+  }
+
+  media->size  = statinfo.st_size;
+  media->mtime = statinfo.st_mtime;
+  media->dev   = statinfo.st_dev;
+  media->ino   = statinfo.st_ino;
+#if defined(HAVE_STRUCT_STAT_ST_MTIM)
+  media->mtime_nsec = statinfo.st_mtim.tv_nsec;
+#endif
+
+  if (media->size == 0) {
+    close (fd);
+    media->data = (const unsigned char *) "";
+    return URIO_SUCCESS;
+  }
+
+#if defined(HAVE_MMAP)
+  data = mmap (NULL, media->size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data != MAP_FAILED) {
+    close (fd);
+    media->data   = data;
+    media->mapped = 1;
+    return URIO_SUCCESS;
+  }
+#endif
+
+  data = malloc (media->size);
+  if (data == NULL) {
+    close (fd);
+    return -ENOMEM;
+  }
+
+  for (total = 0 ; total < media->size ; total += amount) {
+    amount = read (fd, data + total, media->size - total);
+    if (amount < 0 && errno == EINTR) {
+      amount = 0;
+      continue;
+    }
+
+    if (amount <= 0) {
+      ret = (amount < 0) ? -errno : -EIO;
+      free (data);
+      close (fd);
+      return ret;
+    }
+  }
+
+  close (fd);
+
+  media->data = data;
+
+  return URIO_SUCCESS;
+}
+
+void media_close_rio (rio_media_t *media) {
+  if (media->size == 0)
+    return;
+
+#if defined(HAVE_MMAP)
+  if (media->mapped) {
+    munmap ((void *) media->data, media->size);
+    return;
+  }
+#endif
+
+  free ((void *) media->data);
+}
+
 
 /*
   mp3_info:
@@ -418,22 +721,36 @@ static int get_mp3_info (char *file_name, rio_file_t *mp3_file) {
 */
 int mp3_info (info_page_t *newInfo, char *file_name){
   rio_file_t *mp3_file = newInfo->data;
+  rio_media_t media;
 
   int id3_version;
   int mp3_header_offset;
 
-  if ((mp3_header_offset = get_mp3_info(file_name, mp3_file)) < 0) {
+  /* unchanged since it was last parsed */
+  if (metadata_cache_lookup_rio (file_name, newInfo) == URIO_SUCCESS)
+    return URIO_SUCCESS;
+
+  /* the file is read once and shared by both parsers */
+  if (media_open_rio (&media, file_name) != URIO_SUCCESS) {
+    free(mp3_file);
+    newInfo->data = NULL;
+    return -1;
+  }
+
+  if ((mp3_header_offset = get_mp3_info(&media, mp3_file)) < 0) {
+    media_close_rio (&media);
     free(mp3_file);
     newInfo->data = NULL;
     return -1;
   }
 
-  if ((id3_version = get_id3_info(file_name, mp3_file)) < 0) {
+  if ((id3_version = get_id3_info(&media, file_name, mp3_file)) < 0) {
+    media_close_rio (&media);
     free(mp3_file);
     newInfo->data = NULL;
     return -1;
   }
-  
+
   /* the file that will be uploaded is smaller if there is junk */
   if (mp3_header_offset > 0 && !(id3_version >= 2)) {
       mp3_file->size -= mp3_header_offset;
@@ -447,5 +764,9 @@ int mp3_info (info_page_t *newInfo, char *file_name){
   mp3_file->type     = TYPE_MP3;
   mp3_file->foo4     = 0x00020000;
 
+  (void) metadata_cache_store_rio (file_name, &media, newInfo);
+
+  media_close_rio (&media);
+
   return URIO_SUCCESS;
 }
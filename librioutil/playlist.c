@@ -45,13 +45,13 @@
 
 
 int create_playlist_rio (rios_t *rio, char *name, uint songs[], uint memory_units[], uint nsongs) {
-    info_page_t info;
-    int error, addpipe;
+    flist_rio_t playlist;
+    int error, size;
     uint i; /* loop counter */
-    char filename[PATH_MAX]; /* filename of temp file */
     file_list *tmp;
     uint *rio_num;
     u_int8_t **sflags;
+    unsigned char *data;
 
     debug("create_playlist_rio()");
 
@@ -64,78 +64,78 @@ int create_playlist_rio (rios_t *rio, char *name, uint songs[], uint memory_unit
 	return -EPERM;
   
     rio_num = calloc( nsongs, sizeof(uint) );
-    sflags = calloc( nsongs, 3 * sizeof(u_int8_t) );
-    if (rio_num == NULL || sflags == NULL)
+    sflags = calloc( nsongs, sizeof(u_int8_t *) );
+    data = malloc( PLAYLIST_FILE_SIZE(nsongs) );
+    if (rio_num == NULL || sflags == NULL || data == NULL)
     {
         error("calloc() failed!");
+	free (rio_num);
+	free (sflags);
+	free (data);
         return -ENOMEM;
     }
 
     if (try_lock_rio (rio) != 0)
+    {
+	free (rio_num);
+	free (sflags);
+	free (data);
 	return -EBUSY;
+    }
 
     debug("create_playlist_rio: creating a new playlist %s.", name);
 
-    /* Create a temporary file to store the new playlist */
-    snprintf (filename, PATH_MAX, "/tmp/rioutil_%s.%08x.lst", name, (uint) time(NULL));
+    /* the lock is recursive. holding it until the upload is done keeps the songs from
+       changing under the playlist */
     for (i = 0 ; i < nsongs ; i++)
     {
-	for (tmp = rio->info.memory[memory_units[i]].files ; tmp ; \
-             tmp = tmp->next)
-	    if (tmp->num == songs[i])
-		break;
-
+	tmp = get_flist_rio (rio, memory_units[i], songs[i]);
 	if (tmp == NULL)
-	    continue;
+	{
+	    error("create_playlist_rio: song %u on memory unit %u does not exist.", songs[i], memory_units[i]);
+	    break;
+	}
 
         rio_num[i] = tmp->rio_num;
         sflags[i] = tmp->sflags;
     }
 
-    error = write_playlist_file( filename, rio_num, sflags, nsongs );
-    if (error != URIO_SUCCESS)
-        UNLOCK(error);
-
-
-    error = new_playlist_info (&info, name);
-    if (error != URIO_SUCCESS)
-	UNLOCK(error);
+    if (i < nsongs)
+	error = -ENOENT;
+    else
+	/* the playlist is generated in memory and uploaded from there */
+	error = size = write_playlist_buffer( data, rio_num, sflags, nsongs );
 
-    if ((addpipe = open(filename, O_RDONLY)) == -1)
-	UNLOCK(-1);
+    free (rio_num);
+    free (sflags);
 
-    /* i moved the major functionality of both add_file and add_song down a layer */
-    error = do_upload (rio, 0, addpipe, info, 0);
-    if (error != URIO_SUCCESS)
+    if (error >= 0)
     {
-	free (info.data);
+	memset (&playlist, 0, sizeof (playlist));
+	snprintf (playlist.title, sizeof (playlist.title), "%s", name);
+	playlist.type = RIO_FILETYPE_PLAYLIST;
 
-	close (addpipe);
-
-	/* make sure no malicious user has messed with this variable */
-	if (strstr (filename, "/tmp/rioutil_") == filename)
-	    unlink (filename);
-
-	UNLOCK(error);
+	error = upload_buffer_rio (rio, 0, &playlist, data, size);
     }
 
-    close (addpipe);
+    unlock_rio (rio);
 
-    if (strstr (filename, "/tmp/rioutil_") == filename)
-	unlink (filename);
+    free (data);
 
-    free (info.data);
+    if (error != URIO_SUCCESS)
+	return error;
 
     debug("create_playlist_rio(): success");
 
-    UNLOCK(URIO_SUCCESS);
+    return URIO_SUCCESS;
 }
 
 /* Public API function */
 int get_playlist_rio( rios_t *rio, uint memory_unit, uint file_num, rio_playlist_t *playlist )
 {
     int ret;
-    char filename[] = "/tmp/riopl.XXXXXX";
+    unsigned char *data;
+    u_int32_t size;
     uint *songs;
     uint nsongs;
     flist_rio_t *flist;
@@ -146,27 +146,31 @@ int get_playlist_rio( rios_t *rio, uint memory_unit, uint file_num, rio_playlist
     if (!rio || !playlist)
 	return -EINVAL;
 
-    (void) mktemp (filename);
+    flist = get_flist_rio( rio, memory_unit, file_num );
+    if (flist == NULL)
+	return -ENOENT;
 
-    debug("Playlist temp file = %s", filename);
+    /* playlists are small. download straight into memory */
+    data = malloc (flist->size ? flist->size : 1);
+    if (data == NULL)
+	return -ENOMEM;
 
-    ret = download_file_rio (rio, memory_unit, file_num, filename);
+    ret = download_buffer_rio (rio, memory_unit, file_num, data, flist->size, &size);
     if (ret != URIO_SUCCESS)
     {
 	error("get_playlist_rio: downloading failed: %d", ret);
+	free (data);
         return ret;
     }
 
-    ret = read_playlist_file( filename, &songs, &nsongs );
+    ret = read_playlist_buffer( data, size, &songs, &nsongs );
+    free (data);
     if (ret != URIO_SUCCESS)
     {
-        error("get_playlist_rio: read_playlist_file failed: %s", strerror(-ret));
-        /* TODO check for file & delete it */
+        error("get_playlist_rio: read_playlist_buffer failed: %s", strerror(-ret));
         return ret;
     }
 
-    unlink (filename);
-
     playlist->nsongs = nsongs;
     playlist->songs = songs;
     playlist->rio_num = file_num;
@@ -208,25 +212,3 @@ int playlist_info (info_page_t *newInfo, char *file_name) {
     return URIO_SUCCESS;
 }
 
-/* Playlists for S-Series and newer. */
-int new_playlist_info (info_page_t *newInfo, char *name)
-{
-    rio_file_t *playlist_file;
-
-    if (!newInfo || !name)
-	return -EINVAL;
-
-    playlist_file = malloc(sizeof(rio_file_t));
-    if (playlist_file == NULL)
-	return -ENOMEM;
-
-    snprintf((char *)playlist_file->title, 64, "%s", name);
-
-    playlist_file->bits = 0x11000110;
-    playlist_file->type = TYPE_PLS;
-
-    newInfo->skip = 0;
-    newInfo->data = playlist_file;
-
-    return URIO_SUCCESS;
-}
@@ -97,76 +97,51 @@ static uint rio_num( struct rio_playlist_file_entry entry )
 }
 
 
-int read_playlist_file ( const char *filename, uint **songs, uint *nsongs )
+int read_playlist_buffer ( const unsigned char *data, u_int32_t size, uint **songs, uint *nsongs )
 {
-    FILE *file;
     struct rio_playlist_file_header header;
     struct rio_playlist_file_entry entry;
-    int read;
-    uint i;
+    uint i, available;
 
-    debug("read_playlist_file(filename=%s,songs=%x,nsongs=%x)", \
-          filename, songs, nsongs);
+    debug("read_playlist_buffer(data=%x,size=%d,songs=%x,nsongs=%x)", \
+          data, size, songs, nsongs);
 
-    if (!filename || !songs || !nsongs)
+    if (!data || !songs || !nsongs)
 	return -EINVAL;
 
-    file = fopen( filename, "ro" );
-    if (file == 0)
+    if (size < sizeof(header))
     {
-        error("read_playlist_file: Failed to open file \"%s\": %s", \
-              filename, strerror(errno));
-        return -errno;
+        error("read_playlist_buffer: playlist too short: %d bytes", size);
+        return -EIO;
     }
 
-    read = fread(&header, sizeof(header), 1, file);
-    if (read != 1)
-    {
-        int err = errno; /* fclose resets errno */
-        error("read_playlist_file: Couldn't read playlist file: %d %s", \
-              read, strerror(err));
-        fclose(file);
-        return -err;
-    }
+    memcpy(&header, data, sizeof(header));
 
     *nsongs = header.nsongs;
-    debug("read_playlist_file: nsongs=%d", *nsongs);
+    debug("read_playlist_buffer: nsongs=%d", *nsongs);
 
     *songs = malloc(sizeof(uint) * *nsongs);
     if (!*songs)
     {
-	fclose(file);
         error("malloc() failed!");
 	return -ENOMEM;
     }
 
-    i = 0;
-    while ( fread(&entry, sizeof(entry), 1, file) && i < *nsongs )
+    available = (size - sizeof(header)) / sizeof(entry);
+
+    for (i = 0 ; i < *nsongs && i < available ; i++)
     {
+        memcpy(&entry, data + sizeof(header) + i * sizeof(entry), sizeof(entry));
         (*songs)[i] = rio_num( entry );
         debug("Read playlist entry: rio_num=%d", (*songs)[i]);
-        i++;
-    }
-
-    if (ferror(file))
-    {
-        int err = errno;
-        error("read_playlist_file: Error reading playlist file: %s", \
-              strerror(err));
-        fclose(file);
-        return -err;
     }
 
-
     if (i < *nsongs)
     {
-        warning("read_playlist_file: playlist file shorter than expected");
+        warning("read_playlist_buffer: playlist file shorter than expected");
     }
 
-
-    fclose( file );
-
-    debug("read_playlist_file(): Success");
+    debug("read_playlist_buffer(): Success");
 
     return URIO_SUCCESS;
 }
@@ -174,54 +149,28 @@ int read_playlist_file ( const char *filename, uint **songs, uint *nsongs )
 /* songs: array of rio_num
  * sflags: array of u_int8_t[3]
  */
-int write_playlist_file( char *filename, const uint songs[], u_int8_t * const *sflags, uint nsongs)
+int write_playlist_buffer( unsigned char *data, const uint songs[], u_int8_t * const *sflags, uint nsongs)
 {
     struct rio_playlist_file_header header;
     struct rio_playlist_file_entry entry;
-    FILE *f;
     uint i;
-    int ret;
 
-    debug("write_playlist_file(filename=%s,songs=%x,nsongs=%d)", \
-          filename, songs, nsongs);
+    debug("write_playlist_buffer(data=%x,songs=%x,nsongs=%d)", \
+          data, songs, nsongs);
 
-    if (!filename || !songs || !nsongs)
+    if (!data || !songs || !nsongs)
         return -EINVAL;
 
-    f = fopen(filename, "w");
-    if (f == 0)
-        return -errno;
-
     header = rio_playlist_file_header_create( nsongs );
-
-    ret = fwrite( &header, sizeof(header), 1, f );
-
-    if (ret != 1)
-    {
-       error("Failed to write header to file: %s", strerror(errno));
-       ret = errno; /* save errno because fclose() resets it */
-       fclose(f);
-       return -ret;
-    }
+    memcpy( data, &header, sizeof(header) );
 
     for (i = 0; i < nsongs; i++)
     {
        entry = rio_playlist_file_entry_create( songs[i], sflags[i] );
-
-       ret = fwrite( &entry, sizeof(entry), 1, f );
-
-       if (ret != 1)
-       {
-          error("Failed writing playlist entry: %s", strerror(errno));
-          ret = errno; /* save errno because fclose() resets it */
-          fclose(f);
-          return -ret;
-       }
+       memcpy( data + sizeof(header) + i * sizeof(entry), &entry, sizeof(entry) );
     }
 
-    fclose(f);
+    debug("write_playlist_buffer(): Success");
 
-    debug("write_playlist_file(): Success");
-
-    return URIO_SUCCESS;
+    return PLAYLIST_FILE_SIZE(nsongs);
 }
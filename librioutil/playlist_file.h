@@ -24,30 +24,36 @@
 #include <sys/types.h> /* uint, u_int8_t */
 
 /**
- * Read a playlist file that has been downloaded from a newer generation
+ * Parse a playlist file that has been downloaded from a newer generation
  * Rio.
  *
- * filename: name of file to read
+ * data: contents of the playlist file
+ * size: size of data
  * songs: pointer to pointer that will be set to a newly allocated array of
  *        song numbers (rio_num).  Must be freed by the caller.
  * nsongs: will be set to the number of songs
  *
- * Returns: -EINVAL if parameters are bad, errno if file reading fails.
+ * Returns: -EINVAL if parameters are bad, -EIO if the data is too short.
  *          URIO_SUCCESS on success.
  */
-int read_playlist_file ( const char *filename, unsigned int **songs,
-                         unsigned int *nsongs );
+int read_playlist_buffer ( const unsigned char *data, u_int32_t size,
+                           unsigned int **songs, unsigned int *nsongs );
+
+/* size of a playlist file holding nsongs songs */
+#define PLAYLIST_FILE_SIZE(nsongs) (12 + 6 * (nsongs))
 
 /**
- * Write a playlist file to disk.
+ * Write a playlist file to memory.
  *
- * filename: filename to create
+ * data: buffer of at least PLAYLIST_FILE_SIZE(nsongs) bytes
  * songs: array of rio_num
  * sflags: array of u_int8_t[3]
  * nsongs: number of songs in the playlist
+ *
+ * Returns: the size of the playlist file or -EINVAL if parameters are bad.
  */
-int write_playlist_file( char *filename, const unsigned int songs[],
-                         u_int8_t * const *sflags, unsigned int nsongs);
+int write_playlist_buffer( unsigned char *data, const unsigned int songs[],
+                           u_int8_t * const *sflags, unsigned int nsongs);
 
 
 #endif /* PLAYLIST_FILE_H */
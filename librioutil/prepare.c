@@ -0,0 +1,297 @@
+/**
+ *   (c) 2026 agent <agent@local>
+ *   v1.5.4 prepare.c
+ *
+ *   Parses the tags of queued files on worker threads ahead of their upload.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rioi.h"
+#include "riolog.h"
+
+/* files parsed past the last one asked for. bounds the memory held by parsed info */
+#define PREPARE_AHEAD 64
+
+enum prepare_state { PREPARE_QUEUED, PREPARE_PARSING, PREPARE_READY, PREPARE_DONE };
+
+struct prepare_item {
+  char *file_name;
+  char *artist, *title, *album;
+
+  enum prepare_state state;
+  /* result of song_info_rio */
+  int ret;
+  info_page_t info;
+};
+
+struct rio_prepare {
+  pthread_mutex_t lock;
+  /* signaled when files are queued or asked for, or the pool is closing */
+  pthread_cond_t work;
+  /* signaled when a file is parsed */
+  pthread_cond_t progress;
+
+  struct prepare_item **queue;
+  int queue_len, queue_size;
+  /* index of the next queue entry to parse */
+  int next;
+  /* highest index passed to add_prepared_song_rio */
+  int wanted;
+  int closing;
+
+  int num_workers;
+  pthread_t *workers;
+};
+
+static void free_item (struct prepare_item *item) {
+  if (item->state == PREPARE_READY && item->ret == URIO_SUCCESS)
+    free (item->info.data);
+
+  free (item->file_name);
+  free (item->artist);
+  free (item->title);
+  free (item->album);
+  free (item);
+}
+
+static void *prepare_worker (void *arg) {
+  struct rio_prepare *prepare = (struct rio_prepare *) arg;
+  struct prepare_item *item;
+  int ret;
+
+  pthread_mutex_lock (&prepare->lock);
+
+  while (!prepare->closing) {
+    if (prepare->next == prepare->queue_len || prepare->next > prepare->wanted + PREPARE_AHEAD) {
+      pthread_cond_wait (&prepare->work, &prepare->lock);
+      continue;
+    }
+
+    item = prepare->queue[prepare->next++];
+    item->state = PREPARE_PARSING;
+
+    pthread_mutex_unlock (&prepare->lock);
+
+    ret = song_info_rio (&item->info, item->file_name, item->artist, item->title, item->album);
+    if (ret != URIO_SUCCESS)
+      debug ("prepare_worker: could not read the info of %s: %d", item->file_name, ret);
+
+    pthread_mutex_lock (&prepare->lock);
+
+    item->ret   = ret;
+    item->state = PREPARE_READY;
+    pthread_cond_broadcast (&prepare->progress);
+  }
+
+  pthread_mutex_unlock (&prepare->lock);
+
+  return NULL;
+}
+
+static void free_prepare (struct rio_prepare *prepare) {
+  int i;
+
+  for (i = 0 ; i < prepare->queue_len ; i++)
+    free_item (prepare->queue[i]);
+
+  free (prepare->queue);
+  free (prepare->workers);
+
+  pthread_cond_destroy (&prepare->progress);
+  pthread_cond_destroy (&prepare->work);
+  pthread_mutex_destroy (&prepare->lock);
+
+  free (prepare);
+}
+
+int prepare_open_rio (rio_prepare_t **preparep, int threads) {
+  struct rio_prepare *prepare;
+  int i;
+
+  if (preparep == NULL || threads < 0)
+    return -EINVAL;
+
+  *preparep = NULL;
+
+  if (threads == 0) {
+#if defined(_SC_NPROCESSORS_ONLN)
+    threads = sysconf (_SC_NPROCESSORS_ONLN);
+#endif
+
+    if (threads < 1)
+      threads = 1;
+  }
+
+  prepare = (struct rio_prepare *) calloc (1, sizeof (struct rio_prepare));
+  if (prepare == NULL)
+    return -ENOMEM;
+
+  prepare->workers = (pthread_t *) calloc (threads, sizeof (pthread_t));
+  if (prepare->workers == NULL) {
+    free (prepare);
+    return -ENOMEM;
+  }
+
+  pthread_mutex_init (&prepare->lock, NULL);
+  pthread_cond_init (&prepare->work, NULL);
+  pthread_cond_init (&prepare->progress, NULL);
+
+  prepare->wanted = -1;
+
+  for (i = 0 ; i < threads ; i++) {
+    if (pthread_create (&prepare->workers[i], NULL, prepare_worker, prepare) != 0)
+      break;
+
+    prepare->num_workers++;
+  }
+
+  if (prepare->num_workers == 0) {
+    free_prepare (prepare);
+    return -EAGAIN;
+  }
+
+  debug ("prepare_open_rio: started %d workers", prepare->num_workers);
+
+  *preparep = prepare;
+
+  return URIO_SUCCESS;
+}
+
+static char *prepare_strdup (const char *str) {
+  return str ? strdup (str) : NULL;
+}
+
+int prepare_add_rio (rio_prepare_t *prepare, char *file_name, const char *artist,
+		     const char *title, const char *album) {
+  struct prepare_item *item, **tmp;
+  int index;
+
+  if (prepare == NULL || file_name == NULL)
+    return -EINVAL;
+
+  item = (struct prepare_item *) calloc (1, sizeof (struct prepare_item));
+  if (item == NULL)
+    return -ENOMEM;
+
+  item->file_name = strdup (file_name);
+  item->artist    = prepare_strdup (artist);
+  item->title     = prepare_strdup (title);
+  item->album     = prepare_strdup (album);
+  item->state     = PREPARE_QUEUED;
+
+  if (item->file_name == NULL || (artist && item->artist == NULL) ||
+      (title && item->title == NULL) || (album && item->album == NULL)) {
+    free_item (item);
+    return -ENOMEM;
+  }
+
+  pthread_mutex_lock (&prepare->lock);
+
+  if (prepare->queue_len == prepare->queue_size) {
+    tmp = (struct prepare_item **) realloc (prepare->queue, (prepare->queue_size + 16) *
+					    sizeof (struct prepare_item *));
+    if (tmp == NULL) {
+      pthread_mutex_unlock (&prepare->lock);
+      free_item (item);
+      return -ENOMEM;
+    }
+
+    prepare->queue = tmp;
+    prepare->queue_size += 16;
+  }
+
+  index = prepare->queue_len;
+  prepare->queue[prepare->queue_len++] = item;
+
+  pthread_cond_broadcast (&prepare->work);
+  pthread_mutex_unlock (&prepare->lock);
+
+  return index;
+}
+
+int add_prepared_song_rio (rios_t *rio, u_int8_t memory_unit, rio_prepare_t *prepare, int index) {
+  struct prepare_item *item;
+  info_page_t info;
+  int ret;
+
+  if (rio == NULL || prepare == NULL)
+    return -EINVAL;
+
+  if (memory_unit >= rio->info.total_memory_units)
+    return -1;
+
+  pthread_mutex_lock (&prepare->lock);
+
+  if (index < 0 || index >= prepare->queue_len || prepare->queue[index]->state == PREPARE_DONE) {
+    pthread_mutex_unlock (&prepare->lock);
+    return -EINVAL;
+  }
+
+  item = prepare->queue[index];
+
+  if (index > prepare->wanted) {
+    prepare->wanted = index;
+    pthread_cond_broadcast (&prepare->work);
+  }
+
+  while (item->state != PREPARE_READY && item->state != PREPARE_DONE)
+    pthread_cond_wait (&prepare->progress, &prepare->lock);
+
+  /* another thread uploaded it first */
+  if (item->state == PREPARE_DONE) {
+    pthread_mutex_unlock (&prepare->lock);
+    return -EINVAL;
+  }
+
+  info = item->info;
+  ret  = item->ret;
+
+  item->state = PREPARE_DONE;
+
+  pthread_mutex_unlock (&prepare->lock);
+
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  ret = upload_song_info_rio (rio, memory_unit, item->file_name, &info);
+
+  free (info.data);
+
+  return ret;
+}
+
+void prepare_close_rio (rio_prepare_t *prepare) {
+  int i;
+
+  if (prepare == NULL)
+    return;
+
+  pthread_mutex_lock (&prepare->lock);
+  prepare->closing = 1;
+  pthread_cond_broadcast (&prepare->work);
+  pthread_mutex_unlock (&prepare->lock);
+
+  for (i = 0 ; i < prepare->num_workers ; i++)
+    pthread_join (prepare->workers[i], NULL);
+
+  free_prepare (prepare);
+}
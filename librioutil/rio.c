@@ -67,8 +67,8 @@ struct player_device_info player_devices[] = {
 
 /* statically defined functions */
 static int set_time_rio (rios_t *rio);
+static int init_lock_rio (rios_t *rio);
 static int return_intrn_info_rio(rios_t *rio);
-static void free_info_rio (rios_t *rio);
 
 /* read the supported file types from the rio */
 static int read_ftypes_rio (rios_t *rio) {
@@ -108,9 +108,14 @@ int open_rio (rios_t *rio, int number, int debug, int fill_structures) {
     return -EINVAL;
 
   memset(rio, 0, sizeof(rios_t));
+
+  if ((ret = init_lock_rio (rio)) != 0)
+    return ret;
   
   rio->debug       = debug;
   rio->log         = stderr;
+  rio->cache       = (fill_structures & RIO_OPEN_CACHED) ? 1 : 0;
+  rio->lazy        = (fill_structures & RIO_OPEN_LAZY) ? 1 : 0;
   
   debug("creating new rio instance. device: 0x%08x", number);
 
@@ -126,6 +131,8 @@ int open_rio (rios_t *rio, int number, int debug, int fill_structures) {
   if ((ret = usb_open_rio (rio, number)) != 0) {
     error("open_rio: could not open a Rio device: %d", ret);
 
+    pthread_mutex_destroy (&rio->lock);
+
     return ret;
   }
   
@@ -142,8 +149,6 @@ int open_rio (rios_t *rio, int number, int debug, int fill_structures) {
 
   read_ftypes_rio (rio);
 
-  unlock_rio (rio);
-
   if (fill_structures != 0) {
     ret = return_intrn_info_rio (rio);
     if (ret != URIO_SUCCESS) {
@@ -158,6 +163,10 @@ int open_rio (rios_t *rio, int number, int debug, int fill_structures) {
   return URIO_SUCCESS;
 }
 
+int count_rio (void) {
+  return usb_count_rio ();
+}
+
 /*
   set_time_rio:
     Only sets the rio's time these days.
@@ -203,21 +212,37 @@ static int set_time_rio (rios_t *rio) {
   Close connection with rio and free buffer.
 */
 void close_rio (rios_t *rio) {
+  /* nothing to do if the rio was never opened or is already closed */
+  if (rio == NULL || rio->dev == NULL)
+    return;
+
   if (try_lock_rio (rio) != 0)
     return;
   
   debug("close_rio: entering...");
 
+  /* do not leave the player with an out of date database */
+  if (rio->db_dirty)
+    (void)update_db_rio (rio);
+
   (void)wake_rio (rio);
+
+  /* record uploads and deletes in the cache */
+  if (rio->cache)
+    (void)save_flist_cache_rio (rio);
   
   /* close connection */
   usb_close_rio (rio);
   rio->dev = NULL;
 
   /* release the memory used by this instance */
-  free_info_rio (rio);
+  flist_clear_rio (rio);
+  flist_pool_free_rio (rio);
+  flist_views_detach_rio (rio);
 
   unlock_rio (rio);
+
+  pthread_mutex_destroy (&rio->lock);
   
   debug("close_rio: complete");
 }
@@ -276,6 +301,8 @@ int generate_mem_list_rio (rios_t *rio) {
 
   debug("create_mem_list_rio: entering...");
 
+  /* release the list this one replaces */
+  flist_clear_rio (rio);
   memset(list, 0, sizeof(mlist_rio_t) * MAX_MEM_UNITS);
 
   if (return_type_rio(rio) == RIORIOT) {
@@ -289,11 +316,14 @@ int generate_mem_list_rio (rios_t *rio) {
 
     list[0].size       = memory.size;
     list[0].free       = memory.free;
-      
-    ret = generate_flist_riohd (rio);
 
-    if (ret != URIO_SUCCESS)
-      return ret;
+    /* lazy lists are read by flist_load_rio */
+    if (!rio->lazy) {
+      ret = generate_flist_riohd (rio);
+
+      if (ret != URIO_SUCCESS)
+	return ret;
+    }
   } else {
     rio->info.total_memory_units = 0;
 
@@ -310,8 +340,11 @@ int generate_mem_list_rio (rios_t *rio) {
       list[i].size       = memory.size;
       list[i].free       = memory.free;
       strncpy(list[i].name, memory.name, 32);
+
+      if (rio->lazy)
+	continue;
       
-      ret = generate_flist_riomc (rio, i);
+      ret = generate_flist_riomc (rio, i, MAX_RIO_FILES);
       
       if (ret != URIO_SUCCESS)
 	return ret;
@@ -482,6 +515,9 @@ static int return_intrn_info_rio(rios_t *rio) {
   (void)get_device_prefs_rio (rio, &rio->info);
      
   /* generate internal file ane memory lists */
+  if (rio->cache && load_flist_cache_rio (rio) == URIO_SUCCESS)
+    UNLOCK(URIO_SUCCESS);
+
   ret = generate_mem_list_rio(rio);
   if (ret != URIO_SUCCESS) {
     error("rio.c return_intrn_info_rio: could not generate memory/file listing");
@@ -489,6 +525,9 @@ static int return_intrn_info_rio(rios_t *rio) {
     UNLOCK(ret);
   }
 
+  if (rio->cache)
+    (void)save_flist_cache_rio (rio);
+
   UNLOCK(URIO_SUCCESS);
 }
 
@@ -513,13 +552,13 @@ int set_info_rio(rios_t *rio, rio_info_t *info) {
   if (rio == NULL)
     return -EINVAL;
 
-  if ((ret = try_lock_rio (rio)) != 0)
-    return ret;
-
   /* noting to write */
   if (info == NULL)
     return -1;
 
+  if ((ret = try_lock_rio (rio)) != 0)
+    return ret;
+
   (void)wake_rio (rio);
   
   ret = send_command_rio(rio, RIO_PREFR, 0, 0);
@@ -677,7 +716,7 @@ int firmware_upgrade_rio (rios_t *rio, char *file_name) {
   /* some upgrades require that the memory unit be erased */
   debug("rio.c firmware_upgrade_rio: formatting internal memory");
   if ((ret = format_mem_rio (rio, 0)) != URIO_SUCCESS)
-    UNLOCK(ret);
+    return ret;
 
   if ((ret = try_lock_rio (rio)) != 0)
     return ret;
@@ -745,7 +784,7 @@ int firmware_upgrade_rio (rios_t *rio, char *file_name) {
 	  rio->progress (1, 1, rio->progress_ptr);
 
 	close (firm_fd);
-	return URIO_SUCCESS;
+	UNLOCK(URIO_SUCCESS);
       }
     } else if (rio->buffer[1] == 2) {
       /* on older rios (third generation) it appears a 2 is returned to indicate the update
@@ -822,18 +861,6 @@ int wake_rio (rios_t *rio) {
   return URIO_SUCCESS;
 }
 
-/* frees the info ptr in rios_t structure */
-static void free_info_rio (rios_t *rio) {
-  int i;
-  flist_rio_t *tmp, *ntmp;
-  
-  for (i = 0 ; i < MAX_MEM_UNITS ; i++)
-    for (tmp = rio->info.memory[i].files ; tmp ; tmp = ntmp) {
-      ntmp = tmp->next;
-      free(tmp);
-    }
-}
-
 /*
   update_info_rio:
 
@@ -843,7 +870,7 @@ int update_info_rio (rios_t *rio) {
   if (rio == NULL)
     return -EINVAL;
 
-  free_info_rio (rio);
+  flist_clear_rio (rio);
   
   return return_intrn_info_rio (rio);
 }
@@ -931,10 +958,7 @@ char *return_file_name_rio(rios_t *rio, u_int32_t song_id,
   }
   
   /* find the file */
-  for (tmp = rio->info.memory[memory_unit].files ; tmp ; tmp = tmp->next)
-    if (tmp->num == song_id)
-      break;
-  
+  tmp = get_flist_rio (rio, memory_unit, song_id);
   if (tmp == NULL)
     return NULL;
   
@@ -956,10 +980,7 @@ int return_file_size_rio(rios_t *rio, u_int32_t song_id, u_int8_t memory_unit) {
   }
   
   /* find the file */
-  for (tmp = rio->info.memory[memory_unit].files ; tmp ; tmp = tmp->next)
-    if (tmp->num == song_id)
-      break;
-  
+  tmp = get_flist_rio (rio, memory_unit, song_id);
   if (tmp == NULL)
     return -1;
   
@@ -979,6 +1000,8 @@ int return_num_files_rio (rios_t *rio, u_int8_t memory_unit) {
     error("return_num_files_rio: memory unit %02x out of range.", memory_unit);
     return -2;
   }
+
+  (void)flist_load_rio (rio, memory_unit, MAX_RIO_FILES);
   
   return rio->info.memory[memory_unit].num_files;
 }
@@ -996,6 +1019,8 @@ int return_time_rio (rios_t *rio, u_int8_t memory_unit) {
     error("return_time_rio: memory unit %02x out of range.", memory_unit);
     return -2;
   }
+
+  (void)flist_load_rio (rio, memory_unit, MAX_RIO_FILES);
   
   return rio->info.memory[memory_unit].total_time;
 }
@@ -1021,6 +1046,10 @@ int get_info_rio (rios_t *rio, rio_info_t **info) {
   
   if (rio->info.memory[0].size == 0)
     return_intrn_info_rio (rio);
+
+  /* the file counts are only right once the lists are read */
+  for (i = 0 ; i < MAX_MEM_UNITS ; i++)
+    (void)flist_load_rio (rio, i, MAX_RIO_FILES);
   
   *info = calloc(1, sizeof (rio_info_t));
   
@@ -1060,21 +1089,91 @@ int return_serial_number_rio (rios_t *rio, u_int8_t serial_number[16]) {
 }
 
 /* locking/unlocking routines */
+static int init_lock_rio (rios_t *rio) {
+  pthread_mutexattr_t attr;
+  int ret;
+
+  /* library functions call each other with the lock held */
+  pthread_mutexattr_init (&attr);
+  pthread_mutexattr_settype (&attr, PTHREAD_MUTEX_RECURSIVE);
+
+  ret = pthread_mutex_init (&rio->lock, &attr);
+
+  pthread_mutexattr_destroy (&attr);
+
+  return -ret;
+}
+
+int set_lock_mode_rio (rios_t *rio, int mode, int timeout) {
+  if (rio == NULL || mode < RIO_LOCK_TRY || mode > RIO_LOCK_TIMED || timeout < 0)
+    return -EINVAL;
+
+  rio->lock_mode    = mode;
+  rio->lock_timeout = timeout;
+
+  return URIO_SUCCESS;
+}
+
+static int timed_lock_rio (rios_t *rio) {
+#if defined (HAVE_PTHREAD_MUTEX_TIMEDLOCK)
+  struct timespec ts;
+
+  clock_gettime (CLOCK_REALTIME, &ts);
+
+  ts.tv_sec  += rio->lock_timeout / 1000;
+  ts.tv_nsec += (rio->lock_timeout % 1000) * 1000000;
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+
+  return pthread_mutex_timedlock (&rio->lock, &ts);
+#else
+  int ret, waited;
+
+  /* no pthread_mutex_timedlock (Mac OS X). poll for the lock every ms */
+  for (waited = 0 ; (ret = pthread_mutex_trylock (&rio->lock)) == EBUSY ; waited++) {
+    if (waited >= rio->lock_timeout)
+      return ETIMEDOUT;
+
+    usleep (1000);
+  }
+
+  return ret;
+#endif
+}
+
 int try_lock_rio (rios_t *rio) {
+  int ret;
+
   if (rio == NULL)
     return -EINVAL;
 
-  if (rio->lock != 0) {
+  switch (rio->lock_mode) {
+  case RIO_LOCK_BLOCK:
+    ret = pthread_mutex_lock (&rio->lock);
+    break;
+  case RIO_LOCK_TIMED:
+    ret = timed_lock_rio (rio);
+    break;
+  default:
+    ret = pthread_mutex_trylock (&rio->lock);
+  }
+
+  if (ret != 0) {
     error("librioutil/rio.c try_lock_rio: rio is being used by another thread.");
 
-    return -EBUSY;
+    return -ret;
   }
 
-  rio->lock = 1;
-
   return 0;
 }
 
+/* for operations that can not fail (releasing a reference). waits regardless of the lock mode */
+void lock_rio (rios_t *rio) {
+  pthread_mutex_lock (&rio->lock);
+}
+
 void unlock_rio (rios_t *rio) {
-  rio->lock = 0;
+  pthread_mutex_unlock (&rio->lock);
 }
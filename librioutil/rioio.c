@@ -22,11 +22,98 @@
 
 #include <errno.h>
 #include <unistd.h>
+#include <sys/time.h>
 
 #include "rioi.h"
 #include "riolog.h"
 #include "driver.h"
 
+/* acknowledgement handshake tuning by player generation. all times are in usec */
+static struct ack_tuning {
+  int gen;
+  u_int32_t initial;  /* expected acknowledgement time before any have been measured */
+  u_int32_t min_poll; /* shortest poll */
+  u_int32_t max_wait; /* give up after (same as the driver's bulk timeout) */
+} ack_tunings[] = {
+  /* older players take longer to commit a block to flash */
+  {3, 1000, 1000, 8000000},
+  {4,  500, 1000, 8000000},
+  {5,  300, 1000, 8000000},
+  {0, 1000, 1000, 8000000}
+};
+
+int set_handshake_rio (rios_t *rio, int mode) {
+  if (rio == NULL || (mode != RIO_HANDSHAKE_POLL && mode != RIO_HANDSHAKE_SLEEP))
+    return -EINVAL;
+
+  rio->handshake = mode;
+
+  return URIO_SUCCESS;
+}
+
+int set_download_flags_rio (rios_t *rio, int flags) {
+  if (rio == NULL || (flags & ~RIO_DOWNLOAD_DIRECT))
+    return -EINVAL;
+
+  rio->download_flags = flags;
+
+  return URIO_SUCCESS;
+}
+
+static u_int32_t elapsed_usec (struct timeval *start) {
+  struct timeval end;
+
+  gettimeofday (&end, NULL);
+
+  return (end.tv_sec - start->tv_sec) * 1000000 + end.tv_usec - start->tv_usec;
+}
+
+/*
+  read_ack_rio:
+
+  Wait for the device to acknowledge a data block. The device is polled with
+  a timeout of twice the running average of its response time so a slow
+  acknowledgement is never mistaken for a failure.
+*/
+static int read_ack_rio (rios_t *rio) {
+  struct ack_tuning *tuning;
+  struct timeval start;
+  u_int32_t timeout, waited;
+  int ret;
+
+  for (tuning = ack_tunings ; tuning->gen && tuning->gen != return_generation_rio (rio) ; tuning++);
+
+  if (rio->ack_estimate == 0)
+    rio->ack_estimate = tuning->initial;
+
+  timeout = 2 * rio->ack_estimate;
+  if (timeout < tuning->min_poll)
+    timeout = tuning->min_poll;
+
+  gettimeofday (&start, NULL);
+
+  for (waited = 0 ; ; waited += timeout, timeout *= 2) {
+    ret = read_bulk_timeout (rio, rio->buffer, 64, timeout);
+    if (ret != -ETIMEDOUT)
+      break;
+
+    if (waited + timeout >= tuning->max_wait) {
+      error("rioio.c read_ack_rio: timed out waiting for the device to acknowledge a block");
+
+      return -ETIMEDOUT;
+    }
+  }
+
+  if (ret < 0)
+    return ret;
+
+  rio->ack_estimate = (3 * rio->ack_estimate + elapsed_usec (&start)) / 4;
+
+  rio_log_data ("In", rio->buffer, 64);
+
+  return URIO_SUCCESS;
+}
+
 int read_block_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, u_int32_t block_size) {
   u_int32_t i;
   int ret;
@@ -51,12 +138,12 @@ int read_block_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, u_int32_t b
   return URIO_SUCCESS;
 }
 
-int write_cksum_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksum_hdr) {
+/* fill in the 64 byte header that preceeds a block of data */
+static void build_cksum_rio (rios_t *rio, unsigned char *header, unsigned char *ptr, u_int32_t size, char *cksum_hdr) {
   unsigned int *intp;
-  int ret;
 
-  memset(rio->buffer, 0, 64);
-  intp = (unsigned int *)rio->buffer;
+  memset(header, 0, 64);
+  intp = (unsigned int *)header;
 
   if (strcmp (cksum_hdr, "CRIOINFO") != 0) {
     if (ptr != NULL && return_type_rio (rio) != RIONITRUS)
@@ -65,7 +152,13 @@ int write_cksum_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksu
       intp[2] = 0x00800000;
   }
 
-  memcpy (rio->buffer, cksum_hdr, 8);
+  memcpy (header, cksum_hdr, 8);
+}
+
+int write_cksum_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksum_hdr) {
+  int ret;
+
+  build_cksum_rio (rio, rio->buffer, ptr, size, cksum_hdr);
 
   ret = write_bulk (rio, rio->buffer, 64);
   if (ret < 0)
@@ -100,10 +193,15 @@ int write_block_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksu
   
   rio_log_data ("Out", ptr, size);
   
-  if (cksum_hdr != NULL)
-    usleep(1000);
-  
-  ret = read_block_rio (rio, NULL, 64, RIO_FTS);
+  if (cksum_hdr != NULL && rio->handshake == RIO_HANDSHAKE_POLL)
+    ret = read_ack_rio (rio);
+  else {
+    if (cksum_hdr != NULL)
+      usleep(1000);
+
+    ret = read_block_rio (rio, NULL, 64, RIO_FTS);
+  }
+
   if (ret < 0)
     return ret;
   
@@ -115,15 +213,88 @@ int write_block_rio (rios_t *rio, unsigned char *ptr, u_int32_t size, char *cksu
   return URIO_SUCCESS;
 }
 
+/*
+  Pipelined block writes:
+
+  prepare_block_rio computes the header of a block, start_block_rio queues the
+  header, the data and the read of the device's acknowledgement, and
+  finish_block_rio waits for all three. The caller is free to do other work
+  (read and checksum the next block) between start and finish.
+*/
+void prepare_block_rio (rios_t *rio, rio_block_t *block, u_int32_t size, char *cksum_hdr) {
+  build_cksum_rio (rio, block->header, block->data, size, cksum_hdr);
+
+  block->size = size;
+}
+
+/* wait for all of the block's submitted transfers. returns the first error */
+static int reap_block_rio (rios_t *rio, rio_block_t *block) {
+  int i, ret, error = URIO_SUCCESS;
+
+  for (i = 0 ; i < 3 ; i++) {
+    if (block->xfer[i] == NULL)
+      continue;
+
+    ret = usb_reap_bulk (rio, block->xfer[i]);
+    block->xfer[i] = NULL;
+
+    if (ret < 0 && error == URIO_SUCCESS)
+      error = ret;
+  }
+
+  return error;
+}
+
+int start_block_rio (rios_t *rio, rio_block_t *block) {
+  int ret;
+
+  memset (block->xfer, 0, sizeof (block->xfer));
+
+  if (rio->abort) {
+    rio->abort = 0;
+    debug("rioio.c start_block_rio: recieved abort. aborting transfer");
+    return -EINTR;
+  }
+
+  if ((ret = usb_submit_bulk (rio, RIO_BULK_OUT, block->header, 64, 8000000, &block->xfer[0])) < 0 ||
+      (ret = usb_submit_bulk (rio, RIO_BULK_OUT, block->data, block->size, 8000000, &block->xfer[1])) < 0 ||
+      (ret = usb_submit_bulk (rio, RIO_BULK_IN, block->ack, 64, 8000000, &block->xfer[2])) < 0) {
+    (void) reap_block_rio (rio, block);
+    return ret;
+  }
+
+  return URIO_SUCCESS;
+}
+
+int finish_block_rio (rios_t *rio, rio_block_t *block) {
+  int ret;
+
+  if ((ret = reap_block_rio (rio, block)) != URIO_SUCCESS)
+    return ret;
+
+  rio_log_data ("Out", block->header, 64);
+  rio_log_data ("Out", block->data, block->size);
+  rio_log_data ("In", block->ack, 64);
+
+  /* keep the last response in rio->buffer for compatibility with write_block_rio */
+  memcpy (rio->buffer, block->ack, 64);
+
+  if (strncmp ((char *)block->header, "CRIODATA", 8) == 0 && strstr((char *)block->ack, "SRIODATA") == NULL) {
+    error("rioio.c finish_block_rio: second SRIODATA not found");
+    return -EIO;
+  }
+
+  return URIO_SUCCESS;
+}
+
 /* all this command does is call control_msg but it allows to print debug without editing mutiple files */
 int send_command_rio (rios_t *rio, int request, int value, int index) {
-  static int cretry = 0;
   int ret = URIO_SUCCESS;
 
   if (!rio || !rio->dev)
     return -EINVAL;
 
-  if (cretry > 3)
+  if (rio->cmd_retry > 3)
     return -ENODEV;
   
   riolog (4, "rioio.c send_command_rio: sending command: len: 0x0c rt: 0x00 rq: 0x%02x va: 0x%04x id: 0x%04x", 
@@ -135,12 +306,12 @@ int send_command_rio (rios_t *rio, int request, int value, int index) {
   rio_log_data ("Command", rio->cmd_buffer, 0xc);
 
   if (rio->cmd_buffer[0] != 0x1 && request != 0x66 && request != 0x61) {
-    cretry++;
+    rio->cmd_retry++;
     error("rioio.c send_command_rio: device did not respond to command. retrying...");
 
     ret = send_command_rio (rio, request, value, index);
 
-    cretry = 0;
+    rio->cmd_retry = 0;
   }
 
   return ret;
@@ -41,22 +41,49 @@
 static int init_new_upload_rio (rios_t *rio, u_int8_t memory_unit);
 static int init_overwrite_rio (rios_t *rio, u_int8_t memory_unit);
 static int complete_upload_rio (rios_t *rio, u_int8_t memory_unit, info_page_t info);
-static int bulk_upload_rio (rios_t *rio, info_page_t info, int addpipe);
+static int bulk_upload_rio (rios_t *rio, info_page_t info, struct rio_source *source);
 static int upload_dummy_hdr (rios_t *rio, u_int8_t memory_unit, rio_file_t *filexp);
 
+/* upload sources. each returns the number of bytes copied into buffer, 0 at the end of
+   the data or < 0 on error */
+static long fd_source_read (unsigned char *buffer, u_int32_t size, void *ptr) {
+  long amount;
+
+  do
+    amount = read (*((int *) ptr), buffer, size);
+  while (amount < 0 && errno == EINTR);
+
+  return (amount < 0) ? -errno : amount;
+}
+
+struct buffer_source {
+  const unsigned char *data;
+  u_int32_t size, offset;
+};
+
+static long buffer_source_read (unsigned char *buffer, u_int32_t size, void *ptr) {
+  struct buffer_source *bs = (struct buffer_source *) ptr;
+
+  if (size > bs->size - bs->offset)
+    size = bs->size - bs->offset;
+
+  memcpy (buffer, bs->data + bs->offset, size);
+  bs->offset += size;
+
+  return size;
+}
+
 /* the guts of any upload */
-int do_upload (rios_t *rio, u_int8_t memory_unit, int addpipe, info_page_t info, int overwrite) {
+int do_upload (rios_t *rio, u_int8_t memory_unit, struct rio_source *source, info_page_t info, int overwrite) {
   int error;
 
   debug("librioutil/song_management.c do_upload: entering");
 
   /* check if there the device has sufficient space for the file */
   if (overwrite == 0) {
-    if (FREE_SPACE(memory_unit) < (info.data->size - info.skip)/1024) {
-      free (info.data);
-      
+    /* info.data belongs to the caller */
+    if (FREE_SPACE(memory_unit) < (info.data->size - info.skip)/1024)
       return -ENOSPC;
-    }
     
     if ((error = init_new_upload_rio(rio, memory_unit)) != URIO_SUCCESS) {
       error("librioutil/song_management.c do_upload: error in init_upload_rio");
@@ -69,7 +96,7 @@ int do_upload (rios_t *rio, u_int8_t memory_unit, int addpipe, info_page_t info,
     }
   }
 
-  if ((error = bulk_upload_rio(rio, info, addpipe)) != URIO_SUCCESS) {
+  if ((error = bulk_upload_rio(rio, info, source)) != URIO_SUCCESS) {
     error("librioutil/song_management.c do_upload: error in bulk_upload_rio");
     abort_transfer_rio(rio);
     return error;
@@ -84,10 +111,14 @@ int do_upload (rios_t *rio, u_int8_t memory_unit, int addpipe, info_page_t info,
   /* rioutil keeps track of the rio's memory state */
   update_free_intrn_rio(rio, memory_unit);
 
-  flist_add_rio (rio, memory_unit, info);
+  /* a list that has not been completely read will see the new file when it is */
+  if (rio->file_table[memory_unit].complete)
+    flist_add_rio (rio, memory_unit, info);
+  else
+    flist_discard_rio (rio, memory_unit);
 
   if (info.data->type == TYPE_MP3)
-    update_db_rio (rio);
+    db_changed_rio (rio);
 
   debug("librioutil/song_management.c do_upload: complete");
 
@@ -115,9 +146,6 @@ int add_song_rio (rios_t *rio, u_int8_t memory_unit, char *file_name,
                   const char *artist, const char *title, const char *album) {
   info_page_t song_info;
   int error;
-  int addpipe;
-  char *tmp, *tmp2;
-  struct stat statinfo;
 
   if (!rio)
     return -EINVAL;
@@ -126,20 +154,50 @@ int add_song_rio (rios_t *rio, u_int8_t memory_unit, char *file_name,
     return -1;
 
   debug("add_song_rio: entering...");
-  
+
+  error = song_info_rio (&song_info, file_name, artist, title, album);
+  if (error != 0)
+    return error;
+
+  error = upload_song_info_rio (rio, memory_unit, file_name, &song_info);
+
+  free (song_info.data);
+
+  if (error == URIO_SUCCESS)
+    debug("add_song_rio: complete");
+
+  return error;
+}
+
+/*
+  song_info_rio:
+
+  Fills in song_info for file_name. This does not talk to the player so it can be
+  called from any thread. On success song_info->data must be freed by the caller.
+*/
+int song_info_rio (info_page_t *song_info, char *file_name, const char *artist,
+		   const char *title, const char *album) {
+  int error;
+  char *tmp, *tmp2;
+  struct stat statinfo;
+
   if (stat(file_name, &statinfo) < 0)
     return -ENOENT;
 
   /* common info */
-  song_info.data = (rio_file_t *)calloc(1, sizeof(rio_file_t));
-  song_info.data->size = statinfo.st_size;
-  song_info.data->mod_date = statinfo.st_mtime;
+  song_info->skip = 0;
+  song_info->data = (rio_file_t *)calloc(1, sizeof(rio_file_t));
+  if (song_info->data == NULL)
+    return -ENOMEM;
+
+  song_info->data->size = statinfo.st_size;
+  song_info->data->mod_date = statinfo.st_mtime;
   
   /* set the filename */
   tmp = strdup (file_name);
   tmp2 = basename(tmp);
   
-  strncpy((char *)song_info.data->name, tmp2, 63);
+  strncpy((char *)song_info->data->name, tmp2, 63);
   
   free (tmp);
 
@@ -147,63 +205,79 @@ int add_song_rio (rios_t *rio, u_int8_t memory_unit, char *file_name,
   tmp = file_name + strlen(file_name) - 4;
 
   if (strcasecmp(tmp, ".mp3") == 0) {
-    error = mp3_info(&song_info, file_name);
+    error = mp3_info(song_info, file_name);
   
     /* just in case one of the info funcs failed */
     if (error != 0) {
       error("Error getting song info.");
+
+      free (song_info->data);
     
       return error;
     }
 
-    if ((error = try_lock_rio (rio)) != 0)
-      return error;
-
     /* copy any user-suplied data*/
     if (artist)
-      sprintf(song_info.data->artist, artist, 63);
+      sprintf(song_info->data->artist, artist, 63);
   
     if (title)
-      sprintf(song_info.data->title, title, 63);
+      sprintf(song_info->data->title, title, 63);
   
     if (album)
-      sprintf(song_info.data->album, album, 63);
+      sprintf(song_info->data->album, album, 63);
   } else if (strcasecmp (file_name, ".lst") == 0 || strcasecmp (file_name, ".m3u") == 0) {
-    if ((error = playlist_info(&song_info, file_name)) != 0)
-      return error;
+    error = playlist_info(song_info, file_name);
   } else {
-    if ((error = downloadable_info(&song_info, file_name)) != 0)
-      UNLOCK(error);
+    error = downloadable_info(song_info, file_name);
   }
 
-  /* upload the file */
-  addpipe = open(file_name, O_RDONLY);
-  if (addpipe < 0)
-    UNLOCK(-errno);
+  if (error != 0) {
+    free (song_info->data);
 
-  debug("add_song_rio: file opened and ready to send to rio.");
+    return error;
+  }
 
-  if ((error = do_upload (rio, memory_unit, addpipe, song_info, 0)) != URIO_SUCCESS) {
-    free(song_info.data);
-    
-    close (addpipe);
+  return URIO_SUCCESS;
+}
+
+/*
+  upload_song_info_rio:
+
+  Uploads file_name using the info filled in by song_info_rio. song_info->data is
+  not freed.
+*/
+int upload_song_info_rio (rios_t *rio, u_int8_t memory_unit, char *file_name, info_page_t *song_info) {
+  int error;
+  int addpipe;
+  struct rio_source source = {fd_source_read, &addpipe};
+
+  if ((error = try_lock_rio (rio)) != 0)
+    return error;
+
+  /* upload the file */
+  addpipe = open(file_name, O_RDONLY);
+  if (addpipe < 0) {
+    error = -errno;
 
     UNLOCK(error);
   }
-  
-  close (addpipe);
 
-  free(song_info.data);
+  debug("upload_song_info_rio: file opened and ready to send to rio.");
+
+  lseek (addpipe, song_info->skip, SEEK_SET);
+
+  error = do_upload (rio, memory_unit, &source, *song_info, 0);
   
-  debug("add_song_rio: complete");
+  close (addpipe);
 
-  UNLOCK(URIO_SUCCESS);
+  UNLOCK(error);
 }
 
 int overwrite_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, char *filename) {
   info_page_t song_info;  
   rio_file_t file;
   int ret, addpipe, file_id;
+  struct rio_source source = {fd_source_read, &addpipe};
   
   struct stat statinfo;
 
@@ -236,13 +310,14 @@ int overwrite_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, c
 
   file.size = statinfo.st_size;
   song_info.data = &file;
+  song_info.skip = 0;
     
   if ((addpipe = open(filename, O_RDONLY)) == -1) {
       error("overwrite_file_rio: open failed: %d", errno);
     UNLOCK(-1);
   }
   
-  if ((ret = do_upload (rio, 0, addpipe, song_info, 1)) != URIO_SUCCESS) {
+  if ((ret = do_upload (rio, 0, &source, song_info, 1)) != URIO_SUCCESS) {
     error("overwrite_file_rio: do_upload failed");
     close (addpipe);
     
@@ -256,6 +331,101 @@ int overwrite_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, c
   UNLOCK(URIO_SUCCESS);
 }
 
+/* fill in an info page from caller supplied metadata */
+static int flist_to_info (const flist_rio_t *file, u_int32_t size, info_page_t *info) {
+  rio_file_t *data;
+  size_t name_len;
+
+  data = (rio_file_t *) calloc (1, sizeof (rio_file_t));
+  if (data == NULL)
+    return -ENOMEM;
+
+  /* the fields of a file list entry are not always terminated */
+  strncpy (data->name, file->name, sizeof (data->name) - 1);
+  data->name[sizeof (data->name) - 1] = '\0';
+  strncpy (data->title, file->title, sizeof (data->title) - 1);
+  data->title[sizeof (data->title) - 1] = '\0';
+  strncpy (data->artist, file->artist, sizeof (data->artist) - 1);
+  data->artist[sizeof (data->artist) - 1] = '\0';
+  strncpy (data->album, file->album, sizeof (data->album) - 1);
+  data->album[sizeof (data->album) - 1] = '\0';
+  strncpy ((char *)data->genre2, file->genre, sizeof (data->genre2) - 1);
+  data->genre2[sizeof (data->genre2) - 1] = '\0';
+  memcpy (data->year2, file->year, sizeof (data->year2));
+
+  data->size        = size;
+  data->time        = file->time;
+  data->bit_rate    = file->bitrate << 7;
+  data->sample_rate = file->samplerate;
+  data->mod_date    = file->mod_date ? (u_int32_t) file->mod_date : (u_int32_t) time (NULL);
+  data->trackno2    = file->track_number;
+
+  info->data = data;
+  info->skip = 0;
+
+  name_len = strlen (data->name);
+
+  if (file->type == RIO_FILETYPE_MP3 ||
+      (file->type == 0 && name_len > 4 && strcasecmp (data->name + name_len - 4, ".mp3") == 0)) {
+    /* same as mp3_info */
+    data->bits = 0x10000b11;
+    data->type = TYPE_MP3;
+    data->foo4 = 0x00020000;
+  } else if (file->type == RIO_FILETYPE_PLAYLIST) {
+    /* same as new_playlist_info */
+    data->bits = 0x11000110;
+    data->type = TYPE_PLS;
+  } else
+    (void) downloadable_info (info, data->name);
+
+  return URIO_SUCCESS;
+}
+
+static int upload_source_rio (rios_t *rio, u_int8_t memory_unit, const flist_rio_t *file, u_int32_t size,
+			      struct rio_source *source) {
+  info_page_t info;
+  int ret;
+
+  if (rio == NULL || file == NULL || memory_unit >= rio->info.total_memory_units)
+    return -EINVAL;
+
+  if ((ret = flist_to_info (file, size, &info)) != URIO_SUCCESS)
+    return ret;
+
+  if ((ret = try_lock_rio (rio)) != 0) {
+    free (info.data);
+
+    return ret;
+  }
+
+  ret = do_upload (rio, memory_unit, source, info, 0);
+
+  free (info.data);
+
+  UNLOCK(ret);
+}
+
+int upload_buffer_rio (rios_t *rio, u_int8_t memory_unit, const flist_rio_t *file, const unsigned char *buffer,
+		       u_int32_t size) {
+  struct buffer_source bs = {buffer, size, 0};
+  struct rio_source source = {buffer_source_read, &bs};
+
+  if (buffer == NULL && size)
+    return -EINVAL;
+
+  return upload_source_rio (rio, memory_unit, file, size, &source);
+}
+
+int upload_stream_rio (rios_t *rio, u_int8_t memory_unit, const flist_rio_t *file, rio_source_t callback,
+		       void *ptr) {
+  struct rio_source source = {callback, ptr};
+
+  if (callback == NULL || file == NULL)
+    return -EINVAL;
+
+  return upload_source_rio (rio, memory_unit, file, (file->size > 0) ? file->size : 0, &source);
+}
+
 /*
   init_upload_rio: sends write command to the device.
 */
@@ -294,42 +464,106 @@ static int init_overwrite_rio (rios_t *rio, u_int8_t memory_unit) {
   bulk_upload_rio:
     function writes a file to the rio in blocks.
 */
-static int bulk_upload_rio(rios_t *rio, info_page_t info, int addpipe) {
-  unsigned char file_buffer[2 * RIO_FTS];
+/* number of blocks in the upload ring. one block is on the wire while the next is
+   read and checksummed */
+#define UPLOAD_RING 2
+
+/* read the next block of the file and compute its header. returns the number of bytes
+   read from the file (0 at the end of the file) */
+static long int read_upload_block (rios_t *rio, struct rio_source *source, rio_block_t *block, size_t write_size) {
+  long int amount, total = 0;
+
+  while ((size_t) total < write_size) {
+    amount = source->read (block->data + total, write_size - total, source->ptr);
+    if (amount < 0) {
+      error("librioutil/song_management.c read_upload_block: error reading file: %ld", amount);
+      return amount;
+    }
+
+    if (amount == 0)
+      break;
+
+    total += amount;
+  }
+
+  if (total == 0)
+    return 0;
+
+  memset (block->data + total, 0, write_size - total);
+  prepare_block_rio (rio, block, write_size, "CRIODATA");
+
+  return total;
+}
+
+static int bulk_upload_rio(rios_t *rio, info_page_t info, struct rio_source *source) {
+  rio_block_t ring[UPLOAD_RING];
+  long int amount[UPLOAD_RING];
+  unsigned char *file_buffer;
   size_t write_size;
-  long int copied = 0, amount;
-  int ret;
+  long int copied = 0, tag_size = 0;
+  int i, current, next, ret = URIO_SUCCESS;
 
   debug("librioutil/song_management.c bulk_upload_rio: entering");
-  debug("librioutil/song_management.c bulk_upload_rio: skipping %d bytes of input",
-	   info.skip);
 
   write_size = (return_type_rio (rio) == RIONITRUS) ? (2 * RIO_FTS) : RIO_FTS;
-  
-  lseek(addpipe, info.skip, SEEK_SET);
-  memset (file_buffer, 0, write_size);
+
+  file_buffer = malloc (UPLOAD_RING * write_size);
+  if (file_buffer == NULL)
+    return -errno;
+
+  for (i = 0 ; i < UPLOAD_RING ; i++)
+    ring[i].data = file_buffer + i * write_size;
 
   if (rio->progress != NULL)
     rio->progress(0, 1, rio->progress_ptr);
 
-  while ((amount = read (addpipe, file_buffer, write_size)) != 0) {
+  current = 0;
+  amount[current] = read_upload_block (rio, source, &ring[current], write_size);
+
+  /* an id3v2 tag at the start of a stream holds no audio */
+  if (info.data->size == 0 && info.data->type == TYPE_MP3 && amount[current] >= 14)
+    tag_size = id3v2_size (ring[current].data);
+
+  while (amount[current] > 0) {
     /* if we dont know the size we dont know how close we are to finishing */
     if (info.data->size && rio->progress != NULL)
       rio->progress(copied, info.data->size, rio->progress_ptr);
 
-    if ((ret = write_block_rio(rio, file_buffer, write_size, "CRIODATA")) != URIO_SUCCESS)
-      return ret;
-    
-    memset (file_buffer, 0, write_size);
-    copied += amount;
+    /* the old handshake does not pipeline blocks */
+    if (rio->handshake == RIO_HANDSHAKE_SLEEP)
+      ret = write_block_rio(rio, ring[current].data, write_size, "CRIODATA");
+    else
+      ret = start_block_rio (rio, &ring[current]);
+
+    if (ret != URIO_SUCCESS)
+      break;
+
+    /* read and checksum the next block while this one is on the wire */
+    next = (current + 1) % UPLOAD_RING;
+    amount[next] = read_upload_block (rio, source, &ring[next], write_size);
+
+    if (rio->handshake != RIO_HANDSHAKE_SLEEP &&
+	(ret = finish_block_rio (rio, &ring[current])) != URIO_SUCCESS)
+      break;
+
+    copied += amount[current];
+    current = next;
   }
 
+  free (file_buffer);
+
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  if (amount[current] < 0)
+    return amount[current];
+
   if (info.data->size == 0) {
     info.data->size = copied;
 
     /* the time value should also be set, but there is no good way to do so */
-    if (info.data->bit_rate)
-      info.data->time = copied/(info.data->bit_rate * 1000);
+    if ((info.data->bit_rate >> 7) && copied > tag_size)
+      info.data->time = ((copied - tag_size) * 8)/((info.data->bit_rate >> 7) * 1000);
   }
   
   debug("librioutil/song_management.c bulk_upload_rio: sent %d/%d bytes to player",
@@ -343,11 +577,6 @@ static int bulk_upload_rio(rios_t *rio, info_page_t info, int addpipe) {
   return URIO_SUCCESS;
 }
 
-struct sort_list {
-  int seq_number;
-  flist_rio_t *ptr;
-};
-
 static int str_cmp (char *str1, char *str2) {
   char *str1p, *str2p;
   int cmp = 0;
@@ -398,10 +627,137 @@ static int str_cmp (char *str1, char *str2) {
   return cmp;
 }
 
-static void dosort_flist_rio (int section, struct sort_list *x, struct sort_list *tmp, int size) {
-  int i, j, k;
+/* number of database sections that list songs in sorted order (title, source, artist, genre) */
+#define DB_SORTED_SECTIONS 4
 
-  char *str1, *str2;
+/*
+  The sorted sections of the database are built from a sorted view of the file
+  list on memory unit 0 for each section. The views are built the first time
+  the database is needed and then updated as files are added and removed so a
+  database update does not have to sort the file list again.
+*/
+struct db_index {
+  flist_rio_t **sorted[DB_SORTED_SECTIONS];
+  int size, alloc;
+};
+
+static char *db_key (flist_rio_t *flist, int section) {
+  if (section == 0)
+    return flist->title;
+  else if (section == 1)
+    return flist->album;
+  else if (section == 2)
+    return flist->artist;
+
+  return flist->genre;
+}
+
+/* files with the same key stay in file list order */
+static int db_index_cmp (flist_rio_t *a, flist_rio_t *b, int section) {
+  int cmp = str_cmp (db_key (a, section), db_key (b, section));
+
+  if (cmp == 0)
+    cmp = (a->inum < b->inum) ? -1 : (a->inum > b->inum);
+
+  return cmp;
+}
+
+/* returns the position of the first entry in the section that does not sort before flist */
+static int db_index_find (struct db_index *index, int section, flist_rio_t *flist) {
+  int low = 0, high = index->size, mid;
+
+  while (low < high) {
+    mid = (low + high) / 2;
+
+    if (db_index_cmp (index->sorted[section][mid], flist, section) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+static int db_index_grow (struct db_index *index, int alloc) {
+  flist_rio_t **tmp;
+  int i;
+
+  for (i = 0 ; i < DB_SORTED_SECTIONS ; i++) {
+    tmp = (flist_rio_t **) realloc (index->sorted[i], alloc * sizeof (flist_rio_t *));
+    if (tmp == NULL)
+      return -ENOMEM;
+
+    index->sorted[i] = tmp;
+  }
+
+  index->alloc = alloc;
+
+  return URIO_SUCCESS;
+}
+
+void db_index_free_rio (rios_t *rio) {
+  struct db_index *index = (struct db_index *) rio->db_index;
+  int i;
+
+  if (index == NULL)
+    return;
+
+  for (i = 0 ; i < DB_SORTED_SECTIONS ; i++)
+    free (index->sorted[i]);
+
+  free (index);
+
+  rio->db_index = NULL;
+}
+
+void db_index_add_rio (rios_t *rio, flist_rio_t *flist) {
+  struct db_index *index = (struct db_index *) rio->db_index;
+  int i, pos;
+
+  /* nothing to do until the first database update builds the index */
+  if (index == NULL)
+    return;
+
+  if (index->size == index->alloc && db_index_grow (index, index->alloc * 2 + 16) != URIO_SUCCESS) {
+    /* rebuild it from scratch next time */
+    db_index_free_rio (rio);
+    return;
+  }
+
+  for (i = 0 ; i < DB_SORTED_SECTIONS ; i++) {
+    pos = db_index_find (index, i, flist);
+
+    memmove (&index->sorted[i][pos + 1], &index->sorted[i][pos], (index->size - pos) * sizeof (flist_rio_t *));
+    index->sorted[i][pos] = flist;
+  }
+
+  index->size++;
+}
+
+void db_index_remove_rio (rios_t *rio, flist_rio_t *flist) {
+  struct db_index *index = (struct db_index *) rio->db_index;
+  int i, pos;
+
+  if (index == NULL)
+    return;
+
+  for (i = 0 ; i < DB_SORTED_SECTIONS ; i++) {
+    pos = db_index_find (index, i, flist);
+
+    if (pos == index->size || index->sorted[i][pos] != flist) {
+      warning("db_index_remove_rio: file not found in the database index. rebuilding");
+      db_index_free_rio (rio);
+      return;
+    }
+
+    memmove (&index->sorted[i][pos], &index->sorted[i][pos + 1], (index->size - pos - 1) * sizeof (flist_rio_t *));
+  }
+
+  index->size--;
+}
+
+static void dosort_flist_rio (int section, flist_rio_t **x, flist_rio_t **tmp, int size) {
+  int i, j, k;
 
   if (size < 2)
     return;
@@ -411,60 +767,55 @@ static void dosort_flist_rio (int section, struct sort_list *x, struct sort_list
 
   /* merge */
   for (i = 0, j = size/2, k = 0 ; (i < size/2) && (j < size) ; k++) {
-    if (section == 0) {
-      str1 = x[i].ptr->title;
-      str2 = x[j].ptr->title;
-    } else if (section == 1) {
-      str1 = x[i].ptr->album;
-      str2 = x[j].ptr->album;
-    } else if (section == 2) {
-      str1 = x[i].ptr->artist;
-      str2 = x[j].ptr->artist;
-    } else if (section == 3) {
-      str1 = x[i].ptr->genre;
-      str2 = x[j].ptr->genre;
-    }
-    
-    if (str_cmp (str1, str2) <= 0) {
-      tmp[k].seq_number = x[i].seq_number;
-      tmp[k].ptr = x[i++].ptr;
-    } else {
-      tmp[k].seq_number = x[j].seq_number;
-      tmp[k].ptr = x[j++].ptr;
-    }
+    if (db_index_cmp (x[i], x[j], section) <= 0)
+      tmp[k] = x[i++];
+    else
+      tmp[k] = x[j++];
   }
   
-  while (i < size/2) {
-    tmp[k].seq_number = x[i].seq_number;
-    tmp[k++].ptr = x[i++].ptr;
-  }
+  while (i < size/2)
+    tmp[k++] = x[i++];
 
-  while (j < size) {
-    tmp[k].seq_number = x[j].seq_number;
-    tmp[k++].ptr = x[j++].ptr;
-  }
-  
-  memcpy (x, tmp, size * sizeof (struct sort_list));
+  while (j < size)
+    tmp[k++] = x[j++];
   
-  return;
+  memcpy (x, tmp, size * sizeof (flist_rio_t *));
 }
 
-static void sort_flist_rio (rios_t *rio, int section, int num_tracks, struct sort_list **x) {
-  flist_rio_t *flist;
-  int i;
-  struct sort_list *tmp;
+/* build the sorted views of memory unit 0 if they do not already exist */
+static struct db_index *db_index_get_rio (rios_t *rio) {
+  struct db_index *index = (struct db_index *) rio->db_index;
+  flist_rio_t *flist, **tmp;
+  int i, j, num_tracks;
 
-  *x = calloc (num_tracks, sizeof (struct sort_list));
-  tmp = calloc (num_tracks, sizeof (struct sort_list));
+  if (index != NULL)
+    return index;
 
-  for (i = 0, flist = rio->info.memory[0].files ; flist ; flist = flist->next, i++) {
-    (*x)[i].seq_number = i;
-    (*x)[i].ptr = flist;
+  num_tracks = size_flist_rio (rio, 0);
+
+  index = (struct db_index *) calloc (1, sizeof (struct db_index));
+  tmp = (flist_rio_t **) calloc (num_tracks + 1, sizeof (flist_rio_t *));
+  if (index == NULL || tmp == NULL || db_index_grow (index, num_tracks + 16) != URIO_SUCCESS) {
+    rio->db_index = index;
+    db_index_free_rio (rio);
+    free (tmp);
+
+    return NULL;
   }
 
-  dosort_flist_rio (section, *x, tmp, num_tracks);
+  for (i = 0 ; i < DB_SORTED_SECTIONS ; i++) {
+    for (j = 0, flist = rio->info.memory[0].files ; flist ; flist = flist->next, j++)
+      index->sorted[i][j] = flist;
+
+    dosort_flist_rio (i, index->sorted[i], tmp, num_tracks);
+  }
 
   free (tmp);
+
+  index->size = num_tracks;
+  rio->db_index = index;
+
+  return index;
 }
 
 static void set_uint24 (unsigned char *buf, int block, unsigned int value) {
@@ -475,10 +826,72 @@ static void set_uint24 (unsigned char *buf, int block, unsigned int value) {
 
 static char *db_sections[] = {"title", "source", "artist", "genre", "year", "date", "playlist"};
 
-static int build_db_sec_rio (rios_t *rio, unsigned char *buf, int num_tracks, unsigned char *taxi_buf, int section, int start_block) {
+/* the database is built in a buffer of 3 byte blocks that is sent to the player in RIO_FTS chunks */
+struct db_buffer {
+  unsigned char *data;
+  size_t size; /* bytes. always a multiple of RIO_FTS */
+};
+
+/* make sure there is room for at least blocks 3 byte blocks */
+static int db_reserve (struct db_buffer *db, int blocks) {
+  size_t size = db->size ? db->size : RIO_FTS;
+  unsigned char *tmp;
+
+  if ((size_t) blocks * 3 <= db->size)
+    return URIO_SUCCESS;
+
+  while (size < (size_t) blocks * 3)
+    size *= 2;
+
+  tmp = (unsigned char *) realloc (db->data, size);
+  if (tmp == NULL)
+    return -ENOMEM;
+
+  memset (tmp + db->size, 0, size - db->size);
+
+  db->data = tmp;
+  db->size = size;
+
+  return URIO_SUCCESS;
+}
+
+/*
+  db_estimate_rio:
+
+  Returns an upper bound on the number of 3 byte blocks the database will use
+  so the buffer can usually be allocated once.
+*/
+static int db_estimate_rio (rios_t *rio, struct db_index *index) {
+  /* header, section headers, and the taxi header */
+  int blocks = 0x14 + 7 * 6 + 16;
+  u_int32_t max_num = 0;
+  flist_rio_t *flist;
+  int i, j;
+
+  /* each entry in a sorted section takes at most a letter heading (3 blocks), an entry
+     heading (3 blocks), the file number, and the string */
+  for (i = 0 ; i < DB_SORTED_SECTIONS ; i++)
+    for (j = 0 ; j < index->size ; j++)
+      blocks += 8 + strlen (db_key (index->sorted[i][j], i)) / 3;
+
+  /* taxi table and the file number lookup table */
+  blocks += index->size * 0x1b;
+
+  for (flist = rio->info.memory[0].files ; flist ; flist = flist->next)
+    if (flist->rio_num > max_num)
+      max_num = flist->rio_num;
+
+  blocks += max_num / 0x10 + 1;
+
+  return blocks;
+}
+
+static int build_db_sec_rio (struct db_index *index, struct db_buffer *db, unsigned char *taxi_buf, int section, int start_block) {
   int padding = 0xffffff;
   int cblock = start_block;
-  struct sort_list *tmp_list;
+  int num_tracks = index->size;
+  flist_rio_t **sorted;
+  unsigned char *buf;
   int i;
 
   int next_block = 0;
@@ -495,6 +908,11 @@ static int build_db_sec_rio (rios_t *rio, unsigned char *buf, int num_tracks, un
 
   char last_letter = 0;
 
+  if (db_reserve (db, cblock + 6) != URIO_SUCCESS)
+    return -ENOMEM;
+
+  buf = db->data;
+
   set_uint24 (buf, 2 * (section + 2) + 1, start_block);
     
   memset (&buf[cblock * 3], 0xff, 6);
@@ -515,17 +933,16 @@ static int build_db_sec_rio (rios_t *rio, unsigned char *buf, int num_tracks, un
   if (section != 3)
     set_uint24 (buf, start_block, cblock);
 
-  sort_flist_rio (rio, section, num_tracks, &tmp_list);
+  sorted = index->sorted[section];
 
   for (i = 0 ; i < num_tracks ; i++) {
-    if (section == 0)
-      str = tmp_list[i].ptr->title;
-    else if (section == 1)
-      str = tmp_list[i].ptr->album;
-    else if (section == 2)
-      str = tmp_list[i].ptr->artist;
-    else
-      str = tmp_list[i].ptr->genre;
+    str = db_key (sorted[i], section);
+
+    /* headings, the first file number, and the string */
+    if (db_reserve (db, cblock + 8 + strlen (str) / 3) != URIO_SUCCESS)
+      return -ENOMEM;
+
+    buf = db->data;
 
     taxi1 = cblock;
 
@@ -559,22 +976,22 @@ static int build_db_sec_rio (rios_t *rio, unsigned char *buf, int num_tracks, un
     count_block = cblock++;
 
     for ( ; i < num_tracks ; i++) {
-      set_uint24 (buf, cblock++, tmp_list[i].ptr->rio_num);
+      /* room for this file number plus the string */
+      if (db_reserve (db, cblock + 2 + strlen (str) / 3) != URIO_SUCCESS)
+	return -ENOMEM;
+
+      buf = db->data;
 
-      set_uint24 (taxi_buf, tmp_list[i].seq_number * 0x1b + 2 * (section) + 1, taxi1);
-      set_uint24 (taxi_buf, tmp_list[i].seq_number * 0x1b + 2 * (section), taxi2);
+      set_uint24 (buf, cblock++, sorted[i]->rio_num);
+
+      /* inum is the position of the file in the file list (and the taxi table) */
+      set_uint24 (taxi_buf, sorted[i]->inum * 0x1b + 2 * (section) + 1, taxi1);
+      set_uint24 (taxi_buf, sorted[i]->inum * 0x1b + 2 * (section), taxi2);
       
       if ((i + 1) == num_tracks)
 	break;
 
-      if (section == 0)
-	str2 = tmp_list[i+1].ptr->title;
-      else if (section == 1)
-	str2 = tmp_list[i+1].ptr->album;
-      else if (section == 2)
-	str2 = tmp_list[i+1].ptr->artist;
-      else
-	str2 = tmp_list[i+1].ptr->genre;
+      str2 = db_key (sorted[i+1], section);
 
       if (strcmp (str, str2) != 0)
 	break;
@@ -588,38 +1005,52 @@ static int build_db_sec_rio (rios_t *rio, unsigned char *buf, int num_tracks, un
     prev_block = xblock;
   }
 
-  free (tmp_list);
   return cblock;
 }
 
-static int build_database_rio (rios_t *rio, unsigned char *buf, size_t buf_size) {
-  int i;
+/*
+  build_database_rio:
+
+  Builds the Nitrus database in db. Returns the number of 3 byte blocks used
+  or < 0 on error.
+*/
+static int build_database_rio (rios_t *rio, struct db_buffer *db) {
+  int i, ret;
   uint j;
 
-  unsigned char *taxi_buf;
+  unsigned char *buf, *taxi_buf;
   
   int next_sec;
   int num_tracks;
   int taxi_offset;
 
   flist_rio_t *flist;
+  struct db_index *index;
 
   unsigned char db_magic[] = { 0x55, 0x9a, 0x81, 0x03, 0x00, 0x00 };
-  uint prev_num = 0;
+  uint prev_num = 0, max_num;
   int num_tracks_block;
 
-  /* buf_size is not used (though it should be checked). remove compiler warning */
-  (void) buf_size;
+  index = db_index_get_rio (rio);
+  if (index == NULL)
+    return -ENOMEM;
+
+  if (db_reserve (db, db_estimate_rio (rio, index)) != URIO_SUCCESS)
+    return -ENOMEM;
+
+  buf = db->data;
 
   memset (buf, 0xff, 0x3c);
 
   memcpy (buf, db_magic, 6);
 
-  num_tracks = size_flist_rio (rio, 0);
+  num_tracks = index->size;
 
-  taxi_buf = calloc (1, num_tracks * 0x51);
+  taxi_buf = calloc (1, num_tracks * 0x51 + 1);
+  if (taxi_buf == NULL)
+    return -ENOMEM;
 
-  for (i = 0, flist = rio->info.memory[0].files ; flist ; flist = flist->next, i++) {
+  for (i = 0, flist = rio->info.memory[0].files ; flist && i < num_tracks ; flist = flist->next, i++) {
     int track_offset = 0x51 * i;
 
     memset (&taxi_buf[track_offset], 0xff, 3 * 12);
@@ -643,8 +1074,27 @@ static int build_database_rio (rios_t *rio, unsigned char *buf, size_t buf_size)
   }
 
   next_sec = 0x14;
-  for (i = 0 ; i < 7 ; i++)
-    next_sec = build_db_sec_rio (rio, buf, num_tracks, taxi_buf, i, next_sec);
+  for (i = 0 ; i < 7 ; i++) {
+    next_sec = build_db_sec_rio (index, db, taxi_buf, i, next_sec);
+    if (next_sec < 0) {
+      free (taxi_buf);
+
+      return next_sec;
+    }
+  }
+
+  /* taxi table and the file number lookup table (one entry per possible file number) */
+  /* file ids increase along the list */
+  max_num = num_tracks ? rio->file_table[0].entries[num_tracks - 1]->rio_num : 0;
+
+  ret = db_reserve (db, next_sec + 8 + (num_tracks * 0x51) / 3 + max_num / 0x10 + 1);
+  if (ret != URIO_SUCCESS) {
+    free (taxi_buf);
+
+    return ret;
+  }
+
+  buf = db->data;
 
   memset (&buf[next_sec * 3], 0xff, 6);
   next_sec += 2;
@@ -683,29 +1133,92 @@ static int build_database_rio (rios_t *rio, unsigned char *buf, size_t buf_size)
 }
 
 
+/*
+  db_changed_rio:
+
+  Called after the file list changes. Sends a new database to the Nitrus
+  unless a batch is open, in which case the update waits for commit_batch_rio.
+*/
+int db_changed_rio (rios_t *rio) {
+  if (return_type_rio (rio) != RIONITRUS)
+    return URIO_SUCCESS;
+
+  if (rio->batch) {
+    rio->db_dirty = 1;
+
+    return URIO_SUCCESS;
+  }
+
+  return update_db_rio (rio);
+}
+
+int begin_batch_rio (rios_t *rio) {
+  int ret;
+
+  if (rio == NULL)
+    return -EINVAL;
+
+  if ((ret = try_lock_rio (rio)) != 0)
+    return ret;
+
+  rio->batch++;
+
+  UNLOCK(URIO_SUCCESS);
+}
+
+int commit_batch_rio (rios_t *rio) {
+  int ret = URIO_SUCCESS;
+
+  if (rio == NULL)
+    return -EINVAL;
+
+  if ((ret = try_lock_rio (rio)) != 0)
+    return ret;
+
+  if (rio->batch == 0)
+    UNLOCK(-EINVAL);
+
+  if (--rio->batch == 0 && rio->db_dirty) {
+    debug("commit_batch_rio: sending the deferred database update");
+
+    ret = update_db_rio (rio);
+  }
+
+  UNLOCK(ret);
+}
+
 /* The Nitrus expects extra information in a buffer made up of 3 byte chunks */
 int update_db_rio (rios_t *rio) {
+  struct db_buffer db = {NULL, 0};
   unsigned char *buf;
-  int i, ret;
-  int blocks, db_size;
+  int ret;
+  int blocks;
+  size_t i, db_size;
 
   if (return_type_rio (rio) != RIONITRUS)
     return URIO_SUCCESS;
 
   debug("librioutil/song_management.c update_db_rio: entering...");
 
-  /* 8 * RIO_FTS is an arbitrary size for the buffer picked because it should provide enough storage
-     for building the song database. */
-  buf = calloc (1, 8 * RIO_FTS);
-  if (buf == NULL) {
-    error("librioutil/song_management.c update_db_rio: could not allocate a buffer in which to build the new database.");
+  /* the database lists every file */
+  ret = flist_load_rio (rio, 0, MAX_RIO_FILES);
+  if (ret != URIO_SUCCESS)
+    return ret;
 
-    return -errno;
+  blocks = build_database_rio (rio, &db);
+  if (blocks < 0) {
+    error("librioutil/song_management.c update_db_rio: could not build the new database: %d", blocks);
+
+    free (db.data);
+
+    return blocks;
   }
 
-  blocks = build_database_rio (rio, buf, 8 * RIO_FTS);
+  buf = db.data;
   db_size = blocks * 3;
 
+  debug("librioutil/song_management.c update_db_rio: database is %d bytes", db_size);
+
   wake_rio (rio);
   if ((ret = send_command_rio (rio, RIO_NINFO, 0, 0)) != URIO_SUCCESS) {
     error("librioutil/song_management.c update_db_rio: rio did not respond to command.");
@@ -737,12 +1250,9 @@ int update_db_rio (rios_t *rio) {
     return -EIO;
   }
 
-  for (i = 0 ; i < 8 * RIO_FTS ; i += RIO_FTS) {
-    if (i > db_size)
-      break;
-
+  /* only send the blocks that hold the database. the buffer is padded with zeros to a multiple of RIO_FTS */
+  for (i = 0 ; i < db_size ; i += RIO_FTS)
     write_block_rio (rio, &buf[i], RIO_FTS, "CRIODATA");
-  }
 
   write_cksum_rio (rio, buf, 0, "CRIOINFO");
   ret = read_block_rio (rio, NULL, 64, 64);
@@ -757,6 +1267,8 @@ int update_db_rio (rios_t *rio) {
 
   free (buf);
 
+  rio->db_dirty = 0;
+
   debug("librioutil/song_management.c update_db_rio: complete.");
 
   return URIO_SUCCESS;
@@ -899,7 +1411,7 @@ int delete_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num) {
   update_free_intrn_rio (rio, memory_unit);
     
   /* update nitrus database */
-  update_db_rio (rio);
+  db_changed_rio (rio);
     
   debug("delete_file_rio: complete.");
 
@@ -913,6 +1425,9 @@ static int upload_dummy_hdr (rios_t *rio, u_int8_t memory_unit, rio_file_t *file
 
   debug("upload_dummy_hdr: entering...");
 
+  if (file_num < 0)
+    return file_num;
+
   /* uploading a duplicate file header with this value in the file bits makes
      the data downloadable on older diamond rios (600, 800, 900) */
   filep->bits = 0x10000591;
@@ -939,13 +1454,16 @@ static int upload_dummy_hdr (rios_t *rio, u_int8_t memory_unit, rio_file_t *file
 
   debug("upload_dummy_hdr: complete.");
 
-  return file_num;
+  /* the header takes the first unused file id. these players are asked for file
+     headers by position, which is one less than the id */
+  return file_num - 1;
 }
 
 /*
-  download_file_rio:
+  do_download:
   Function takes in the number of the file
-  and attemt to download it from the Rio.
+  and attemt to download it from the Rio into
+  sink. The caller must hold the lock.
  
   Note: This only works with the following files:
   - Recorded WAVE files on the Rio 800
@@ -969,50 +1487,37 @@ static int upload_dummy_hdr (rios_t *rio, u_int8_t memory_unit, rio_file_t *file
   All of the newer players from Rio support the download of any
   file on the player!
 */
-int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, char *file_name) {
+int do_download (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, struct rio_sink *sink) {
   int i, blocks, size, ret, file_id, player_generation, read_size;
-  int downfd;
   
-  int download_complete, cr_dummy = -1;
-  int mode = S_IRUSR | S_IWUSR | S_IROTH | S_IRGRP;
+  int download_complete, sink_failed, cr_dummy = -1;
   int block_size;
 
-  unsigned char dload_buffer[RIO_FTS];
+  unsigned char dload_buffer[RIO_FTS], *data;
 
-  char tmp_np[PATH_MAX];
   rio_file_t file;
 
-  if ((ret = try_lock_rio (rio)) != 0)
-    return ret;
-
-  debug("librioutil/song_management.c download_file_rio: entering...");
+  debug("librioutil/song_management.c do_download: entering...");
 
   player_generation = return_generation_rio (rio);
   
   /* get file header data */
   file_id = flist_get_file_id_rio (rio, memory_unit, file_num);
   if (file_id < 0) {
-    error("librioutil/song_management.c download_file_rio: file not found: %d", file_id);
+    error("librioutil/song_management.c do_download: file not found: %d", file_id);
 
-    UNLOCK(file_id);
+    return file_id;
   }
 
   if ((ret = get_file_info_rio(rio, &file, memory_unit, file_id)) != URIO_SUCCESS) {
-    error("librioutil/song_management.c download_file_rio: error getting file info: %d", ret);
+    error("librioutil/song_management.c do_download: error getting file info: %d", ret);
 
-    UNLOCK(ret);
-  }
-
-  /* generate a filename if one was not supplied */
-  if (file_name == NULL) {
-    (void)flist_get_file_name_rio (rio, memory_unit, file_num, tmp_np, PATH_MAX);
-
-    for ( i = strlen (tmp_np) - 1 ; i > 0 && tmp_np[i] != '\\' && tmp_np[i] != '/' ; i--);
-
-    file_name = &tmp_np[i];
+    return ret;
   }
-  
 
+  /* the Riot does not send file headers. the size of the file is in its file list */
+  if (return_type_rio (rio) == RIORIOT)
+    file.size = get_flist_rio (rio, memory_unit, file_num)->size;
 
   if (player_generation < 5 && return_version_rio(rio) < 2.0 && return_type_rio (rio) != RIORIOT) {
     /*
@@ -1022,7 +1527,7 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
       they do not have the same restrictions on downloading from the device.
     */
     if (file.start == 0)
-      UNLOCK(-EPERM);
+      return -EPERM;
 
     if (player_generation == 3 && !(file.bits & 0x00000080)) {
       /* Older players will only allow non-music files to be downloaded. A fake
@@ -1030,13 +1535,15 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
 	 the deletion of the file off of the device. */
       file_id = upload_dummy_hdr (rio, memory_unit, &file);
       if (file_id < 0) {
-	error("librioutil/song_management.c download_file_rio: error uploading dummy file header.");
-	UNLOCK(file_id);
+	error("librioutil/song_management.c do_download: error uploading dummy file header.");
+	return file_id;
       }
+
+      cr_dummy = file_num;
   
       if ((ret = get_file_info_rio(rio, &file, memory_unit, file_id)) != URIO_SUCCESS) {
-        error("librioutil/song_management.c download_file_rio: could not fetch song info: %d", ret);
-	UNLOCK(ret);
+        error("librioutil/song_management.c do_download: could not fetch song info: %d", ret);
+	return ret;
       }
     }
   }
@@ -1046,10 +1553,10 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
   (void)wake_rio (rio);
   
   if ((ret = send_command_rio(rio, RIO_READF, memory_unit, 0)) != URIO_SUCCESS)
-    UNLOCK(ret);
+    return ret;
   
   if ((ret = read_block_rio(rio, NULL, 64, RIO_FTS)) != URIO_SUCCESS)
-    UNLOCK(ret);
+    return ret;
     
   /* send file header data */
   file_to_arch (&file);
@@ -1058,22 +1565,18 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
   
   if (memcmp(rio->buffer, "SRIONOFL", 8) == 0) {
     /* file does not exist */
-    error("librioutil/song_management.c download_file_rio: (device) no such file");
+    error("librioutil/song_management.c do_download: (device) no such file");
 
-    UNLOCK(-1);
+    return -ENOENT;
   }
 
 
-  /* create local file */
-  debug("librioutil/song_management.c download_file_rio: downloading to file %s", file_name);
-
-  downfd = creat (file_name, mode);
-  if (downfd < 0) {
-    error("librioutil/song_management.c download_file_rio: could not create file %s: %s", file_name, strerror (errno));
-
+  /* prepare the destination */
+  ret = sink->open (sink->ptr, file.size);
+  if (ret != URIO_SUCCESS) {
     abort_transfer_rio (rio);
 
-    UNLOCK(-1);
+    return ret;
   }
 
 
@@ -1082,13 +1585,15 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
   block_size = (player_generation >= 4) ? RIO_FTS : 4096;
   blocks = size/block_size + ((size % block_size) ? 1 : 0);
 
+  /* the rio appears to expect a checksum in the CRIODATA packet. the checksum is
+     always that of an empty block */
+  memset (dload_buffer, 0, block_size);
+
   if (rio->progress)
     rio->progress(0, 1, rio->progress_ptr);
 
   /* retrieve file data from the device */
-  for (i = 0, download_complete = 0 ; i < blocks ; i++) {
-    memset (dload_buffer, 0, block_size);
-
+  for (i = 0, download_complete = 0, sink_failed = 0 ; i < blocks ; i++) {
     if (rio->abort) {
       abort_transfer_rio (rio);
       rio->abort = 0;
@@ -1096,11 +1601,17 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
       if (rio->progress)
 	rio->progress(1, 1, rio->progress_ptr);
       
-      close(downfd);
-      UNLOCK(URIO_SUCCESS);
+      return sink->close (sink->ptr, -EINTR);
+    }
+
+    /* the device always sends a full RIO_FTS byte block */
+    data = sink->reserve (sink->ptr);
+    if (data == NULL) {
+      abort_transfer_rio (rio);
+      sink_failed = 1;
+      break;
     }
     
-    /* the rio appears to expect a checksum in the CRIODATA packet */
     write_cksum_rio (rio, dload_buffer, block_size, "CRIODATA");
     
     read_block_rio(rio, NULL, 64, 64);
@@ -1117,17 +1628,22 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
     else
       read_size = size;
     
-    read_block_rio (rio, dload_buffer, RIO_FTS, block_size);
+    read_block_rio (rio, data, RIO_FTS, block_size);
     
     if (rio->progress)
       rio->progress(i, blocks, rio->progress_ptr);
     
-    write(downfd, dload_buffer, read_size);
+    ret = sink->commit (sink->ptr, read_size);
+    if (ret != URIO_SUCCESS) {
+      abort_transfer_rio (rio);
+      sink_failed = 1;
+      break;
+    }
     
     size -= read_size;
   }
   
-  if (!download_complete) {
+  if (!download_complete && !sink_failed) {
     write_cksum_rio (rio, dload_buffer, block_size, "CRIODATA");
   
     if (player_generation < 4)
@@ -1137,7 +1653,9 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
       rio->progress(1, 1, rio->progress_ptr);
   }
 
-  close(downfd);
+  ret = sink->close (sink->ptr, ret);
+  if (ret != URIO_SUCCESS)
+    return ret;
   
   if (cr_dummy != -1) {
     /* If a dummy header was uploaded, delete it. An unfortunate side-effect of this
@@ -1149,6 +1667,7 @@ int download_file_rio (rios_t *rio, u_int8_t memory_unit, u_int32_t file_num, ch
     delete_file_rio (rio, memory_unit, cr_dummy);
   }
   
-  debug("librioutil/song_management.c download_file_rio: complete.");
-  UNLOCK(URIO_SUCCESS);
+  debug("librioutil/song_management.c do_download: complete.");
+
+  return URIO_SUCCESS;
 }
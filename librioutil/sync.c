@@ -0,0 +1,381 @@
+/**
+ *   (c) 2026 agent <agent@local>
+ *   v1.5.4 sync.c
+ *
+ *   Uploads a shared queue of files to every attached player in parallel.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU Lesser General Public License as published
+ *   by the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Lesser General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ **/
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "rioi.h"
+#include "riolog.h"
+
+enum sync_state { SYNC_OPENING, SYNC_READY, SYNC_FAILED };
+
+struct sync_item {
+  u_int8_t memory_unit;
+  char *file_name;
+  char *artist, *title, *album;
+};
+
+struct sync_player {
+  struct rio_sync *sync;
+  rios_t rio;
+  pthread_t thread;
+  int number;
+
+  enum sync_state state;
+  int ret; /* result of open_rio */
+
+  /* index of the next queue entry to upload */
+  int next;
+  int uploaded, failed;
+  /* error from the last failed database update. the files in that batch may not show up */
+  int error;
+  /* uploading or committing the batch */
+  int busy;
+};
+
+struct rio_sync {
+  pthread_mutex_t lock;
+  /* signaled when files are queued or the manager is closing */
+  pthread_cond_t work;
+  /* signaled when a player opens or finishes a file */
+  pthread_cond_t progress;
+
+  struct sync_item **queue;
+  int queue_len, queue_size;
+  int closing;
+
+  int debug;
+  int num_players;
+  struct sync_player *players;
+};
+
+static void free_item (struct sync_item *item) {
+  free (item->file_name);
+  free (item->artist);
+  free (item->title);
+  free (item->album);
+  free (item);
+}
+
+static void *sync_worker (void *arg) {
+  struct sync_player *player = (struct sync_player *) arg;
+  struct rio_sync *sync = player->sync;
+  struct sync_item *item;
+  int ret;
+
+  ret = open_rio (&player->rio, player->number, sync->debug, 1);
+
+  pthread_mutex_lock (&sync->lock);
+
+  player->ret   = ret;
+  player->state = (ret == URIO_SUCCESS) ? SYNC_READY : SYNC_FAILED;
+  pthread_cond_broadcast (&sync->progress);
+
+  while (player->state == SYNC_READY) {
+    if (player->next == sync->queue_len) {
+      if (player->busy) {
+	/* the queue is empty. send the player its database now instead of after every file */
+	pthread_mutex_unlock (&sync->lock);
+
+	ret = commit_batch_rio (&player->rio);
+	if (ret != URIO_SUCCESS)
+	  error ("sync_worker: could not update the database on player %d: %d", player->number, ret);
+
+	pthread_mutex_lock (&sync->lock);
+
+	if (ret != URIO_SUCCESS)
+	  player->error = ret;
+
+	player->busy = 0;
+	pthread_cond_broadcast (&sync->progress);
+	continue;
+      }
+
+      /* pending files are still uploaded after sync_close_rio is called */
+      if (sync->closing)
+	break;
+
+      pthread_cond_wait (&sync->work, &sync->lock);
+      continue;
+    }
+
+    item = sync->queue[player->next];
+
+    if (!player->busy) {
+      player->busy = 1;
+      begin_batch_rio (&player->rio);
+    }
+
+    pthread_mutex_unlock (&sync->lock);
+
+    ret = add_song_rio (&player->rio, item->memory_unit, item->file_name, item->artist,
+			item->title, item->album);
+    if (ret != URIO_SUCCESS)
+      error ("sync_worker: could not upload %s to player %d: %d", item->file_name, player->number, ret);
+
+    pthread_mutex_lock (&sync->lock);
+
+    if (ret == URIO_SUCCESS)
+      player->uploaded++;
+    else
+      player->failed++;
+
+    player->next++;
+    pthread_cond_broadcast (&sync->progress);
+  }
+
+  pthread_mutex_unlock (&sync->lock);
+
+  if (player->state == SYNC_READY)
+    close_rio (&player->rio);
+
+  return NULL;
+}
+
+static void free_sync (struct rio_sync *sync) {
+  int i;
+
+  for (i = 0 ; i < sync->queue_len ; i++)
+    free_item (sync->queue[i]);
+
+  free (sync->queue);
+  free (sync->players);
+
+  pthread_cond_destroy (&sync->progress);
+  pthread_cond_destroy (&sync->work);
+  pthread_mutex_destroy (&sync->lock);
+
+  free (sync);
+}
+
+int sync_open_rio (rio_sync_t **syncp, int debug) {
+  struct rio_sync *sync;
+  int i, count, ret, opening;
+
+  if (syncp == NULL)
+    return -EINVAL;
+
+  *syncp = NULL;
+
+  count = count_rio ();
+  if (count < 0)
+    return count;
+  else if (count == 0)
+    return -ENOENT;
+
+  debug ("sync_open_rio: found %d players", count);
+
+  sync = (struct rio_sync *) calloc (1, sizeof (struct rio_sync));
+  if (sync == NULL)
+    return -ENOMEM;
+
+  sync->players = (struct sync_player *) calloc (count, sizeof (struct sync_player));
+  if (sync->players == NULL) {
+    free (sync);
+    return -ENOMEM;
+  }
+
+  pthread_mutex_init (&sync->lock, NULL);
+  pthread_cond_init (&sync->work, NULL);
+  pthread_cond_init (&sync->progress, NULL);
+
+  sync->debug = debug;
+
+  for (i = 0 ; i < count ; i++) {
+    sync->players[i].sync   = sync;
+    sync->players[i].number = i;
+    sync->players[i].state  = SYNC_OPENING;
+
+    if (pthread_create (&sync->players[i].thread, NULL, sync_worker, &sync->players[i]) != 0)
+      break;
+
+    sync->num_players++;
+  }
+
+  /* wait for every player to finish opening */
+  pthread_mutex_lock (&sync->lock);
+
+  do {
+    for (i = 0, opening = 0 ; i < sync->num_players ; i++)
+      if (sync->players[i].state == SYNC_OPENING)
+	opening++;
+
+    if (opening)
+      pthread_cond_wait (&sync->progress, &sync->lock);
+  } while (opening);
+
+  for (i = 0, ret = -ENOENT ; i < sync->num_players ; i++) {
+    if (sync->players[i].state == SYNC_READY) {
+      ret = URIO_SUCCESS;
+      break;
+    }
+
+    ret = sync->players[i].ret;
+  }
+
+  pthread_mutex_unlock (&sync->lock);
+
+  if (ret != URIO_SUCCESS) {
+    /* the workers have already exited */
+    for (i = 0 ; i < sync->num_players ; i++)
+      pthread_join (sync->players[i].thread, NULL);
+
+    free_sync (sync);
+
+    return ret;
+  }
+
+  *syncp = sync;
+
+  return URIO_SUCCESS;
+}
+
+int sync_players_rio (rio_sync_t *sync) {
+  if (sync == NULL)
+    return -EINVAL;
+
+  return sync->num_players;
+}
+
+static char *sync_strdup (const char *str) {
+  return str ? strdup (str) : NULL;
+}
+
+int sync_add_rio (rio_sync_t *sync, u_int8_t memory_unit, char *file_name, const char *artist,
+		  const char *title, const char *album) {
+  struct sync_item *item, **tmp;
+
+  if (sync == NULL || file_name == NULL)
+    return -EINVAL;
+
+  item = (struct sync_item *) calloc (1, sizeof (struct sync_item));
+  if (item == NULL)
+    return -ENOMEM;
+
+  item->memory_unit = memory_unit;
+  item->file_name   = strdup (file_name);
+  item->artist      = sync_strdup (artist);
+  item->title       = sync_strdup (title);
+  item->album       = sync_strdup (album);
+
+  if (item->file_name == NULL || (artist && item->artist == NULL) ||
+      (title && item->title == NULL) || (album && item->album == NULL)) {
+    free_item (item);
+    return -ENOMEM;
+  }
+
+  pthread_mutex_lock (&sync->lock);
+
+  if (sync->queue_len == sync->queue_size) {
+    tmp = (struct sync_item **) realloc (sync->queue, (sync->queue_size + 16) * sizeof (struct sync_item *));
+    if (tmp == NULL) {
+      pthread_mutex_unlock (&sync->lock);
+      free_item (item);
+      return -ENOMEM;
+    }
+
+    sync->queue = tmp;
+    sync->queue_size += 16;
+  }
+
+  sync->queue[sync->queue_len++] = item;
+
+  pthread_cond_broadcast (&sync->work);
+  pthread_mutex_unlock (&sync->lock);
+
+  return URIO_SUCCESS;
+}
+
+int sync_wait_rio (rio_sync_t *sync) {
+  int i, busy, failed, ret;
+
+  if (sync == NULL)
+    return -EINVAL;
+
+  pthread_mutex_lock (&sync->lock);
+
+  do {
+    for (i = 0, busy = 0, failed = 0, ret = URIO_SUCCESS ; i < sync->num_players ; i++) {
+      if (sync->players[i].state != SYNC_READY)
+	continue;
+
+      if (sync->players[i].next < sync->queue_len || sync->players[i].busy)
+	busy++;
+
+      failed += sync->players[i].failed;
+
+      if (ret == URIO_SUCCESS)
+	ret = sync->players[i].error;
+    }
+
+    if (busy)
+      pthread_cond_wait (&sync->progress, &sync->lock);
+  } while (busy);
+
+  pthread_mutex_unlock (&sync->lock);
+
+  if (ret != URIO_SUCCESS)
+    return ret;
+
+  return failed ? -EIO : URIO_SUCCESS;
+}
+
+int sync_status_rio (rio_sync_t *sync, int player, int *uploaded, int *failed) {
+  struct sync_player *p;
+  int ret;
+
+  if (sync == NULL || player < 0 || player >= sync->num_players)
+    return -EINVAL;
+
+  p = &sync->players[player];
+
+  pthread_mutex_lock (&sync->lock);
+
+  if (uploaded)
+    *uploaded = p->uploaded;
+  if (failed)
+    *failed = p->failed;
+
+  ret = p->ret;
+
+  pthread_mutex_unlock (&sync->lock);
+
+  return ret;
+}
+
+void sync_close_rio (rio_sync_t *sync) {
+  int i;
+
+  if (sync == NULL)
+    return;
+
+  pthread_mutex_lock (&sync->lock);
+  sync->closing = 1;
+  pthread_cond_broadcast (&sync->work);
+  pthread_mutex_unlock (&sync->lock);
+
+  for (i = 0 ; i < sync->num_players ; i++)
+    pthread_join (sync->players[i].thread, NULL);
+
+  free_sync (sync);
+}
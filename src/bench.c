@@ -0,0 +1,754 @@
+/**
+ *   (c) 2026 agent <agent@local>
+ *   v1.5.4 bench.c
+ *
+ *   Benchmarks the librioutil transfer paths against the emulated player
+ *   (librioutil/driver_emu.c).
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ **/
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <time.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "rio.h"
+#include "rioi.h"
+#include "driver.h"
+
+struct bench_opts {
+  int num_files;
+  int file_size; /* kiB */
+  int debug;
+  char tmpdir[64];
+  /* directory of tagged files for the id3 test */
+  char *corpus;
+};
+
+struct bench_result {
+  double seconds;
+  u_int64_t bytes;
+  struct emu_stats stats;
+};
+
+typedef int (*bench_fn) (rios_t *rio, struct bench_opts *opts, struct bench_result *result);
+
+static char *bench_files[] = {"bench.mp3", "download.mp3", "expected.mp3", "firmware.lok", NULL};
+
+static void bench_path (struct bench_opts *opts, char *name, char *path) {
+  snprintf (path, PATH_MAX, "%s/%s", opts->tmpdir, name);
+}
+
+static double now (void) {
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* write a file of MPEG-1 layer III frames (128 kbps, 44.1 kHz). files made with
+   different seeds have different contents */
+static int make_mp3 (char *path, int size, int seed) {
+  unsigned char frame[417];
+  int fd, i;
+
+  if ((fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+    return -errno;
+
+  memset (frame, 0, sizeof (frame));
+  frame[0] = 0xff;
+  frame[1] = 0xfb;
+  frame[2] = 0x90;
+  frame[3] = 0x64;
+  memcpy (frame + 404, &seed, sizeof (seed));
+
+  for (i = 0 ; i < size ; i += sizeof (frame)) {
+    /* vary the payload so the checksums are not all alike */
+    frame[4 + (i / sizeof (frame)) % 400] = (unsigned char) i;
+
+    if (write (fd, frame, sizeof (frame)) != (ssize_t) sizeof (frame)) {
+      close (fd);
+      return -EIO;
+    }
+  }
+
+  close (fd);
+
+  return 0;
+}
+
+/* tagged files written for the id3 test when no corpus is given */
+#define ID3_CORPUS_SIZE 64
+
+static size_t id3_put_size (unsigned char *buf, int major, size_t size) {
+  int i;
+
+  /* id3v2.4 frame sizes are synchsafe */
+  for (i = 3 ; i >= 0 ; i--, size >>= (major == 4) ? 7 : 8)
+    buf[i] = size & ((major == 4) ? 0x7f : 0xff);
+
+  return 4;
+}
+
+/* append a text frame in ISO-8859-1 or byte order marked UTF-16 */
+static size_t id3_text_frame (unsigned char *buf, int major, char *id, int encoding, char *text) {
+  size_t i, length = 1;
+
+  buf[10] = encoding;
+
+  if (encoding == 0)
+    for (i = 0 ; text[i] ; i++)
+      buf[10 + length++] = text[i];
+  else {
+    buf[10 + length++] = 0xff;
+    buf[10 + length++] = 0xfe;
+
+    for (i = 0 ; text[i] ; i++) {
+      buf[10 + length++] = text[i];
+      buf[10 + length++] = 0;
+    }
+  }
+
+  memcpy (buf, id, 4);
+  id3_put_size (&buf[4], major, length);
+  buf[8] = buf[9] = 0;
+
+  return 10 + length;
+}
+
+/* write an id3v2 tagged file with a 16 kiB picture ahead of the text frames */
+static int make_tagged_mp3 (char *path, int index) {
+  int major = (index & 1) ? 4 : 3, encoding = (index & 2) ? 1 : 0;
+  unsigned char *tag, frame[417];
+  size_t length = 10, picture = 16384;
+  char text[64];
+  int fd, i, ret = 0;
+
+  if ((tag = calloc (1, picture + 1024)) == NULL)
+    return -ENOMEM;
+
+  memcpy (&tag[length], "APIC", 4);
+  id3_put_size (&tag[length + 4], major, picture);
+  memcpy (&tag[length + 11], "image/jpeg", 10);
+  length += 10 + picture;
+
+  snprintf (text, 64, "Bench Title %d", index);
+  length += id3_text_frame (&tag[length], major, "TIT2", encoding, text);
+  length += id3_text_frame (&tag[length], major, "TPE1", encoding, "Bench Artist");
+  length += id3_text_frame (&tag[length], major, "TALB", encoding, "Bench Album");
+  snprintf (text, 64, "%d/%d", index + 1, ID3_CORPUS_SIZE);
+  length += id3_text_frame (&tag[length], major, "TRCK", encoding, text);
+  length += id3_text_frame (&tag[length], major, "TCON", encoding, "(17)");
+  length += id3_text_frame (&tag[length], major, (major == 4) ? "TDRC" : "TYER", encoding, "2004");
+
+  /* padding */
+  length += 256;
+
+  memcpy (tag, "ID3", 3);
+  tag[3] = major;
+  for (i = 0 ; i < 4 ; i++)
+    tag[6 + i] = ((length - 10) >> (21 - 7 * i)) & 0x7f;
+
+  memset (frame, 0, sizeof (frame));
+  frame[0] = 0xff;
+  frame[1] = 0xfb;
+  frame[2] = 0x90;
+  frame[3] = 0x64;
+
+  if ((fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+    free (tag);
+    return -errno;
+  }
+
+  if (write (fd, tag, length) != (ssize_t) length)
+    ret = -EIO;
+
+  for (i = 0 ; i < 8 && ret == 0 ; i++)
+    if (write (fd, frame, sizeof (frame)) != (ssize_t) sizeof (frame))
+      ret = -EIO;
+
+  close (fd);
+  free (tag);
+
+  return ret;
+}
+
+static void free_corpus (char **files, int num_files) {
+  int i;
+
+  for (i = 0 ; i < num_files ; i++)
+    free (files[i]);
+
+  free (files);
+}
+
+/* list the regular files in the corpus directory or write a corpus to the temporary directory */
+static int id3_corpus (struct bench_opts *opts, char ***filesp) {
+  char path[PATH_MAX], **files, **tmp;
+  int num_files = 0, size = ID3_CORPUS_SIZE, ret;
+  struct dirent *entry;
+  struct stat statinfo;
+  DIR *dir;
+
+  if ((files = calloc (size, sizeof (char *))) == NULL)
+    return -ENOMEM;
+
+  if (opts->corpus == NULL) {
+    for (num_files = 0 ; num_files < ID3_CORPUS_SIZE ; num_files++) {
+      snprintf (path, PATH_MAX, "%s/id3-%02d.mp3", opts->tmpdir, num_files);
+
+      if ((ret = make_tagged_mp3 (path, num_files)) < 0 || (files[num_files] = strdup (path)) == NULL) {
+	unlink (path);
+	free_corpus (files, num_files);
+	return (ret < 0) ? ret : -ENOMEM;
+      }
+    }
+
+    *filesp = files;
+
+    return num_files;
+  }
+
+  if ((dir = opendir (opts->corpus)) == NULL) {
+    free (files);
+    return -errno;
+  }
+
+  while ((entry = readdir (dir)) != NULL) {
+    snprintf (path, PATH_MAX, "%s/%s", opts->corpus, entry->d_name);
+
+    if (stat (path, &statinfo) < 0 || !S_ISREG (statinfo.st_mode))
+      continue;
+
+    if (num_files == size) {
+      if ((tmp = realloc (files, 2 * size * sizeof (char *))) == NULL)
+	break;
+
+      files = tmp;
+      size *= 2;
+    }
+
+    if ((files[num_files] = strdup (path)) == NULL)
+      break;
+
+    num_files++;
+  }
+
+  closedir (dir);
+
+  if (entry != NULL) {
+    free_corpus (files, num_files);
+    return -ENOMEM;
+  }
+
+  *filesp = files;
+
+  return num_files;
+}
+
+/* parse the tags of every file in the corpus once per -n */
+static int bench_id3 (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  rio_media_t media;
+  rio_file_t info;
+  char **files = NULL;
+  int i, j, num_files;
+
+  (void) rio;
+
+  if ((num_files = id3_corpus (opts, &files)) < 0)
+    return num_files;
+
+  for (i = 0 ; i < opts->num_files ; i++)
+    for (j = 0 ; j < num_files ; j++) {
+      if (media_open_rio (&media, files[j]) != URIO_SUCCESS)
+	continue;
+
+      memset (&info, 0, sizeof (info));
+      get_id3_info (&media, files[j], &info);
+
+      /* count the id3v2 tag and the id3v1 tag */
+      if (media.size >= 14)
+	result->bytes += id3v2_size ((unsigned char *) media.data);
+
+      if (media.size >= 128 && memcmp (media.data + media.size - 128, "TAG", 3) == 0)
+	result->bytes += 128;
+
+      media_close_rio (&media);
+    }
+
+  if (opts->corpus == NULL)
+    for (j = 0 ; j < num_files ; j++)
+      unlink (files[j]);
+
+  free_corpus (files, num_files);
+
+  return 0;
+}
+
+static int bench_upload (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  char path[PATH_MAX], title[32];
+  int i, ret;
+
+  bench_path (opts, "bench.mp3", path);
+
+  for (i = 0 ; i < opts->num_files ; i++) {
+    snprintf (title, 32, "Bench Track %d", i);
+
+    /* each track has its own contents so bench_download can tell them apart */
+    if ((ret = make_mp3 (path, opts->file_size * 1024, i)) < 0)
+      return ret;
+
+    ret = add_song_rio (rio, 0, path, "Bench Artist", title, "Bench Album");
+    if (ret != URIO_SUCCESS)
+      return ret;
+
+    result->bytes += opts->file_size * 1024;
+  }
+
+  return 0;
+}
+
+/* same as upload but the nitrus database is only sent once */
+static int bench_batch (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  int ret, batch_ret;
+
+  if ((ret = begin_batch_rio (rio)) != URIO_SUCCESS)
+    return ret;
+
+  ret = bench_upload (rio, opts, result);
+
+  batch_ret = commit_batch_rio (rio);
+
+  return ret ? ret : batch_ret;
+}
+
+/* returns 0 if the two files have the same contents */
+static int compare_files (char *path_a, char *path_b) {
+  unsigned char buffer_a[4096], buffer_b[4096];
+  ssize_t amount_a, amount_b;
+  int fd_a, fd_b, ret = 0;
+
+  if ((fd_a = open (path_a, O_RDONLY)) < 0)
+    return -errno;
+
+  if ((fd_b = open (path_b, O_RDONLY)) < 0) {
+    ret = -errno;
+    close (fd_a);
+    return ret;
+  }
+
+  do {
+    amount_a = read (fd_a, buffer_a, sizeof (buffer_a));
+    amount_b = read (fd_b, buffer_b, sizeof (buffer_b));
+
+    if (amount_a != amount_b || (amount_a > 0 && memcmp (buffer_a, buffer_b, amount_a) != 0))
+      ret = -EIO;
+  } while (ret == 0 && amount_a > 0);
+
+  close (fd_a);
+  close (fd_b);
+
+  return ret;
+}
+
+/* download the tracks written by bench_upload and check that they come back unchanged */
+static int bench_download (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  char path[PATH_MAX], expected[PATH_MAX];
+  int i, seed, ret, size;
+  flist_rio_t *tmp;
+
+  bench_path (opts, "download.mp3", path);
+  bench_path (opts, "expected.mp3", expected);
+
+  for (i = 0 ; i < opts->num_files ; i++) {
+    if ((tmp = get_flist_rio (rio, 0, i)) == NULL)
+      return -ENOENT;
+
+    /* older players delete a music file once it has been downloaded */
+    size = tmp->size;
+
+    if (sscanf (tmp->title, "Bench Track %d", &seed) != 1) {
+      fprintf (stderr, "download: file %d (%s) was not uploaded by the upload test\n", i, tmp->title);
+      return -ENOENT;
+    }
+
+    ret = download_file_rio (rio, 0, i, path);
+    if (ret != URIO_SUCCESS)
+      return ret;
+
+    if ((ret = make_mp3 (expected, opts->file_size * 1024, seed)) < 0)
+      return ret;
+
+    if ((ret = compare_files (path, expected)) != 0) {
+      fprintf (stderr, "download: file %d (%s) does not match what was uploaded\n", i, tmp->title);
+      return ret;
+    }
+
+    result->bytes += size;
+  }
+
+  return 0;
+}
+
+static int bench_list (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  (void) opts;
+
+  result->bytes += return_num_files_rio (rio, 0) * sizeof (rio_file_t);
+
+  /* rebuilds the file list with generate_flist_riomc */
+  return update_info_rio (rio);
+}
+
+static int bench_database (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  (void) opts;
+  (void) result;
+
+  return update_db_rio (rio);
+}
+
+static int bench_firmware (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  char path[PATH_MAX];
+  int ret;
+
+  bench_path (opts, "firmware.lok", path);
+
+  /* the device does not validate the firmware */
+  if ((ret = make_mp3 (path, opts->file_size * 1024, 0)) < 0)
+    return ret;
+
+  result->bytes += opts->file_size * 1024;
+
+  return firmware_upgrade_rio (rio, path);
+}
+
+/* upload the files to every emulated player through the sync manager. the sync manager
+   opens the players itself so this runs while main's handle is closed */
+static int bench_sync (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  char path[PATH_MAX], title[32];
+  rio_sync_t *sync;
+  int i, ret;
+
+  (void) rio;
+
+  bench_path (opts, "bench.mp3", path);
+  if ((ret = make_mp3 (path, opts->file_size * 1024, 0)) < 0)
+    return ret;
+
+  if ((ret = sync_open_rio (&sync, opts->debug)) != URIO_SUCCESS)
+    return ret;
+
+  for (i = 0 ; i < opts->num_files ; i++) {
+    snprintf (title, 32, "Sync Track %d", i);
+
+    if ((ret = sync_add_rio (sync, 0, path, "Bench Artist", title, "Bench Album")) != URIO_SUCCESS)
+      break;
+  }
+
+  if (ret == URIO_SUCCESS)
+    ret = sync_wait_rio (sync);
+
+  result->bytes += (u_int64_t) sync_players_rio (sync) * opts->num_files * opts->file_size * 1024;
+
+  sync_close_rio (sync);
+
+  return ret;
+}
+
+/* byte at a time version of crc32_rio used to check the library's result */
+static u_int32_t crc32_bytewise (u_int8_t *buf, size_t length) {
+  static u_int32_t table[256];
+  u_int32_t crc = 0, r;
+  size_t i, j;
+
+  if (table[1] == 0)
+    for (i = 0 ; i < 256 ; i++) {
+      for (r = i, j = 0 ; j < 8 ; j++)
+	r = (r & 1) ? (r >> 1) ^ 0x04C11DB7 : r >> 1;
+
+      table[i] = r;
+    }
+
+  for (i = 0 ; i < length ; i++)
+    crc = (crc >> 8) ^ table[(crc ^ buf[i]) & 0xff];
+
+  crc = big32_2_arch32 (crc);
+  return crc;
+}
+
+static int bench_checksum (struct bench_opts *opts, struct bench_result *result,
+			   u_int32_t (*crc_fn)(u_int8_t *, size_t)) {
+  unsigned char *buffer;
+  u_int32_t sum = 0;
+  int i, blocks;
+
+  /* checksum as many RIO_FTS blocks as the upload test sends */
+  blocks = (opts->num_files * opts->file_size * 1024) / RIO_FTS;
+
+  if ((buffer = malloc (RIO_FTS + 1)) == NULL)
+    return -ENOMEM;
+
+  for (i = 0 ; i < RIO_FTS + 1 ; i++)
+    buffer[i] = (unsigned char)(i * 7 + (i >> 8));
+
+  /* odd lengths and alignments must give the same result */
+  for (i = 0 ; i < 64 ; i++)
+    if (crc32_rio (buffer + (i & 1), RIO_FTS - i) != crc32_bytewise (buffer + (i & 1), RIO_FTS - i)) {
+      free (buffer);
+      return -EIO;
+    }
+
+  for (i = 0 ; i < blocks ; i++) {
+    buffer[0] = (unsigned char) i;
+    sum ^= crc_fn (buffer, RIO_FTS);
+  }
+
+  result->bytes = (u_int64_t) blocks * RIO_FTS;
+
+  free (buffer);
+
+  /* keep the loop from being optimized out */
+  return (sum == 0xdeadbeef) ? 1 : 0;
+}
+
+static int bench_crc (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  (void) rio;
+
+  return bench_checksum (opts, result, crc32_rio);
+}
+
+static int bench_crc_bytewise (rios_t *rio, struct bench_opts *opts, struct bench_result *result) {
+  (void) rio;
+
+  return bench_checksum (opts, result, crc32_bytewise);
+}
+
+static struct bench_test {
+  char *name;
+  bench_fn fn;
+  int nitrus_only;
+  /* the test opens the players itself. the handle is closed while it runs and
+     the per-device counters are not reported */
+  int exclusive;
+} tests[] = {
+  {"crc", bench_crc, 0, 0},
+  {"crc-bytewise", bench_crc_bytewise, 0, 0},
+  {"id3", bench_id3, 0, 0},
+  {"upload", bench_upload, 0, 0},
+  {"batch", bench_batch, 0, 0},
+  {"download", bench_download, 0, 0},
+  {"list", bench_list, 0, 0},
+  {"database", bench_database, 1, 0},
+  {"sync", bench_sync, 0, 1},
+  /* the firmware upgrade formats the player so it has to run last */
+  {"firmware", bench_firmware, 0, 0},
+  {NULL, NULL, 0, 0}
+};
+
+static void print_result (char *name, struct bench_result *result) {
+  struct emu_stats *stats = &result->stats;
+  double mbs = (result->seconds > 0.0) ? result->bytes / result->seconds / 1048576.0 : 0.0;
+
+  printf ("%-12s %9.3f %10.2f %7u %7u %7u %9.1f %9llu %9llu\n", name, result->seconds, mbs,
+	  stats->commands, stats->bulk_out, stats->blocks,
+	  stats->blocks ? (double) stats->block_time / stats->blocks : 0.0,
+	  (unsigned long long) stats->block_min, (unsigned long long) stats->block_max);
+}
+
+static void usage (void) {
+  printf ("Usage: rioutil-bench [OPTIONS] [test ...]\n\n");
+  printf ("Run librioutil operations against an emulated player and report\n");
+  printf ("throughput, block round trip times and command counts.\n\n");
+
+  printf (" tests: crc crc-bytewise id3 upload batch download list database sync firmware (default: all)\n\n");
+
+  printf (" options:\n");
+  printf ("  -p <name>   player to emulate (default: Rio Nitrus)\n");
+  printf ("  -d <int>    number of emulated players (default: 1)\n");
+  printf ("  -n <int>    number of files to upload/download, passes over the id3 corpus (default: 8)\n");
+  printf ("  -s <int>    size of each file in kiB (default: 1024)\n");
+  printf ("  -c <dir>    tagged files for the id3 test (default: generated)\n");
+  printf ("  -l <int>    per-transfer latency in usec (default: player model)\n");
+  printf ("  -w <int>    bandwidth in bytes/sec (default: player model)\n");
+  printf ("  -k <int>    block commit delay in usec (default: player model)\n");
+  printf ("  -S          sleep 1 ms before each block acknowledgement (old handshake)\n");
+  printf ("  -e          increase verbosity level\n");
+  printf ("  -h          print this screen\n\n");
+
+  exit (EXIT_FAILURE);
+}
+
+int main (int argc, char *argv[]) {
+  struct bench_opts opts;
+  struct bench_result result;
+  struct emu_config config;
+  struct bench_test *test;
+  char path[PATH_MAX];
+  double start;
+  rios_t rio;
+  int c, i, ret, failed = 0, open_ret = URIO_SUCCESS;
+  int handshake = RIO_HANDSHAKE_POLL;
+
+  memset (&opts, 0, sizeof (opts));
+  opts.num_files = 8;
+  opts.file_size = 1024;
+
+  memset (&config, 0, sizeof (config));
+  config.player    = "Rio Nitrus";
+  config.devices   = 1;
+  config.latency   = -1;
+  config.bandwidth = -1;
+  config.ack_delay = -1;
+  config.mem_size  = 1024 * 1024 * 1024;
+
+  while ((c = getopt (argc, argv, "p:d:n:s:c:l:w:k:Seh?")) != -1) {
+    switch (c) {
+    case 'p':
+      config.player = optarg;
+      break;
+    case 'd':
+      config.devices = strtol (optarg, NULL, 10);
+      break;
+    case 'n':
+      opts.num_files = strtol (optarg, NULL, 10);
+      break;
+    case 's':
+      opts.file_size = strtol (optarg, NULL, 10);
+      break;
+    case 'c':
+      opts.corpus = optarg;
+      break;
+    case 'l':
+      config.latency = strtol (optarg, NULL, 10);
+      break;
+    case 'w':
+      config.bandwidth = strtol (optarg, NULL, 10);
+      break;
+    case 'k':
+      config.ack_delay = strtol (optarg, NULL, 10);
+      break;
+    case 'S':
+      handshake = RIO_HANDSHAKE_SLEEP;
+      break;
+    case 'e':
+      opts.debug++;
+      break;
+    default:
+      usage ();
+    }
+  }
+
+  if (opts.num_files <= 0 || opts.file_size <= 0 || config.devices <= 0)
+    usage ();
+
+  for (i = optind ; i < argc ; i++) {
+    for (test = tests ; test->name && strcmp (test->name, argv[i]) ; test++);
+
+    if (test->name == NULL) {
+      fprintf (stderr, "Unknown test: %s\n\n", argv[i]);
+      usage ();
+    }
+  }
+
+  snprintf (opts.tmpdir, sizeof (opts.tmpdir), "/tmp/rioutil-bench.XXXXXX");
+  if (mkdtemp (opts.tmpdir) == NULL) {
+    fprintf (stderr, "Could not create a temporary directory: %s\n", strerror (errno));
+    exit (EXIT_FAILURE);
+  }
+
+  emu_set_config (&config);
+
+  ret = open_rio (&rio, 0, opts.debug, 1);
+  if (ret != URIO_SUCCESS) {
+    fprintf (stderr, "Could not open the emulated player: %s\n", strerror (-ret));
+    rmdir (opts.tmpdir);
+    exit (EXIT_FAILURE);
+  }
+
+  set_handshake_rio (&rio, handshake);
+
+  printf ("player: %s x %d, files: %d x %d kiB\n\n", config.player, config.devices, opts.num_files,
+	  opts.file_size);
+  printf ("%-12s %9s %10s %7s %7s %7s %9s %9s %9s\n", "test", "seconds", "MB/s", "cmds",
+	  "writes", "blocks", "rtt avg", "rtt min", "rtt max");
+
+  for (test = tests ; test->name ; test++) {
+    if (optind < argc) {
+      for (i = optind ; i < argc && strcmp (test->name, argv[i]) ; i++);
+
+      if (i == argc)
+	continue;
+    }
+
+    if (test->nitrus_only && return_type_rio (&rio) != RIONITRUS) {
+      printf ("%-12s skipped (requires a Rio Nitrus)\n", test->name);
+      continue;
+    }
+
+    memset (&result, 0, sizeof (result));
+
+    if (test->exclusive)
+      close_rio (&rio);
+    else
+      emu_reset_stats (&rio);
+
+    start = now ();
+    ret = test->fn (&rio, &opts, &result);
+    result.seconds = now () - start;
+
+    if (test->exclusive) {
+      if ((open_ret = open_rio (&rio, 0, opts.debug, 1)) != URIO_SUCCESS) {
+	fprintf (stderr, "Could not reopen the emulated player: %s\n", strerror (-open_ret));
+	failed = 1;
+	break;
+      }
+
+      set_handshake_rio (&rio, handshake);
+    } else
+      emu_get_stats (&rio, &result.stats);
+
+    if (ret != URIO_SUCCESS) {
+      printf ("%-12s failed: %d\n", test->name, ret);
+      failed = 1;
+      continue;
+    }
+
+    print_result (test->name, &result);
+  }
+
+  if (open_ret == URIO_SUCCESS)
+    close_rio (&rio);
+
+  for (i = 0 ; bench_files[i] ; i++) {
+    bench_path (&opts, bench_files[i], path);
+    unlink (path);
+  }
+
+  rmdir (opts.tmpdir);
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
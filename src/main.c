@@ -48,6 +48,9 @@
 #define MAX_DEPTH_RIO 3
 #define TOTAL_MARKS  20
 
+/* first read of a piped upload. grown until it reaches past any id3v2 tag */
+#define PIPE_BLOCK_SIZE 65536
+
 #define max(a, b) ((a > b) ? a : b)
 
 /* a simple version of basename that returns a pointer into x where the basename
@@ -82,6 +85,7 @@ static int create_playlist (rios_t *rio, int argc, char *argv[]);
 static int overwrite_file (rios_t *rio, int mem_unit, int argc, char *argv[]);
 static int pipe_upload (rios_t *rio, int mem_unit, char *title, char *album, char *artist);
 static int add_tracks (rios_t *rio);
+static int sync_tracks (int debug);
 static int download_tracks (rios_t *rio, char *copt, u_int32_t mem_unit);
 static int delete_tracks (rios_t *rio, char *dopt, u_int32_t mem_unit);
 static int print_playlists (rios_t *rio);
@@ -115,6 +119,8 @@ int main (int argc, char *argv[]) {
   uint num_command_flags = 0;
   unsigned int mem_unit = -1;
   long int dev;
+  int all_players = 0;
+  int use_cache = 0;
 
   rios_t rio;
 
@@ -142,6 +148,8 @@ int main (int argc, char *argv[]) {
     {"update",    required_argument, 0,    'u'},
     {"version",   no_argument,       0,    'v'},
     {"recovery",  no_argument,       0,    'z'},
+    {"all",       no_argument,       0,    'A'},
+    {"cache",     no_argument,       0,    'C'},
     {NULL,        0,                 NULL,  0 },
   };
       
@@ -155,7 +163,7 @@ int main (int argc, char *argv[]) {
   memset (flags, 0, 27);
   memset (flag_args, 0, 26 * sizeof (char *));
 
-  while((c = getopt_long(argc, argv, "W;a:bld:ec:u:s:t:r:m:po:n:fh?ivgzjkO",
+  while((c = getopt_long(argc, argv, "W;a:bld:ec:u:s:t:r:m:po:n:fh?ivgzjkOAC",
 			 long_options, NULL)) != -1){
     switch(c){
     case 'm':
@@ -207,6 +215,14 @@ int main (int argc, char *argv[]) {
     case 'O':
       flags[26] = 1;
 
+      break;
+    case 'A':
+      all_players = 1;
+
+      break;
+    case 'C':
+      use_cache = 1;
+
       break;
     case 0:
       break;
@@ -240,6 +256,19 @@ int main (int argc, char *argv[]) {
     exit (EXIT_FAILURE);
   }
 
+  /* skip parsing files that have not changed since the last upload */
+  if (use_cache && flags[0])
+    (void) enable_metadata_cache_rio ();
+
+  if (all_players) {
+    if (!flags[0] || num_command_flags > 1) {
+      fprintf (stderr, "--all can only be used with the upload commands.\n");
+      exit (EXIT_FAILURE);
+    }
+
+    return sync_tracks (flags[4]);
+  }
+
   /* open the player */
   if (flags[5] || flags[20]) {
     flags[25] = 1;
@@ -249,7 +278,7 @@ int main (int argc, char *argv[]) {
 
   dev = (flags[14]) ? strtol (flag_args[14], NULL, 10) : 0;
 
-  ret = open_rio (&rio, dev, flags[4], (flags[25]) ? 0 : 1);
+  ret = open_rio (&rio, dev, flags[4], (flags[25]) ? 0 : (use_cache ? RIO_OPEN_CACHED : RIO_OPEN_FILL));
   if (ret != URIO_SUCCESS) {
       printf ("failed!\n");
 
@@ -317,6 +346,7 @@ int main (int argc, char *argv[]) {
   }
 
   close_rio (&rio);
+  disable_metadata_cache_rio ();
   
   return ret;
 }
@@ -358,40 +388,106 @@ static void dir_add_songs (char *filename, int depth, int mem_unit) {
   closedir (dir_fd);
 }
 
+static long stdin_source (unsigned char *buffer, u_int32_t size, void *ptr) {
+  long ret;
+
+  (void) ptr;
+
+  do
+    ret = read (0, buffer, size);
+  while (ret < 0 && errno == EINTR);
+
+  return (ret < 0) ? -errno : ret;
+}
+
+/* the first block of stdin is held back until the MPEG headers in it have been read */
+struct pipe_source {
+  unsigned char *buffer;
+  u_int32_t length;
+  u_int32_t offset;
+};
+
+static long pipe_source_read (unsigned char *buffer, u_int32_t size, void *ptr) {
+  struct pipe_source *source = (struct pipe_source *) ptr;
+
+  if (source->offset == source->length)
+    return stdin_source (buffer, size, NULL);
+
+  if (size > source->length - source->offset)
+    size = source->length - source->offset;
+
+  memcpy (buffer, source->buffer + source->offset, size);
+  source->offset += size;
+
+  return size;
+}
+
 static int pipe_upload (rios_t *rio, int mem_unit, char *title, char *album, char *artist) {
-  int error, ret, fd;
-  char file_name[] = "/tmp/rioutil_XXXXXX.mp3";
-  char file_buffer[1024];
+  struct pipe_source source;
+  u_int32_t size, skip = 0;
+  unsigned char *tmp;
+  flist_rio_t file;
+  long amount = 0;
+  int ret;
 
-  if (NULL == mktemp (file_name)) {
-    fprintf (stderr, "rioutil/pipe_upload: mktemp failed: %s\n", strerror (errno));
+  /* the data is sent to the player as it is read. the size is not known until the
+     end of the stream */
+  memset (&file, 0, sizeof (file));
 
-    return -errno;
-  }
+  snprintf (file.name, sizeof (file.name), "%s.mp3", title ? title : "stdin");
+  if (title)
+    strncpy (file.title, title, sizeof (file.title) - 1);
+  if (album)
+    strncpy (file.album, album, sizeof (file.album) - 1);
+  if (artist)
+    strncpy (file.artist, artist, sizeof (file.artist) - 1);
+
+  file.type = RIO_FILETYPE_MP3;
+
+  /* read enough of the stream to get past any id3v2 tag and into the frames */
+  memset (&source, 0, sizeof (source));
+
+  for (size = PIPE_BLOCK_SIZE ; ; size *= 2) {
+    tmp = (unsigned char *) realloc (source.buffer, size);
+    if (tmp == NULL) {
+      free (source.buffer);
+      return -ENOMEM;
+    }
+
+    source.buffer = tmp;
 
-  fd = open (file_name, O_WRONLY | O_CREAT | O_EXCL, 0644);
-  if (fd < 0) {
-    fprintf (stderr, "rioutil/pipe_upload: could not create a temporary file: %s\n", strerror (errno));
+    while (source.length < size &&
+	   (amount = stdin_source (source.buffer + source.length, size - source.length, NULL)) > 0)
+      source.length += amount;
 
-    return -errno;
+    if (amount < 0) {
+      fprintf (stderr, "rioutil/pipe_upload: could not read from stdin: %s\n", strerror (-amount));
+      free (source.buffer);
+      return amount;
+    }
+
+    ret = mp3_stream_info_rio (source.buffer, source.length, &file, &skip);
+    /* stop at the end of the stream */
+    if (ret != -EAGAIN || source.length < size)
+      break;
   }
 
-  while ((ret = read (0, file_buffer, 1024)) > 0)
-    write (fd, file_buffer, ret);
+  if (ret != URIO_SUCCESS) {
+    fprintf (stderr, "rioutil/pipe_upload: no MPEG audio found at the start of the stream\n");
+    free (source.buffer);
+    return -EINVAL;
+  }
 
-  close (fd);
+  source.offset = skip;
 
-  error = add_song_rio (rio, mem_unit, file_name, artist, title, album);
+  ret = upload_stream_rio (rio, mem_unit, &file, pipe_source_read, &source);
 
-  /* delete the temporary file */
-  ret = unlink (file_name);
-  if (ret < 0)
-    fprintf (stderr, "rioutil/pipe_upload: could not destroy temporary file: %s\n", strerror (errno));
+  free (source.buffer);
 
-  return error;
+  return ret;
 }
 
-static void process_song (rios_t *rio, struct _song *p) {
+static void process_song (rios_t *rio, rio_prepare_t *prepare, struct _song *p) {
   int ret, mem_unit, mem_units;
   char display_name[32];
   struct stat statinfo;
@@ -417,17 +513,6 @@ static void process_song (rios_t *rio, struct _song *p) {
     return;
   }
 
-  if (S_ISDIR(statinfo.st_mode)) {
-    /* add files from directory */
-    dir_add_songs (p->filename, p->recursive_depth, p->mem_unit);
-    return;
-  }
-
-  if (!S_ISREG(statinfo.st_mode)) {
-    printf("rioutil/src/main.c add_track: %s is not a regular file!\n", p->filename);
-    return;
-  }
-
   file_name = basename_simple (p->filename);
   file_namel = strlen (file_name);
 
@@ -459,7 +544,10 @@ static void process_song (rios_t *rio, struct _song *p) {
   }
 
   if (p->mem_unit >= 0) {
-    ret = add_song_rio (rio, p->mem_unit, p->filename, p->artist, p->title, p->album);
+    if (p->prepared >= 0)
+      ret = add_prepared_song_rio (rio, p->mem_unit, prepare, p->prepared);
+    else
+      ret = add_song_rio (rio, p->mem_unit, p->filename, p->artist, p->title, p->album);
   }
 
   if (ret == URIO_SUCCESS) 
@@ -469,18 +557,107 @@ static void process_song (rios_t *rio, struct _song *p) {
 }
 
 static int add_tracks (rios_t *rio){
-  struct _song *p;
+  struct _song *p, **songs = NULL, **tmp;
+  struct stat statinfo;
+  rio_prepare_t *prepare;
+  int i, nsongs = 0;
+  int ret;
   
   /* set up a signal handler for ^C and kill -15 */
   signal (SIGINT,  aborttransfer);
   signal (SIGTERM, aborttransfer);
-  
+
+  /* read the tags of the queued files on all cores while uploading */
+  if (prepare_open_rio (&prepare, 0) != URIO_SUCCESS)
+    prepare = NULL;
+
+  /* expand directories first so every file can be queued */
   while ((p = upstack_pop()) != NULL) {
-    process_song (rio, p);
+    if (stat (p->filename, &statinfo) < 0)
+      printf ("rioutil/src/main.c add_track: could not stat file %s (%s)\n", p->filename, strerror (errno));
+    else if (S_ISDIR (statinfo.st_mode))
+      /* add files from directory */
+      dir_add_songs (p->filename, p->recursive_depth, p->mem_unit);
+    else if (!S_ISREG (statinfo.st_mode))
+      printf ("rioutil/src/main.c add_track: %s is not a regular file!\n", p->filename);
+    else if ((tmp = (struct _song **) realloc (songs, (nsongs + 1) * sizeof (struct _song *))) != NULL) {
+      songs = tmp;
+      songs[nsongs++] = p;
+
+      p->prepared = prepare ? prepare_add_rio (prepare, p->filename, p->artist, p->title, p->album) : -1;
+      continue;
+    }
+
     free__song (p);
   }
   
-  return 0;
+  /* only rebuild the player's database once */
+  begin_batch_rio (rio);
+
+  for (i = 0 ; i < nsongs ; i++) {
+    process_song (rio, prepare, songs[i]);
+    free__song (songs[i]);
+  }
+
+  free (songs);
+
+  ret = commit_batch_rio (rio);
+
+  prepare_close_rio (prepare);
+
+  return ret;
+}
+
+/* upload the tracks to every attached player at the same time */
+static int sync_tracks (int debug) {
+  int i, ret, players, uploaded, failed;
+  struct stat statinfo;
+  rio_sync_t *sync;
+  struct _song *p;
+
+  printf ("Attempting to open all attached Rios.... ");
+
+  ret = sync_open_rio (&sync, debug);
+  if (ret != URIO_SUCCESS) {
+    printf ("failed!\n");
+
+    fprintf (stderr, "Reason: %s.\n", strerror (-ret));
+
+    exit (EXIT_FAILURE);
+  }
+
+  players = sync_players_rio (sync);
+
+  printf ("complete (%d found)\n", players);
+
+  while ((p = upstack_pop()) != NULL) {
+    if (stat (p->filename, &statinfo) < 0)
+      printf ("rioutil/src/main.c sync_tracks: could not stat file %s (%s)\n", p->filename, strerror (errno));
+    else if (S_ISDIR (statinfo.st_mode))
+      dir_add_songs (p->filename, p->recursive_depth, p->mem_unit);
+    else if (S_ISREG (statinfo.st_mode))
+      /* free space is checked by each player */
+      sync_add_rio (sync, (p->mem_unit < 0) ? 0 : p->mem_unit, p->filename, p->artist, p->title, p->album);
+    else
+      printf ("rioutil/src/main.c sync_tracks: %s is not a regular file!\n", p->filename);
+
+    free__song (p);
+  }
+
+  ret = sync_wait_rio (sync);
+
+  for (i = 0 ; i < players ; i++) {
+    if (sync_status_rio (sync, i, &uploaded, &failed) != URIO_SUCCESS)
+      printf (" Rio %d: could not be opened\n", i);
+    else
+      printf (" Rio %d: %d uploaded, %d failed\n", i, uploaded, failed);
+  }
+
+  sync_close_rio (sync);
+
+  printf (" Command %ssuccessful\n", (ret) ? "un" : "");
+
+  return ret;
 }
 
 static int download_single_file (rios_t *rio, int file, int mem_unit) {
@@ -584,7 +761,16 @@ static int download_tracks (rios_t *rio, char *copt, u_int32_t mem_unit) {
 }
 
 static int delete_tracks (rios_t *rio, char *dopt, u_int32_t mem_unit) {
-  return parse_input (rio, dopt, mem_unit, delete_single_file);
+  int ret, batch_ret;
+
+  /* only rebuild the player's database once */
+  begin_batch_rio (rio);
+
+  ret = parse_input (rio, dopt, mem_unit, delete_single_file);
+
+  batch_ret = commit_batch_rio (rio);
+
+  return ret ? ret : batch_ret;
 }
 
   
@@ -598,8 +784,8 @@ static int intwidth(int i) {
 }
 
 static void new_printfiles(rios_t *rio) {
-  flist_rio_t *tmpf;
-  int j;
+  const flist_rio_t *tmpf;
+  int i, j;
   int id_width;
   int size_width;
   int minutes_width;
@@ -611,20 +797,20 @@ static void new_printfiles(rios_t *rio) {
   unsigned int max_time = 0;
   int num_mem_units;
   
-  flist_rio_t **flst;
+  rio_flist_view_t **views;
   
   num_mem_units = return_mem_units_rio (rio);
   
-  flst = (flist_rio_t**) malloc (sizeof(flist_rio_t *) * num_mem_units);
+  views = (rio_flist_view_t **) calloc (num_mem_units, sizeof (rio_flist_view_t *));
   
   for (j = 0 ; j < num_mem_units ; j++) {
-    if (return_flist_rio (rio, j, RIO_FILETYPE_ALL, &flst[j]) < 0) {
+    if (open_flist_view_rio (rio, j, RIO_FILETYPE_ALL, &views[j]) < 0) {
       printf ("Could not retrieve the file list from memory unit %i\n", j);
 
       continue;
     }
     
-    for (tmpf = flst[j]; tmpf ; tmpf = tmpf->next) {
+    for (i = 0 ; (tmpf = flist_view_entry_rio (views[j], i)) ; i++) {
       max_title_width = max(max_title_width,(int)strlen(tmpf->title));
       max_name_width = max(max_name_width,(int)strlen(tmpf->name));
       max_id = max(max_id, tmpf->num);
@@ -664,7 +850,7 @@ static void new_printfiles(rios_t *rio) {
       printf("[m");
 
     
-    for (tmpf = flst[j]; tmpf ; tmpf = tmpf->next) {
+    for (i = 0 ; (tmpf = flist_view_entry_rio (views[j], i)) ; i++) {
       printf("%*i | %*s |  %*s | %*i:%02i %*i %*i 0x%02x %i\n",
 	     id_width, tmpf->num,
 	     max_title_width, tmpf->title,
@@ -673,11 +859,14 @@ static void new_printfiles(rios_t *rio) {
 	     (tmpf->time % 60),
 	     size_width, tmpf->size / 1024, 7, tmpf->bitrate, tmpf->rio_num, tmpf->inum);
     }
+
+    if (flist_view_size_rio (views[j]) == -ESTALE)
+      printf ("The file list changed while it was being printed. The listing is incomplete.\n");
     
-    free_flist_rio (flst[j]);
+    close_flist_view_rio (views[j]);
   }
   
-  free (flst);
+  free (views);
   
   printf ("\n");
 }
@@ -863,21 +1052,22 @@ static int overwrite_file (rios_t *rio, int mem_unit, int argc, char *argv[]) {
 
 static int print_playlists (rios_t *rio)
 {
-    flist_rio_t *flist, *f;
+    rio_flist_view_t *view;
+    const flist_rio_t *f;
     rio_playlist_t playlist;
     unsigned int i, playlist_count = 0;
-    int ret;
+    int j, ret;
 
     if (!rio)
         return -EINVAL;
 
-    ret = return_flist_rio (rio, 0, RIO_FILETYPE_PLAYLIST, &flist);
+    ret = open_flist_view_rio (rio, 0, RIO_FILETYPE_PLAYLIST, &view);
     if (ret != URIO_SUCCESS)
         return ret;
 
     printf("Playlists:\n\n");
 
-    for (f = flist; f; f = f->next)
+    for (j = 0 ; (f = flist_view_entry_rio (view, j)) ; j++)
     {
         playlist_count++;
 
@@ -890,8 +1080,10 @@ static int print_playlists (rios_t *rio)
             printf("    %d\n", playlist.songs[i]); /* TODO print song name */
     }
 
-    free_flist_rio (flist);
-    flist = NULL;
+    if (flist_view_size_rio (view) == -ESTALE)
+        printf("The file list changed while it was being printed. The listing is incomplete.\n");
+
+    close_flist_view_rio (view);
 
     printf ("Total playlists: %d\n", playlist_count);
 
@@ -947,6 +1139,9 @@ static void usage (void) {
 #else
   printf("  -o, --device=<int>     minor number of rio (assigned by driver), /dev/urio?\n");
 #endif
+  printf("  -A, --all              upload to every attached rio at the same time\n");
+  printf("  -C, --cache            use the cached file list if the rio has not changed\n");
+  printf("                         and the cached info of files that have not changed\n");
   printf("  -k, --nocolor          supress ansi color\n");
   printf("  -m, --memory=<int>     memory unit to upload/download/delete/format to/from\n");
   printf("  -e, --debug            increase verbosity level.\n");
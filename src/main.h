@@ -57,6 +57,9 @@ struct _song {
   char *filename;
 
   int recursive_depth;
+
+  /* index in the metadata queue (see add_tracks) or -1 */
+  int prepared;
 };
 
 struct stack_item {